@@ -398,7 +398,8 @@ class SPA{
      * @return a const version of this SPA
      */
     operator SPA<const T>(){
-      return SPA<const T>(*this);
+      // go via const so the converting constructor is used rather than this
+      return SPA<const T>(static_cast<const SPA<T>&>(*this));
     }
 
     #ifdef IOSTREAM
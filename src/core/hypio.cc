@@ -3,6 +3,8 @@
  * @brief Implementation of hypio.hh
  */
 #include "hypio.hh"
+#include <cstring>
+#include <string>
 
 IOResult read(HypIStream& s,int& i,const int& base){
   return s.read(i,base);
@@ -10,15 +12,58 @@ IOResult read(HypIStream& s,int& i,const int& base){
 IOResult read(HypIStream& s,SPA<char const>& str,const bool& quote){
   return s.read(str,quote);
 }
+IOResult read(HypIStream& s,int* dst,int n,const int& base){
+  return s.read(dst,n,base);
+}
+
+IOResult HypIStream::read(int* dst,int n,const int& base){
+  IOResult r;
+  for(int i=0;i<n;++i)
+    if(!(r=read(dst[i],base)).ok)
+      return r;
+  return r;
+}
 
 const char* HypOStream::quotechars="\"'|\\/^_!@#~.=+-$*\3\1\2";
 
+char HypOStream::quoteFor(const char* str){
+  for(const char* d=quotechars;*d;++d)
+    if(strchr(str,*d)==0)
+      return *d;
+  return '\0';
+}
+
+bool HypIStream::isTextString(const char* str,int len,bool quote){
+  if(memchr(str,'\0',len)!=0)
+    return false;
+  if(quote){
+    std::string tmp(str,len);
+    return HypOStream::quoteFor(tmp.c_str())!='\0';
+  }
+  if(len==0)
+    return false;
+  for(int i=0;i<len;++i)
+    if(isspace(str[i]))
+      return false;
+  return true;
+}
+
 bool write(HypOStream& s,const int& i,const int& base){
   return s.write(i,base);
 }
 bool write(HypOStream& s,const char*& str,const bool& quote){
   return s.write(str,quote);
 }
+bool write(HypOStream& s,const int* src,int n,const int& base){
+  return s.write(src,n,base);
+}
+
+bool HypOStream::write(const int* src,int n,const int& base){
+  for(int i=0;i<n;++i)
+    if(!write(src[i],base))
+      return false;
+  return true;
+}
 
 IOResult read(HypIStream& s,bool& b){
   int tmp;
@@ -13,6 +13,11 @@
  * When reading make sure to leave the object in a consistent (if non-sensical) state when
  * reading it. e.g. if reading an array make sure the array is the size you claim to have made
  * it and everything has a valid value.
+ *
+ * Streams are text by default. An output stream can be switched to a compact binary form with
+ * HypOStream::setBinary which starts with a header so input streams can tell which form they are
+ * reading. In the binary form integers are zigzag encoded varints and strings are a varint length
+ * followed by the characters, so the base, quoting and whitespace are all ignored.
  */
 
 #define USE_CLIM
@@ -27,6 +32,30 @@
 #ifndef HYPIO_HH_INC
 #define HYPIO_HH_INC 
 
+///The bytes at the start of a stream in the binary form
+const char HYPIO_BINARY_MAGIC[]="\x7fHMB";
+///The number of bytes in HYPIO_BINARY_MAGIC
+const int HYPIO_BINARY_MAGIC_LEN=4;
+///The version of the binary form which is written as a varint after the magic bytes
+const int HYPIO_BINARY_VERSION=1;
+
+///Map an integer to an unsigned one so small negative numbers are small too
+/**
+ * @param i the integer
+ * @return 2*i for positive i and -2*i-1 for negative i
+ */
+inline unsigned int zigzagEncode(int i){
+  return ((unsigned int)i<<1)^(unsigned int)(i>>31);
+}
+///Reverse zigzagEncode
+/**
+ * @param u the encoded integer
+ * @return the original integer
+ */
+inline int zigzagDecode(unsigned int u){
+  return (int)(u>>1)^-(int)(u&1);
+}
+
 ///A structure used to store the status of a read
 struct IOResult{
   bool ok;///< True if the read happend sucessfully
@@ -44,6 +73,16 @@ struct IOResult{
  */
 class HypIStream{
   protected:
+    ///The form of the data being read
+    enum Format{
+      UNKNOWN,///<nothing has been read yet so the form hasn't been checked
+      TEXT,///<the text form
+      BINARY,///<the binary form
+      UNSUPPORTED///<the binary form from a newer version which can't be read
+    };
+    Format format;///<the form of the data being read
+    ///constructor for a stream that hasn't checked the form of its data yet
+    HypIStream():format(UNKNOWN){}
     ///Read a integer from the stream
     /**
      * Also reads a special form for maximum or minimum values of * and -* respectively
@@ -63,10 +102,33 @@ class HypIStream{
      * @return an IOResult object that contains the status of the read
      */
     virtual IOResult read(SPA<char const>& str,const bool& quote)=0;
+    ///Read a number of integers from the stream
+    /**
+     * The default reads them one at a time. Implementations can do this faster by not
+     * going through a virtual call and the whitespace handling for every integer.
+     * @param dst the array to store the integers in
+     * @param n the number of integers to read
+     * @param base the base to read the integers in. 0 means guess based on possible prefix
+     * @return an IOResult object that contains the status of the read
+     */
+    virtual IOResult read(int* dst,int n,const int& base);
     ///Allow the public functions to access the protected implementations
     friend IOResult read(HypIStream& s,int& i,const int& base);
     ///Allow the public functions to access the protected implementations
+    friend IOResult read(HypIStream& s,int* dst,int n,const int& base);
+    ///Allow the public functions to access the protected implementations
     friend IOResult read(HypIStream& s,SPA<char const>& str,const bool& quote);
+    ///Check a string read from the binary form could be written in the text form
+    /**
+     * Strings in the binary form can hold anything, but an unquoted string has to be a
+     * single word and a quoted one needs a quote character that isn't in it. Rejecting the
+     * others when reading keeps everything that is read writable in both forms.
+     * @param str the string
+     * @param len the length of the string
+     * @param quote if the string is quoted
+     * @return true if it could be written in the text form
+     */
+    static bool isTextString(const char* str,int len,bool quote);
   public:
     ///Check if a character is considered a space by the hypio system
     inline static bool isspace(const char& c){return c == ' ' || c == '\f' || c == '\n' || c == '\r' || c == '\t' || c == '\v';}
@@ -94,6 +156,16 @@ IOResult read(HypIStream& s,int& i,const int& base=0);
  * @return an IOResult object that contains the status of the read
  */
 IOResult read(HypIStream& s,SPA<char const>& str,const bool& quote);
+///Read a number of integers from the stream
+/**
+ * This is the same as reading each integer in turn but faster
+ * @param s the stream to read from
+ * @param dst the array to store the integers in. Those before any error are set
+ * @param n the number of integers to read
+ * @param base the base to read the integers in. 0 means guess based on possible prefix
+ * @return an IOResult object that contains the status of the read
+ */
+IOResult read(HypIStream& s,int* dst,int n,const int& base=0);
 
 ///Base class for outputting to in the hypio system
 /**
@@ -125,9 +197,20 @@ class HypOStream{
      * @return true if str was written ok
      */
     virtual bool write(const char*& str,const bool& quote)=0;
+    ///write a number of integers to this stream in the specified base
+    /**
+     * The default writes them one at a time
+     * @param src the integers to write
+     * @param n the number of integers
+     * @param base the base to write the integers in. 0 means use a base with prefix
+     * @return true if they were all written ok
+     */
+    virtual bool write(const int* src,int n,const int& base);
     ///Allow the public functions to access the protected implementations
     friend bool write(HypOStream& s,const int& i,const int& base);
     ///Allow the public functions to access the protected implementations
+    friend bool write(HypOStream& s,const int* src,int n,const int& base);
+    ///Allow the public functions to access the protected implementations
     friend bool write(HypOStream& s,const char*& str,const bool& quote);
     ///Get and reset the next space for this stream
     /**
@@ -144,6 +227,12 @@ class HypOStream{
       return tmp;
     }
   public:
+    ///Find a quote character for a string
+    /**
+     * @param str the string to quote
+     * @return the first of quotechars that isn't in the string or '\0' if they all are
+     */
+    static char quoteFor(const char* str);
     ///virtual destructor to allow deletion of base class type objects
     virtual ~HypOStream(){};
     ///Set the whitespace to use next time one is needed
@@ -160,6 +249,13 @@ class HypOStream{
     inline void setDefaultSpace(const char* space){
       defaultspace=space;
     }
+    ///Switch to writing the binary form
+    /**
+     * This must be called before anything else is written as it writes the header
+     * that lets input streams detect the binary form.
+     * @return true if the stream supports the binary form and the header was written
+     */
+    virtual bool setBinary(){return false;}
     ///force writing of any data to the underlying storage
     virtual void flush()=0;
 };
@@ -182,6 +278,16 @@ bool write(HypOStream& s,const int& i,const int& base=0);
  * @return true if str was written ok
  */
 bool write(HypOStream& s,const char*& str,const bool& quote);
+///write a number of integers to a stream in the specified base
+/**
+ * This is the same as writing each integer in turn but faster
+ * @param s the stream to write to
+ * @param src the integers to write
+ * @param n the number of integers
+ * @param base the base to write the integers in. 0 means use a base with prefix
+ * @return true if they were all written ok
+ */
+bool write(HypOStream& s,const int* src,int n,const int& base=0);
 
 ///read a boolean from a stream
 /**
@@ -0,0 +1,198 @@
+/**
+ * @file levelpack.cc
+ * @brief Implementation of levelpack.hh
+ */
+#include "levelpack.hh"
+#include "maze.hh"
+#include "script.hh"
+#include "../shared/memoryhypioimp.hh"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+/// The number of bytes before the index
+static const int LEVELPACK_HEADER_LEN=LEVELPACK_MAGIC_LEN+4;
+
+/// Orders levels by their names
+struct NameOrder{
+  const std::vector<LevelPackEntry>& entries;///< the levels being ordered
+  /// Create an ordering for some levels
+  /**
+   * @param entries the levels
+   */
+  NameOrder(const std::vector<LevelPackEntry>& entries):entries(entries){};
+  /// Compare two levels
+  /**
+   * @param a the first level
+   * @param b the second level
+   * @return true if a comes before b
+   */
+  bool operator()(int a,int b) const{
+    return strcmp(&*entries[a].name,&*entries[b].name)<0;
+  }
+  /// Compare a level with a name
+  /**
+   * @param a the level
+   * @param name the name
+   * @return true if a comes before name
+   */
+  bool operator()(int a,const char* name) const{
+    return strcmp(&*entries[a].name,name)<0;
+  }
+};
+
+LevelPack::LevelPack():data(),len(0),start(0),entries(),byName(){}
+
+bool LevelPack::open(SPA<const char> _data,int _len){
+  data=SPA<const char>();
+  len=start=0;
+  entries.clear();
+  byName.clear();
+  if(_len<LEVELPACK_HEADER_LEN || memcmp(&*_data,LEVELPACK_MAGIC,LEVELPACK_MAGIC_LEN)!=0)
+    return false;
+  unsigned int indexlen=0;
+  for(int i=3;i>=0;--i)
+    indexlen=indexlen<<8|(unsigned char)_data[LEVELPACK_MAGIC_LEN+i];
+  if(indexlen>(unsigned int)(_len-LEVELPACK_HEADER_LEN))
+    return false;
+  int levelstart=LEVELPACK_HEADER_LEN+indexlen;
+
+  MemoryHypIStream s(&*_data+LEVELPACK_HEADER_LEN,indexlen);
+  int version,count;
+  if(!::read(s,version,10).ok || version!=LEVELPACK_VERSION || !::read(s,count,10).ok)
+    return false;
+  // every entry takes at least 7 bytes so a count that can't fit is corrupt
+  if(count<0 || count>(int)indexlen/7)
+    return false;
+  std::vector<LevelPackEntry> index(count);
+  for(int i=0;i<count;++i){
+    LevelPackEntry& e=index[i];
+    int checksum;
+    if(!(::read(s,e.name,true).ok && ::read(s,e.offset,10).ok && ::read(s,e.size,10).ok && ::read(s,checksum,16).ok &&
+         ::read(s,e.dimensions.X,10).ok && ::read(s,e.dimensions.Y,10).ok && ::read(s,e.dimensions.Z,10).ok))
+      return false;
+    e.checksum=checksum;
+    if(e.offset<0 || e.size<0 || e.offset>_len-levelstart || e.size>_len-levelstart-e.offset)
+      return false;
+  }
+  std::vector<int> order(count);
+  for(int i=0;i<count;++i)
+    order[i]=i;
+  std::sort(order.begin(),order.end(),NameOrder(index));
+
+  data=_data;
+  len=_len;
+  start=levelstart;
+  entries.swap(index);
+  byName.swap(order);
+  return true;
+}
+
+int LevelPack::find(const char* name) const{
+  std::vector<int>::const_iterator it=std::lower_bound(byName.begin(),byName.end(),name,NameOrder(entries));
+  if(it==byName.end() || strcmp(&*entries[*it].name,name)!=0)
+    return -1;
+  return *it;
+}
+
+bool LevelPack::check(int i) const{
+  return levelPackChecksum(level(i),entries[i].size)==entries[i].checksum;
+}
+
+IOResult LevelPack::read(int i,Maze& m,Script& sc) const{
+  if(!check(i))
+    return IOResult(false,false);
+  MemoryHypIStream s(level(i),entries[i].size);
+  IOResult r;
+  if(!(r=::read(s,m)).ok)
+    return r;
+  sc=Script();// reset it to blank as a default
+  return ::read(s,sc);
+}
+
+bool LevelPackWriter::add(const char* name,const char* data,int len){
+  if(!*name || strchr(name,LEVELPACK_SEPARATOR))
+    return false;
+  for(unsigned int i=0;i<entries.size();++i)
+    if(strcmp(&*entries[i].name,name)==0)
+      return false;
+  Maze m(Vector(3,3,3));
+  Script sc;
+  MemoryHypIStream s(data,len);
+  if(!read(s,m).ok || !read(s,sc).ok)
+    return false;
+
+  LevelPackEntry e;
+  int namelen=strlen(name);
+  SPA<char> copy(namelen+1);
+  memcopy(copy,name,namelen+1);
+  e.name=copy;
+  e.offset=levels.size();
+  e.size=len;
+  e.checksum=levelPackChecksum(data,len);
+  e.dimensions=m.size();
+  entries.push_back(e);
+  levels.insert(levels.end(),data,data+len);
+  return true;
+}
+
+bool LevelPackWriter::write(SPA<char>& out,int& len) const{
+  SPA<char> index;
+  MemoryHypOStream s(index);
+  s.setBinary();
+  bool status=::write(s,LEVELPACK_VERSION,10);
+  status&=::write(s,(int)entries.size(),10);
+  for(unsigned int i=0;i<entries.size();++i){
+    const LevelPackEntry& e=entries[i];
+    status&=::write(s,e.name,true);
+    status&=::write(s,e.offset,10);
+    status&=::write(s,e.size,10);
+    status&=::write(s,(int)e.checksum,16);
+    status&=::write(s,e.dimensions.X,10);
+    status&=::write(s,e.dimensions.Y,10);
+    status&=::write(s,e.dimensions.Z,10);
+  }
+  s.flush();
+  if(!status)
+    return false;
+
+  len=LEVELPACK_HEADER_LEN+s.strlen+levels.size();
+  out=SPA<char>(len);
+  memcopy(out,LEVELPACK_MAGIC,LEVELPACK_MAGIC_LEN);
+  for(int i=0;i<4;++i)
+    out[LEVELPACK_MAGIC_LEN+i]=(char)(s.strlen>>(8*i));
+  memcopy(out+LEVELPACK_HEADER_LEN,(SPA<const char>)index,s.strlen);
+  if(!levels.empty())
+    memcopy(out+LEVELPACK_HEADER_LEN+s.strlen,&levels[0],levels.size());
+  return true;
+}
+
+unsigned int levelPackChecksum(const char* data,int len){
+  unsigned int h=2166136261u;
+  for(int i=0;i<len;++i){
+    h^=(unsigned char)data[i];
+    h*=16777619u;
+  }
+  return h;
+}
+
+bool splitLevelPath(const char* path,SPA<const char>& pack,SPA<const char>& name){
+  if(!path)
+    return false;
+  const char* sep=strrchr(path,LEVELPACK_SEPARATOR);
+  if(!sep || sep-path<4)
+    return false;
+  const char* ext=sep-4;
+  if(ext[0]!='.' || tolower(ext[1])!='h' || tolower(ext[2])!='m' || tolower(ext[3])!='p')
+    return false;
+  int packlen=sep-path;
+  SPA<char> p(packlen+1);
+  memcopy(p,path,packlen);
+  p[packlen]='\0';
+  int namelen=strlen(sep+1);
+  SPA<char> n(namelen+1);
+  memcopy(n,sep+1,namelen+1);
+  pack=p;
+  name=n;
+  return true;
+}
@@ -0,0 +1,157 @@
+/**
+ * @file levelpack.hh
+ * @brief A single file holding many levels with an index to find each one
+ */
+
+#include "vector.hh"
+#include "SmartPointer.hh"
+#include "hypio.hh"
+#include <vector>
+
+#ifndef LEVELPACK_HH_INC
+#define LEVELPACK_HH_INC
+
+class Maze;
+class Script;
+
+///The bytes at the start of a level pack
+const char LEVELPACK_MAGIC[]="\x7fHMP";
+///The number of bytes in LEVELPACK_MAGIC
+const int LEVELPACK_MAGIC_LEN=4;
+///The version of the level pack form
+const int LEVELPACK_VERSION=1;
+///The character separating the pack from the name of the level in a level path
+const char LEVELPACK_SEPARATOR='#';
+
+/// The entry in the index of a level pack for one level
+struct LevelPackEntry{
+  SPA<const char> name;///< the name of the level
+  int offset;///< the start of the level after the index
+  int size;///< the number of bytes in the level
+  unsigned int checksum;///< the checksum of the level, see levelPackChecksum
+  Vector dimensions;///< the size of the maze of the level
+};
+
+/// A set of levels stored in one file
+/**
+ * The file starts with LEVELPACK_MAGIC then the length of the index as 4 bytes
+ * with the lowest first. The index is a hypio stream in the binary form with the
+ * version, the number of levels and then an entry for each level (see
+ * LevelPackEntry). After the index the levels are stored one after another exactly
+ * as they would be in their own files, text or binary.
+ *
+ * Only the index is read when a pack is opened. Any level can then be found
+ * straight away and is checked and read only when asked for.
+ */
+class LevelPack{
+  SPA<const char> data;///< the whole pack
+  int len;///< the length of the pack
+  int start;///< the start of the levels
+  std::vector<LevelPackEntry> entries;///< the index
+  std::vector<int> byName;///< the levels in order of their names
+
+  public:
+    /// Create an empty pack
+    LevelPack();
+
+    /// Open a pack from its data
+    /**
+     * @param data the whole of the pack which is kept by the pack
+     * @param len the length of the data
+     * @return false if the index is corrupt in which case the pack is left empty
+     */
+    bool open(SPA<const char> data,int len);
+
+    /// Get the number of levels
+    /**
+     * @return the number of levels
+     */
+    inline int levels() const{
+      return entries.size();
+    }
+    /// Get the index entry of a level
+    /**
+     * @param i the level from 0 to levels()-1
+     * @return the entry
+     */
+    inline const LevelPackEntry& operator[](int i) const{
+      return entries[i];
+    }
+    /// Find a level by name
+    /**
+     * @param name the name of the level
+     * @return the level or -1 if there isn't one with that name
+     */
+    int find(const char* name) const;
+
+    /// Get the data of a level
+    /**
+     * @param i the level from 0 to levels()-1
+     * @return the start of the level in the pack. There is no null after it
+     */
+    inline const char* level(int i) const{
+      return &*data+start+entries[i].offset;
+    }
+    /// Check that the data of a level matches its checksum
+    /**
+     * @param i the level from 0 to levels()-1
+     * @return true if it matches
+     */
+    bool check(int i) const;
+    /// Check and read a level
+    /**
+     * @param i the level from 0 to levels()-1
+     * @param m the maze to read into
+     * @param sc the script to read into which is reset first
+     * @return the result of the read which fails if the level doesn't match its checksum
+     */
+    IOResult read(int i,Maze& m,Script& sc) const;
+};
+
+/// Builds the data of a level pack
+class LevelPackWriter{
+  std::vector<LevelPackEntry> entries;///< the index so far
+  std::vector<char> levels;///< the levels so far
+
+  public:
+    /// Add a level to the pack
+    /**
+     * The level is read to make sure it is valid and to find the size of its maze
+     * @param name the name of the level which can't be empty, contain
+     * LEVELPACK_SEPARATOR or be the same as another level's
+     * @param data the level as it would be stored in a file
+     * @param len the length of the data
+     * @return false if the level wasn't added
+     */
+    bool add(const char* name,const char* data,int len);
+    /// Get the data of the pack
+    /**
+     * @param out set to the data
+     * @param len set to the length of the data
+     * @return true if it was made ok
+     */
+    bool write(SPA<char>& out,int& len) const;
+};
+
+/// Calculate the checksum of a level in a pack
+/**
+ * This is the 32 bit FNV-1a hash
+ * @param data the data of the level
+ * @param len the length of the data
+ * @return the checksum
+ */
+unsigned int levelPackChecksum(const char* data,int len);
+
+/// Split a path to a level in a pack into the pack and the name of the level
+/**
+ * A level in a pack is given as the path of the pack, which must end in .hmp,
+ * then LEVELPACK_SEPARATOR and the name of the level, e.g. levels/tutorial.hmp#tutorial-2.
+ * It works for urls as well as local paths.
+ * @param path the path
+ * @param pack set to the path of the pack
+ * @param name set to the name of the level
+ * @return false if the path isn't a level in a pack
+ */
+bool splitLevelPath(const char* path,SPA<const char>& pack,SPA<const char>& name);
+
+#endif
@@ -3,7 +3,10 @@
  * @brief Implementation of maze.hh
  */
 #include "maze.hh"
+#include "mazecoder.hh"
+#include <climits>
 #include <cstring>
+#include <vector>
 
 using namespace std;
 
@@ -80,6 +83,108 @@ void prettyPrint(std::ostream& o,Maze m,int w){
 }
 #endif
 
+/// The number of bytes of compressed data on each line
+const int ASCII85_LINE_BYTES=64;
+
+/// Read compressed data written as lines of ascii85
+/**
+ * @param s the stream to read from
+ * @param len the number of bytes
+ * @param data set to the data
+ * @return the result of the read
+ */
+static IOResult readAscii85(HypIStream& s,int len,std::vector<unsigned char>& data){
+  IOResult r;
+  data.clear();
+  while((int)data.size()<len){
+    SPA<const char> line;
+    if(!(r=read(s,line,false)).ok)
+      return r;
+    int chars=strlen(line);
+    int bytes=chars/5*4+(chars%5?chars%5-1:0);
+    // only the last line can end in a part of a group
+    if(chars%5==1 || bytes>len-(int)data.size() || (chars%5 && bytes!=len-(int)data.size()))
+      return IOResult(false,r.eof);
+    for(int i=0;i<chars;i+=5){
+      int n=chars-i<5?chars-i:5;
+      unsigned long long v=0;
+      for(int j=0;j<5;++j){
+        // a part of a group is padded with the last digit
+        int c=(j<n?line[i+j]:'u')-'!';
+        if(c<0 || c>=85)
+          return IOResult(false,r.eof);
+        v=v*85+c;
+      }
+      if(v>0xffffffffull)
+        return IOResult(false,r.eof);
+      for(int j=0;j<n-1;++j)
+        data.push_back((unsigned char)(v>>(24-8*j)));
+    }
+  }
+  return r;
+}
+
+/// Write compressed data as lines of ascii85
+/**
+ * @param s the stream to write to
+ * @param data the data
+ * @return the result of the write
+ */
+static bool writeAscii85(HypOStream& s,const std::vector<unsigned char>& data){
+  bool status=true;
+  char line[ASCII85_LINE_BYTES/4*5+1];
+  for(unsigned int start=0;start<data.size();start+=ASCII85_LINE_BYTES){
+    unsigned int end=start+ASCII85_LINE_BYTES<data.size()?start+ASCII85_LINE_BYTES:data.size();
+    int chars=0;
+    for(unsigned int i=start;i<end;i+=4){
+      unsigned int v=0;
+      int n=end-i<4?end-i:4;
+      for(int j=0;j<4;++j)
+        v=v<<8|(j<n?data[i+j]:0);
+      char group[5];
+      for(int j=4;j>=0;--j){
+        group[j]=(char)('!'+v%85);
+        v/=85;
+      }
+      memcpy(line+chars,group,n+1);
+      chars+=n+1;
+    }
+    line[chars]='\0';
+    const char* l=line;
+    s.setNextSpace("\n");
+    status&=write(s,l,false);
+  }
+  return status;
+}
+
+/// The number of cells read before the maze is made larger
+const int READ_CELLS_CHUNK=1<<16;
+
+/// Read cells written as numbers
+/**
+ * The cells are read in chunks that grow as they are read so an input that
+ * claims a large maze but ends early doesn't make the whole maze first.
+ * @param s the stream to read from
+ * @param n the number of cells
+ * @param cells set to the cells
+ * @return the result of the read
+ */
+static IOResult readCells(HypIStream& s,int n,std::vector<int>& cells){
+  IOResult r;
+  cells.clear();
+  int chunk=READ_CELLS_CHUNK;
+  while((int)cells.size()<n){
+    int done=cells.size();
+    int count=n-done<chunk?n-done:chunk;
+    cells.resize(done+count);
+    if(!(r=read(s,&cells[done],count,16)).ok)
+      return r;
+    // as much again next time so a real maze is still only copied a few times
+    chunk=cells.size();
+  }
+  return r;
+}
+
 IOResult read(HypIStream& s,Maze& m){
   Vector thesize;
   IOResult r;
@@ -87,28 +192,52 @@ IOResult read(HypIStream& s,Maze& m){
        (r=read(s,thesize.Y,10)).ok&&
        (r=read(s,thesize.Z,10)).ok))
     return IOResult(false,r.eof);
+  bool compressed=thesize.X<0;
+  if(compressed)
+    thesize.X=thesize.X==INT_MIN?0:-thesize.X;
   if(thesize.X<=2||thesize.Y<=2||thesize.Z<=2)
     return IOResult(false,r.eof);
-  m=Maze(thesize);
-  int pos=-1;//start at -1 so first increment doesn't sift us of the maze
-  while(++pos<thesize.X*thesize.Y*thesize.Z){
-    if(!(r=read(s,m.maze[pos],16)).ok)
+  if((long long)thesize.X*thesize.Y*thesize.Z>MAZE_MAX_CELLS)
+    return IOResult(false,r.eof);
+  // the maze is only made once its data has been read so a short input can't make a large maze
+  if(compressed){
+    int len;
+    if(!(r=read(s,len,10)).ok || len<0)
+      return IOResult(false,r.eof);
+    std::vector<unsigned char> data;
+    if(!(r=readAscii85(s,len,data)).ok || !checkCompressedCells(len?&data[0]:0,len))
+      return IOResult(false,r.eof);
+    m=Maze(thesize);
+    if(!decompressCells(len?&data[0]:0,len,thesize,&m.maze[0]))
       return IOResult(false,r.eof);
+  }else{
+    int n=thesize.X*thesize.Y*thesize.Z;
+    std::vector<int> cells;
+    if(!(r=readCells(s,n,cells)).ok)
+      return IOResult(false,r.eof);
+    m=Maze(thesize);
+    memcpy(&m.maze[0],&cells[0],n*sizeof(int));
   }
   return IOResult(true,r.eof);
 }
 
 bool write(HypOStream& s,const Maze& m){
-  bool status=write(s,m.size().X);
+  return write(s,m,m.size().X*m.size().Y*m.size().Z>=MAZE_COMPRESS_CELLS);
+}
+
+bool write(HypOStream& s,const Maze& m,bool compressed){
+  int cells=m.size().X*m.size().Y*m.size().Z;
+  bool status=write(s,compressed?-m.size().X:m.size().X);
   status&=write(s,m.size().Y);
   status&=write(s,m.size().Z);
   s.setNextSpace("\n");
-  SPA<int> p=m.maze;
-  SPA<int> end=m.maze+m.size().X*m.size().Y*m.size().Z;
-  while(p!=end){
-    status&=write(s,*p,16);
-    ++p;
-  }
+  if(compressed){
+    std::vector<unsigned char> data;
+    compressCells(&m.maze[0],m.size(),data);
+    status&=write(s,(int)data.size());
+    status&=writeAscii85(s,data);
+  }else
+    status&=write(s,&m.maze[0],cells,16);
   return status;
 }
 
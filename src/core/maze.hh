@@ -18,6 +18,20 @@
 class Point;
 class ConstPoint;
 
+/// The number of cells from which a maze is written in the compressed form
+/**
+ * Smaller mazes are written as a list of hex numbers so level files can still be
+ * edited by hand. See compressCells for the compressed form.
+ */
+const int MAZE_COMPRESS_CELLS=32768;
+
+/// The most cells a maze that is read can have
+/**
+ * A 256x256x256 maze fits. Anything bigger is taken as a corrupt size rather than
+ * trying to make a maze that can't be played anyway.
+ */
+const int MAZE_MAX_CELLS=1<<24;
+
 /// A hypermaze
 /**
  * This is the data for a hypermaze.
@@ -99,12 +113,14 @@ class Maze
     #endif
 
     friend IOResult read(HypIStream& s,Maze& m);
-    friend bool write(HypOStream& s,const Maze& m);
+    friend bool write(HypOStream& s,const Maze& m,bool compressed);
 
 };
 
 ///Read a maze from an input stream
 /**
+ * Either form written by write(HypOStream&,const Maze&) is read. Mazes with more
+ * than MAZE_MAX_CELLS cells aren't read.
  * @param s the stream to read from
  * @param m the maze to read into
  * @return the result of the read
@@ -112,11 +128,23 @@ class Maze
 IOResult read(HypIStream& s,Maze& m);
 ///Write a maze to an output stream
 /**
+ * A maze with at least MAZE_COMPRESS_CELLS cells is written compressed.
  * @param s the stream to write to
  * @param m the maze to write
  * @return the result of the write
  */
 bool write(HypOStream& s,const Maze& m);
+///Write a maze to an output stream choosing the form
+/**
+ * The compressed form is marked by writing the size in X as negative, followed by the number
+ * of bytes of compressed data and then the data in ascii85 on lines of 80 characters. Only the
+ * walls are kept in the compressed form.
+ * @param s the stream to write to
+ * @param m the maze to write
+ * @param compressed true to write the compressed form
+ * @return the result of the write
+ */
+bool write(HypOStream& s,const Maze& m,bool compressed);
 
 /// A pointer to a point in the maze
 /**
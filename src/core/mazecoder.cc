@@ -0,0 +1,359 @@
+/**
+ * @file mazecoder.cc
+ * @brief Implementation of mazecoder.hh
+ */
+#include "mazecoder.hh"
+#include "dirns.hh"
+#include <algorithm>
+
+/// The number of bits of precision of the symbol frequencies
+static const int FREQ_BITS=10;
+/// The total of the symbol frequencies of each context
+static const unsigned int FREQ_TOTAL=1<<FREQ_BITS;
+/// The lowest the rANS state can be between symbols
+static const unsigned int RANS_LOW=1u<<23;
+/// The number of symbols, one for each combination of the UP, LEFT and FORWARD bits
+static const int SYMBOLS=8;
+/// The number of contexts the symbols are coded in
+/**
+ * 8 combinations of the predicted bits times 3 for being on the bottom face, the top
+ * face or neither times 2 for the last column in X times 2 for the last slice in Z
+ */
+static const int CONTEXTS=96;
+
+/// Get the DOWN, RIGHT and BACK bits a cell should have from the cells before it
+/**
+ * The result is shifted down so it is 0 to 7
+ * @param left the cell at x-1 or 0 if there isn't one
+ * @param below the cell at y-1 or 0 if there isn't one
+ * @param behind the cell at z-1 or 0 if there isn't one
+ * @return the bits
+ */
+static inline int predict(int left,int below,int behind){
+  return (below&to_mask(UP))|(left&to_mask(LEFT))|(behind&to_mask(FORWARD));
+}
+
+/// Get the context a cell is coded in
+/**
+ * @param known the DOWN, RIGHT and BACK bits of the cell shifted down
+ * @param yface 0 on the bottom face, 1 on the top face and 2 for neither
+ * @param lastx if the cell is in the last column in X
+ * @param lastz if the cell is in the last slice in Z
+ * @return the context
+ */
+static inline int context(int known,int yface,bool lastx,bool lastz){
+  return ((known*3+yface)*2+lastx)*2+lastz;
+}
+
+/// Get which face of the maze in Y a row is on
+/**
+ * @param y the row
+ * @param size the size of the maze
+ * @return 0 on the bottom face, 1 on the top face and 2 for neither
+ */
+static inline int yFace(int y,const Vector& size){
+  return y==0?0:(y==size.Y-1?1:2);
+}
+
+/// Add an unsigned varint to some data
+/**
+ * @param out the data
+ * @param u the value
+ */
+static void putVarint(std::vector<unsigned char>& out,unsigned int u){
+  while(u>=0x80){
+    out.push_back((unsigned char)(u|0x80));
+    u>>=7;
+  }
+  out.push_back((unsigned char)u);
+}
+
+/// Read an unsigned varint
+/**
+ * @param p the next byte to read which is moved past the varint
+ * @param end the end of the data
+ * @param u set to the value
+ * @return false if the data ran out or the varint is too long
+ */
+static bool getVarint(const unsigned char*& p,const unsigned char* end,unsigned int& u){
+  u=0;
+  for(int shift=0;shift<35;shift+=7){
+    if(p>=end)
+      return false;
+    unsigned char c=*p++;
+    u|=(unsigned int)(c&0x7f)<<shift;
+    if(!(c&0x80))
+      return true;
+  }
+  return false;
+}
+
+/// Scale the counts of the symbols in a context to frequencies adding up to FREQ_TOTAL
+/**
+ * Every symbol that was seen keeps a frequency of at least 1
+ * @param count the counts of the symbols
+ * @param freq set to the frequencies which are all 0 if nothing was seen
+ */
+static void normalise(const unsigned int* count,unsigned int* freq){
+  unsigned long long total=0;
+  for(int s=0;s<SYMBOLS;++s)
+    total+=count[s];
+  unsigned int sum=0;
+  int largest=0;
+  for(int s=0;s<SYMBOLS;++s){
+    freq[s]=0;
+    if(count[s]){
+      freq[s]=(unsigned int)(count[s]*(unsigned long long)FREQ_TOTAL/total);
+      if(freq[s]==0)
+        freq[s]=1;
+    }
+    sum+=freq[s];
+    if(freq[s]>freq[largest])
+      largest=s;
+  }
+  // the largest is at least an eighth of the total so it can take up the rounding
+  if(total)
+    freq[largest]+=FREQ_TOTAL-sum;
+}
+
+void compressCells(const int* cells,const Vector& size,std::vector<unsigned char>& out){
+  int n=size.X*size.Y*size.Z;
+  int slice=size.X*size.Y;
+  std::vector<unsigned char> contexts(n);
+  std::vector<unsigned int> counts(CONTEXTS*SYMBOLS,0);
+  std::vector<unsigned char> exceptions;
+  int exceptionCount=0;
+  int lastException=0;
+  const int walls=ALLDIRNSMASK;
+  for(int z=0,i=0;z<size.Z;++z)
+    for(int y=0;y<size.Y;++y){
+      int yface=yFace(y,size);
+      for(int x=0;x<size.X;++x,++i){
+        int left=x?cells[i-1]&walls:0;
+        int below=y?cells[i-size.X]&walls:0;
+        int behind=z?cells[i-slice]&walls:0;
+        int known=(cells[i]&walls)>>3;
+        if(known!=predict(left,below,behind)){
+          putVarint(exceptions,i-lastException);
+          exceptions.push_back((unsigned char)known);
+          exceptionCount++;
+          lastException=i+1;
+        }
+        int c=context(known,yface,x==size.X-1,z==size.Z-1);
+        contexts[i]=(unsigned char)c;
+        counts[c*SYMBOLS+(cells[i]&(SYMBOLS-1))]++;
+      }
+    }
+
+  // the contexts used and their frequencies
+  std::vector<unsigned int> freq(CONTEXTS*SYMBOLS);
+  std::vector<unsigned int> cumulative(CONTEXTS*SYMBOLS);
+  unsigned char used[CONTEXTS/8]={0};
+  for(int c=0;c<CONTEXTS;++c){
+    normalise(&counts[c*SYMBOLS],&freq[c*SYMBOLS]);
+    unsigned int cum=0;
+    for(int s=0;s<SYMBOLS;++s){
+      cumulative[c*SYMBOLS+s]=cum;
+      cum+=freq[c*SYMBOLS+s];
+    }
+    if(cum)
+      used[c/8]|=1<<(c%8);
+  }
+  out.clear();
+  out.insert(out.end(),used,used+CONTEXTS/8);
+  for(int c=0;c<CONTEXTS;++c)
+    if(used[c/8]&(1<<(c%8)))
+      for(int s=0;s<SYMBOLS;++s)
+        putVarint(out,freq[c*SYMBOLS+s]);
+  putVarint(out,exceptionCount);
+  out.insert(out.end(),exceptions.begin(),exceptions.end());
+
+  // rANS codes the symbols last first so the bytes are reversed at the end
+  std::vector<unsigned char> coded;
+  unsigned int r=RANS_LOW;
+  for(int i=n-1;i>=0;--i){
+    int k=contexts[i]*SYMBOLS+(cells[i]&(SYMBOLS-1));
+    unsigned int f=freq[k];
+    unsigned int limit=((RANS_LOW>>FREQ_BITS)<<8)*f;
+    while(r>=limit){
+      coded.push_back((unsigned char)r);
+      r>>=8;
+    }
+    r=((r/f)<<FREQ_BITS)+r%f+cumulative[k];
+  }
+  for(int shift=0;shift<32;shift+=8)
+    coded.push_back((unsigned char)(r>>shift));
+  out.insert(out.end(),coded.rbegin(),coded.rend());
+}
+
+/// Read the frequency tables and find the exceptions and the rANS data
+/**
+ * @param data the compressed data
+ * @param len the length of the data
+ * @param base set to where the table for each context starts in slots or -1 if it isn't used
+ * @param slots set to the symbol, its frequency and the slot less its cumulative
+ * frequency for each slot of each table
+ * @param exceptionCount set to the number of exceptions
+ * @param exceptions set to the start of the exceptions
+ * @param coded set to the start of the rANS data
+ * @return false if the data is corrupt
+ */
+static bool readHeader(const unsigned char* data,int len,std::vector<int>& base,std::vector<unsigned int>& slots,
+    unsigned int& exceptionCount,const unsigned char*& exceptions,const unsigned char*& coded){
+  const unsigned char* p=data;
+  const unsigned char* end=data+len;
+
+  // a table for each context used of the symbol, its frequency and the slot less its
+  // cumulative frequency for each slot so decoding a symbol is a single look up
+  if(end-p<CONTEXTS/8)
+    return false;
+  const unsigned char* used=p;
+  p+=CONTEXTS/8;
+  base.assign(CONTEXTS,-1);
+  slots.clear();
+  for(int c=0;c<CONTEXTS;++c){
+    if(!(used[c/8]&(1<<(c%8))))
+      continue;
+    base[c]=slots.size();
+    slots.resize(slots.size()+FREQ_TOTAL);
+    unsigned int cum=0;
+    for(int s=0;s<SYMBOLS;++s){
+      unsigned int f;
+      if(!getVarint(p,end,f) || f>FREQ_TOTAL-cum)
+        return false;
+      for(unsigned int slot=cum;slot<cum+f;++slot)
+        slots[base[c]+slot]=s|f<<3|(slot-cum)<<14;
+      cum+=f;
+    }
+    if(cum!=FREQ_TOTAL)
+      return false;
+  }
+
+  // the exceptions are read as they are reached so check them and find where the rANS data starts
+  if(!getVarint(p,end,exceptionCount))
+    return false;
+  exceptions=p;
+  for(unsigned int e=0;e<exceptionCount;++e){
+    unsigned int gap;
+    if(!getVarint(p,end,gap) || p>=end)
+      return false;
+    ++p;
+  }
+  if(end-p<4)
+    return false;
+  coded=p;
+  return ((unsigned int)p[0]<<24|p[1]<<16|p[2]<<8|p[3])>=RANS_LOW;
+}
+
+/// Decode the cells of a maze
+/**
+ * @param data the compressed data
+ * @param len the length of the data
+ * @param size the size of the maze
+ * @param cells where to store the cells
+ * @param done set to the number of cells decoded
+ * @return false if the data is corrupt
+ */
+static bool decodeCells(const unsigned char* data,int len,const Vector& size,int* cells,int& done){
+  int slice=size.X*size.Y;
+  const unsigned char* end=data+len;
+  done=0;
+
+  std::vector<int> base;
+  std::vector<unsigned int> slots;
+  unsigned int exceptionCount;
+  const unsigned char* q;
+  const unsigned char* p;
+  if(!readHeader(data,len,base,slots,exceptionCount,q,p))
+    return false;
+  unsigned int n=size.X*size.Y*size.Z;
+  unsigned int nextException=n;
+  if(exceptionCount)
+    getVarint(q,end,nextException);
+  unsigned int r=0;
+  for(int b=0;b<4;++b)
+    r=(r<<8)|*p++;
+  // each symbol takes at most 2 bytes so with enough padding for a row the reading only
+  // needs checking at the end of each row
+  std::vector<unsigned char> padded(p,end);
+  int coded=padded.size();
+  padded.resize(coded+2*size.X+2,0);
+  const unsigned char* in=&padded[0];
+  const unsigned char* inend=in+coded;
+
+  // copies so the compiler knows storing cells doesn't change them
+  const int X=size.X,Y=size.Y,Z=size.Z;
+  const int* bases=&base[0];
+  const unsigned int* table=&slots[0];
+  // the row used for the cells below or behind the first row or slice
+  std::vector<int> zeros(X,0);
+  unsigned int i=0;
+  for(int z=0;z<Z;++z)
+    for(int y=0;y<Y;++y){
+      const int* below=y?cells+i-X:&zeros[0];
+      const int* behind=z?cells+i-slice:&zeros[0];
+      int* row=cells+i;
+      int yface=yFace(y,size);
+      int left=0;
+      for(int x=0;x<X;++x){
+        int known;
+        int c;
+        if(i+x==nextException){
+          known=*q++&(SYMBOLS-1);
+          nextException=n;
+          if(--exceptionCount){
+            unsigned int gap;
+            getVarint(q,end,gap);
+            // a gap past the end of the maze is never reached
+            if(gap<n-i-x)
+              nextException=i+x+1+gap;
+          }
+          c=bases[context(known,yface,x==X-1,z==Z-1)];
+        }else{
+          // the contexts for both values of the bit from the previous cell are looked up
+          // first and picked between without a branch as the bit can't be predicted
+          int rest=predict(0,below[x],behind[x]);
+          int c0=bases[context(rest,yface,x==X-1,z==Z-1)];
+          int c1=bases[context(rest|to_mask(LEFT),yface,x==X-1,z==Z-1)];
+          int bit=left&to_mask(LEFT);
+          known=rest|bit;
+          c=c0^((c0^c1)&-(bit>>1));
+        }
+        if(c<0)
+          return false;
+        unsigned int e=table[c+(r&(FREQ_TOTAL-1))];
+        r=(e>>3&0x7ff)*(r>>FREQ_BITS)+(e>>14);
+        // up to 2 bytes are needed which is also worked out without branches
+        unsigned int more=(r<RANS_LOW)+(r<(RANS_LOW>>8));
+        unsigned int next=in[0]<<8|in[1];
+        r=r<<(more<<3)|next>>(16-(more<<3));
+        in+=more;
+        left=known<<3|(e&(SYMBOLS-1));
+        row[x]=left;
+      }
+      i+=X;
+      if(in>inend)
+        return false;
+      done=i;
+    }
+  // the state ends where the encoder started it so this checks all the data was right
+  return r==RANS_LOW && in==inend;
+}
+
+bool checkCompressedCells(const unsigned char* data,int len){
+  std::vector<int> base;
+  std::vector<unsigned int> slots;
+  unsigned int exceptionCount;
+  const unsigned char* exceptions;
+  const unsigned char* coded;
+  return readHeader(data,len,base,slots,exceptionCount,exceptions,coded);
+}
+
+bool decompressCells(const unsigned char* data,int len,const Vector& size,int* cells){
+  int done;
+  if(decodeCells(data,len,size,cells,done))
+    return true;
+  int n=size.X*size.Y*size.Z;
+  std::fill(cells+done,cells+n,0);
+  return false;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file mazecoder.hh
+ * @brief A compressed form of the cells of a maze
+ */
+
+#include "vector.hh"
+#include <vector>
+
+#ifndef MAZECODER_HH_INC
+#define MAZECODER_HH_INC
+
+/// Compress the cells of a maze
+/**
+ * Only the walls (the bits in ALLDIRNSMASK) are kept. Each wall is stored in
+ * both of the cells it is between so the DOWN, RIGHT and BACK bits of a cell are
+ * predicted from the cells below, to the right and behind it, which have already
+ * been coded, and any cell that doesn't match the prediction is listed
+ * separately. The UP, LEFT and FORWARD bits are then coded as one symbol with rANS
+ * using frequencies counted for each combination of the predicted bits and the
+ * faces of the maze the cell is on. The frequencies are stored at the start so a
+ * generated maze comes to a little over 2 bits a cell.
+ * @param cells the cells in the order they are stored in a Maze
+ * @param size the size of the maze
+ * @param out set to the compressed data
+ */
+void compressCells(const int* cells,const Vector& size,std::vector<unsigned char>& out);
+
+/// Check the start of compressed cells without decompressing them
+/**
+ * This is quick whatever the size of the maze so it is used to turn down most
+ * corrupt data before making a maze to decompress it into.
+ * @param data the compressed data
+ * @param len the length of the data
+ * @return false if the data is corrupt. The data can still be corrupt if it is true
+ */
+bool checkCompressedCells(const unsigned char* data,int len);
+
+/// Decompress the cells of a maze
+/**
+ * @param data the compressed data
+ * @param len the length of the data
+ * @param size the size of the maze
+ * @param cells where to store the cells which must have room for the whole maze
+ * @return false if the data is corrupt. Every cell is still set to something
+ */
+bool decompressCells(const unsigned char* data,int len,const Vector& size,int* cells);
+
+#endif
@@ -0,0 +1,103 @@
+/**
+ * @file movelog.cc
+ * @brief The implementation of movelog.hh
+ */
+#include "movelog.hh"
+
+/// The bytes at the start of every log
+static const unsigned char header[]={'H','M','L','G',1};
+
+MoveLog::MoveLog():data(header,header+sizeof(header)),now(0),last(0){};
+
+void MoveLog::clear(){
+  data.assign(header,header+sizeof(header));
+  last=0;
+}
+
+bool MoveLog::load(const unsigned char* bytes,int len){
+  clear();
+  if(len<(int)sizeof(header))
+    return false;
+  for(unsigned int i=0;i<sizeof(header);i++)
+    if(bytes[i]!=header[i])
+      return false;
+  data.assign(bytes,bytes+len);
+  return true;
+}
+
+void MoveLog::put(Op op,unsigned int args){
+  data.push_back(op|args<<4);
+  // a clock going backwards is stored as no time passing
+  putVarint(now>last?now-last:0);
+  if(now>last)
+    last=now;
+}
+
+void MoveLog::putVarint(unsigned int v){
+  while(v>=0x80){
+    data.push_back((v&0x7f)|0x80);
+    v>>=7;
+  }
+  data.push_back(v);
+}
+
+MoveLog::Reader::Reader(const MoveLog& log):p(log.bytes()+sizeof(header)),end(log.bytes()+log.size()),time(0),error(false){};
+
+bool MoveLog::Reader::getVarint(unsigned int& v){
+  v=0;
+  for(int shift=0;shift<35;shift+=7){
+    if(p==end)
+      return false;
+    unsigned int b=*p++;
+    v|=(b&0x7f)<<shift;
+    if(!(b&0x80))
+      return true;
+  }
+  return false;
+}
+
+bool MoveLog::Reader::next(Event& e){
+  if(p==end || error)
+    return false;
+  unsigned int b=*p++;
+  unsigned int args=b>>4;
+  unsigned int delta;
+  if((b&15)>=OPCOUNT || !getVarint(delta)){
+    error=true;
+    return false;
+  }
+  time+=delta;
+  e.op=static_cast<Op>(b&15);
+  e.time=time;
+  e.d=from_id(0);
+  e.flag=args&1;
+  e.out=args&2;
+  e.count=0;
+  switch(e.op){
+    case MOVE:
+    case MOVES:
+      if((args>>1)>=6){
+        error=true;
+        return false;
+      }
+      e.d=from_id(args>>1);
+      if(e.op==MOVE)
+        break;
+      // fall through for the step count
+    case SELECT:
+    case JUMP:
+    case UNDOSTEPS:
+      {
+        unsigned int v;
+        if(!getVarint(v) || v>0x7fffffff){
+          error=true;
+          return false;
+        }
+        e.count=v;
+      }
+      break;
+    default:
+      break;
+  }
+  return true;
+}
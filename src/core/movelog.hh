@@ -0,0 +1,232 @@
+/**
+ * @file movelog.hh
+ * @brief A compact binary log of the moves a player makes
+ */
+
+#include "dirns.hh"
+#include <vector>
+
+#ifndef MOVELOG_HH_INC
+#define MOVELOG_HH_INC
+
+/// A record of everything done to a string by a player
+/**
+ * Every call made on a StringPlay is stored with the time it happened so the
+ * game can be replayed exactly (see the replay tool). The log is a flat array
+ * of bytes starting with a short header. Each event is:
+ * - an op byte with the type of event in the low 4 bits and its small
+ *   arguments (a flag and a Dirn or a second flag) in the high 4 bits
+ * - the time since the previous event as a varint
+ * - for MOVES, SELECT, JUMP and UNDOSTEPS a varint count, index or id
+ *
+ * Times are in the same units as Script::setnow so they can be fed straight
+ * back into a Script when replaying.
+ */
+class MoveLog{
+  public:
+    /// The types of event stored in the log
+    enum Op{
+      START, ///< the level was (re)started and Script::runStart run
+      MOVE, ///< StringPlay::tryMove
+      MOVES, ///< StringPlay::tryMoves
+      SLIDE, ///< StringPlay::slide
+      SELECT, ///< StringPlay::setSelected
+      UNDO, ///< StringPlay::undo
+      REDO, ///< StringPlay::redo
+      EXTENDED, ///< StringPlay::startExtendedMove
+      JUMP, ///< StringPlay::jumpTo
+      UPDATED, ///< the string was reported as changed to the script
+      SELECTIONUPDATED, ///< the selection was reported as changed to the script
+      UNDOSTEPS, ///< StringPlay::undoSteps
+      OPCOUNT ///< the number of types of event
+    };
+
+    /// A single decoded event
+    struct Event{
+      Op op; ///< the type of the event
+      unsigned int time; ///< the time the event happened
+      Dirn d; ///< the direction for MOVE and MOVES
+      bool flag; ///< extendedmove for moves, undo and redo, moveEnd for SLIDE or selected for SELECT
+      bool out; ///< out for SLIDE
+      int count; ///< steps for MOVES and UNDOSTEPS, the element index for SELECT or the state id for JUMP
+    };
+
+    /// Decode the events in a log one at a time
+    class Reader{
+      const unsigned char* p; ///< the next byte to read
+      const unsigned char* end; ///< the end of the log
+      unsigned int time; ///< the time of the last event read
+      bool error; ///< if the log was found to be corrupt
+      /// Read a varint
+      /**
+       * @param v set to the value read
+       * @return true if it was read or false if the log is corrupt
+       */
+      bool getVarint(unsigned int& v);
+      public:
+        /// Create a reader for the events in a log
+        /**
+         * @param log the log to read which must stay unchanged while reading
+         */
+        Reader(const MoveLog& log);
+        /// Read the next event
+        /**
+         * @param e set to the event read
+         * @return true if an event was read or false at the end of the log or
+         * if it is corrupt
+         */
+        bool next(Event& e);
+        /// Check if reading stopped because the log is corrupt
+        /**
+         * @return true if a corrupt event was found
+         */
+        inline bool failed() const{
+          return error;
+        }
+    };
+
+  private:
+    std::vector<unsigned char> data; ///< the encoded log including the header
+    unsigned int now; ///< the time to stamp new events with
+    unsigned int last; ///< the time of the last event written
+
+    /// Start a new event
+    /**
+     * @param op the type of event
+     * @param args the small arguments to pack in the high bits of the op byte
+     */
+    void put(Op op,unsigned int args=0);
+    /// Add a varint to the current event
+    /**
+     * @param v the value to add
+     */
+    void putVarint(unsigned int v);
+
+  public:
+    /// Create a new empty log
+    MoveLog();
+
+    /// Remove all the events from the log
+    /**
+     * The time is kept so it doesn't need to be set again.
+     */
+    void clear();
+
+    /// Replace the log with a previously saved one
+    /**
+     * @param bytes the saved log
+     * @param len the number of bytes in the saved log
+     * @return true if it was loaded or false if it isn't a log this version
+     * can read in which case the log is left empty
+     */
+    bool load(const unsigned char* bytes,int len);
+
+    /// Get the encoded log to save
+    /**
+     * @return the bytes of the log, valid until the log is next changed
+     */
+    inline const unsigned char* bytes() const{
+      return &data[0];
+    }
+
+    /// Get the size of the encoded log
+    /**
+     * @return the number of bytes in the log
+     */
+    inline int size() const{
+      return data.size();
+    }
+
+    /// Set the time to stamp events added after this with
+    /**
+     * @param t the current time
+     */
+    inline void setTime(unsigned int t){
+      now=t;
+    }
+
+    /// Record the start of a level
+    inline void start(){
+      put(START);
+    }
+    /// Record a call to StringPlay::tryMove
+    /**
+     * @param d the direction
+     * @param extendedmove if it was part of an extended move
+     */
+    inline void move(Dirn d,bool extendedmove){
+      put(MOVE,(extendedmove?1:0)|to_id(d)<<1);
+    }
+    /// Record a call to StringPlay::tryMoves
+    /**
+     * @param d the direction
+     * @param steps the maximum number of steps
+     * @param extendedmove if it was part of an extended move
+     */
+    inline void moves(Dirn d,int steps,bool extendedmove){
+      put(MOVES,(extendedmove?1:0)|to_id(d)<<1);
+      putVarint(steps<0?0:steps);
+    }
+    /// Record a call to StringPlay::slide
+    /**
+     * @param moveEnd true for the end or false for the start
+     * @param out if the selection was moved out
+     */
+    inline void slide(bool moveEnd,bool out){
+      put(SLIDE,(moveEnd?1:0)|(out?2:0));
+    }
+    /// Record a call to StringPlay::setSelected
+    /**
+     * @param index the position of the element in the string
+     * @param selected the new selection state
+     */
+    inline void select(int index,bool selected){
+      put(SELECT,selected?1:0);
+      putVarint(index);
+    }
+    /// Record a call to StringPlay::undo
+    /**
+     * @param extendedmove if it was part of an extended move
+     */
+    inline void undo(bool extendedmove){
+      put(UNDO,extendedmove?1:0);
+    }
+    /// Record a call to StringPlay::undoSteps
+    /**
+     * @param steps the maximum number of steps
+     * @param extendedmove if it was part of an extended move
+     */
+    inline void undoSteps(int steps,bool extendedmove){
+      put(UNDOSTEPS,extendedmove?1:0);
+      putVarint(steps<0?0:steps);
+    }
+    /// Record a call to StringPlay::redo
+    /**
+     * @param extendedmove if it was part of an extended move
+     */
+    inline void redo(bool extendedmove){
+      put(REDO,extendedmove?1:0);
+    }
+    /// Record a call to StringPlay::startExtendedMove
+    inline void extended(){
+      put(EXTENDED);
+    }
+    /// Record a call to StringPlay::jumpTo
+    /**
+     * @param node the state id
+     */
+    inline void jump(int node){
+      put(JUMP);
+      putVarint(node<0?0:node);
+    }
+    /// Record that the script was told the string changed
+    inline void updated(){
+      put(UPDATED);
+    }
+    /// Record that the script was told the selection changed
+    inline void selectionUpdated(){
+      put(SELECTIONUPDATED);
+    }
+};
+
+#endif
@@ -3,36 +3,179 @@
  * @brief The implementation of script.hh and scriptimpl.hh
  */
 #include <cctype>
+#include <climits>
+#include <vector>
+#include <algorithm>
 #include "script.hh"
 #include "scriptimpl.hh"
+#include "scriptprofile.hh"
 
 #ifdef IOSTREAM
 #include <iostream>
 #endif
 
+/// The most items of a list that are made before any of them have been read
+/**
+ * Lists grow as their items are read after this so a corrupt count fails at the
+ * end of the data rather than making a huge list first
+ */
+static const int READ_RESERVE=256;
+
+/// Read the number of items in a list
+/**
+ * @param s the stream to read from
+ * @param count set to the number of items, or 0 if it couldn't be read or was negative
+ * @return an IOResult object that contains the status of the read
+ */
+static IOResult readCount(HypIStream& s,int& count){
+  IOResult r=read(s,count,0);
+  if(r.ok && count<0)
+    r=IOResult(false,r.eof);
+  if(!r.ok)
+    count=0;
+  return r;
+}
+
+/// Copy the items of a list that were read into an array
+/**
+ * @tparam T the type of the items
+ * @param items the items
+ * @return a new array holding the items
+ */
+template <class T>
+static SPA<T> toArray(const std::vector<T>& items){
+  SPA<T> a(items.size());
+  for(unsigned int i=0;i<items.size();++i)
+    a[i]=items[i];
+  return a;
+}
+
 template <class T>
 bool StringElementCondition::matches(T el){
-  if((selectionCondition&2)==0&&(((selectionCondition&1)==1)!=el->selected))
-    return false;
-  if((dirnsCondition&to_mask(el->d))==0)
+  if(((accept>>((el->selected?6:0)+to_id(el->d)))&1)==0)
     return false;
-  bool match=xrange_count==0;
-  for(int i=0;i<xrange_count&&!match;++i)
-    if(xrange[i].inRange(el->pos.X))
-      match=true;
-  if(!match)
+  return inIntervals(0,el->pos.X) && inIntervals(1,el->pos.Y) && inIntervals(2,el->pos.Z);
+}
+
+/// Compare intervals by their start for sorting
+/**
+ * @param a the first interval
+ * @param b the second interval
+ * @return true if a starts before b
+ */
+static bool startsBefore(const Pair<int>& a,const Pair<int>& b){
+  return a.a<b.a;
+}
+
+/// Turn a list of ranges into sorted non overlapping intervals
+/**
+ * @param count the number of ranges
+ * @param ranges the ranges where no ranges means there is no limit
+ * @param intervals set to the intervals
+ * @return the number of intervals
+ */
+static int mergeRanges(int count,const SPA<Range>& ranges,SPA<Pair<int> >& intervals){
+  std::vector<Pair<int> > in;
+  if(count==0)
+    in.push_back(Pair<int>(INT_MIN,INT_MAX));
+  for(int i=0;i<count;++i){
+    Pair<int> r(ranges[i].start==INT_MAX?INT_MIN:ranges[i].start,ranges[i].end);
+    // a range that is back to front can't match anything
+    if(r.a<=r.b)
+      in.push_back(r);
+  }
+  std::sort(in.begin(),in.end(),startsBefore);
+  int n=0;
+  for(unsigned int i=0;i<in.size();++i){
+    if(n>0 && (in[n-1].b==INT_MAX || in[i].a<=in[n-1].b+1)){
+      if(in[i].b>in[n-1].b)
+        in[n-1].b=in[i].b;
+    }else
+      in[n++]=in[i];
+  }
+  // always have one interval so there is something to point at
+  intervals=SPA<Pair<int> >(n>0?n:1);
+  for(int i=0;i<n;++i)
+    intervals[i]=in[i];
+  return n;
+}
+
+void StringElementCondition::compile(){
+  accept=0;
+  for(int sel=0;sel<2;++sel)
+    if((selectionCondition&2)!=0 || (selectionCondition&1)==sel)
+      accept|=(dirnsCondition&ALLDIRNSMASK)<<(sel*6);
+  interval_count[0]=mergeRanges(xrange_count,xrange,intervals[0]);
+  interval_count[1]=mergeRanges(yrange_count,yrange,intervals[1]);
+  interval_count[2]=mergeRanges(zrange_count,zrange,intervals[2]);
+}
+
+bool StringElementCondition::overlaps(const StringElementCondition& o) const{
+  if((accept&o.accept)==0)
     return false;
-  match=yrange_count==0;
-  for(int i=0;i<yrange_count&&!match;++i)
-    if(yrange[i].inRange(el->pos.Y))
-      match=true;
-  if(!match)
+  for(int axis=0;axis<3;++axis){
+    // the intervals are sorted so walk both lists together
+    int i=0,j=0;
+    while(i<interval_count[axis] && j<o.interval_count[axis]){
+      const Pair<int>& a=intervals[axis][i];
+      const Pair<int>& b=o.intervals[axis][j];
+      if(a.b<b.a)
+        ++i;
+      else if(b.b<a.a)
+        ++j;
+      else
+        break;
+    }
+    if(i>=interval_count[axis] || j>=o.interval_count[axis])
+      return false;
+  }
+  return true;
+}
+
+/// Read a list of ranges
+/**
+ * The ends of the ranges are read READ_RESERVE ranges at a time
+ * @param s the stream to read from
+ * @param count set to the number of ranges
+ * @param ranges set to the ranges. If they couldn't all be read the ones in the
+ * last block read are kept and any ends not read have no limits
+ * @return an IOResult object that contains the status of the read
+ */
+static IOResult readRanges(HypIStream& s,int& count,SPA<Range>& ranges){
+  IOResult r=readCount(s,count);
+  std::vector<int> ends;
+  for(int done=0;r.ok && done<count;){
+    int n=count-done<READ_RESERVE?count-done:READ_RESERVE;
+    ends.resize(2*(done+n),INT_MAX);
+    r=read(s,&ends[2*done],2*n,0);
+    done+=n;
+  }
+  count=ends.size()/2;
+  ranges=SPA<Range>(count);
+  for(int i=0;i<count;++i){
+    ranges[i].start=ends[2*i];
+    ranges[i].end=ends[2*i+1];
+  }
+  return r;
+}
+/// Write a list of ranges
+/**
+ * @param s the stream to write to
+ * @param count the number of ranges
+ * @param ranges the ranges
+ * @return true if they were written ok
+ */
+static bool writeRanges(HypOStream& s,int count,const SPA<Range>& ranges){
+  if(!write(s,count,0))
     return false;
-  match=zrange_count==0;
-  for(int i=0;i<zrange_count&&!match;++i)
-    if(zrange[i].inRange(el->pos.Z))
-      match=true;
-  return match;
+  if(count<=0)
+    return true;
+  std::vector<int> ends(2*count);
+  for(int i=0;i<count;++i){
+    ends[2*i]=ranges[i].start;
+    ends[2*i+1]=ranges[i].end;
+  }
+  return write(s,&ends[0],2*count,0);
 }
 
 IOResult read(HypIStream& s,StringElementCondition& c){
@@ -41,42 +184,13 @@ IOResult read(HypIStream& s,StringElementCondition& c){
     return r;
   if(!(r=read(s,c.dirnsCondition,0)).ok)
     return r;
-  if(!(r=read(s,c.xrange_count,0)).ok){
-    c.xrange_count=0;
+  if(!(r=readRanges(s,c.xrange_count,c.xrange)).ok)
     return r;
-  }else{
-    c.xrange=SPA<Range>(c.xrange_count);
-    for(int i=0;i<c.xrange_count;++i){
-      if(!(r=read(s,c.xrange[i].start,0)).ok)
-        return r;
-      if(!(r=read(s,c.xrange[i].end,0)).ok)
-        return r;
-    }
-  }
-  if(!(r=read(s,c.yrange_count,0)).ok){
-    c.yrange_count=0;
+  if(!(r=readRanges(s,c.yrange_count,c.yrange)).ok)
     return r;
-  }else{
-    c.yrange=SPA<Range>(c.yrange_count);
-    for(int i=0;i<c.yrange_count;++i){
-      if(!(r=read(s,c.yrange[i].start,0)).ok)
-        return r;
-      if(!(r=read(s,c.yrange[i].end,0)).ok)
-        return r;
-    }
-  }
-  if(!(r=read(s,c.zrange_count,0)).ok){
-    c.zrange_count=0;
+  if(!(r=readRanges(s,c.zrange_count,c.zrange)).ok)
     return r;
-  }else{
-    c.zrange=SPA<Range>(c.zrange_count);
-    for(int i=0;i<c.zrange_count;++i){
-      if(!(r=read(s,c.zrange[i].start,0)).ok)
-        return r;
-      if(!(r=read(s,c.zrange[i].end,0)).ok)
-        return r;
-    }
-  }
+  c.compile();
   return IOResult(true,r.eof);
 }
 bool write(HypOStream& s,const StringElementCondition& c){
@@ -84,31 +198,9 @@ bool write(HypOStream& s,const StringElementCondition& c){
     return false;
   if(!write(s,c.dirnsCondition,0))
     return false;
-  if(!write(s,c.xrange_count,0))
-    return false;
-  for(int i=0;i<c.xrange_count;++i){
-    if(!write(s,c.xrange[i].start,0))
-      return false;
-    if(!write(s,c.xrange[i].end,0))
-      return false;
-  }
-  if(!write(s,c.yrange_count,0))
-    return false;
-  for(int i=0;i<c.yrange_count;++i){
-    if(!write(s,c.yrange[i].start,0))
-      return false;
-    if(!write(s,c.yrange[i].end,0))
-      return false;
-  }
-  if(!write(s,c.zrange_count,0))
-    return false;
-  for(int i=0;i<c.zrange_count;++i){
-    if(!write(s,c.zrange[i].start,0))
-      return false;
-    if(!write(s,c.zrange[i].end,0))
-      return false;
-  }
-  return true;
+  return writeRanges(s,c.xrange_count,c.xrange) &&
+      writeRanges(s,c.yrange_count,c.yrange) &&
+      writeRanges(s,c.zrange_count,c.zrange);
 }
 
 IOResult read(HypIStream& s,PatternTag& pt){
@@ -120,40 +212,48 @@ bool write(HypOStream& s,const PatternTag& pt){
   return write(s,pt.min,0) && write(s,pt.max,0) && write(s,pt.greedy);
 }
 
-bool StringMatcher::match(SP<const String> s,SPA<Pair<SP<ConstStringPointer> > > groups){
-  return match<const String,ConstStringPointer>(s,groups,0);
+bool StringMatcher::match(SP<const String> s,SPA<Pair<SP<ConstStringPointer> > > groups,unsigned long* steps){
+  return match<const String,ConstStringPointer>(*s,groups,0,steps);
 }
-bool StringMatcher::match(SP<String> s,SPA<Pair<SP<StringPointer> > > groups){
-  return match<String,StringPointer>(s,groups,0);
+bool StringMatcher::match(SP<String> s,SPA<Pair<SP<StringPointer> > > groups,unsigned long* steps){
+  return match<String,StringPointer>(*s,groups,0,steps);
+}
+bool StringMatcher::match(const String& s,unsigned long* steps){
+  return match<const String,ConstStringPointer>(s,SPA<Pair<SP<ConstStringPointer> > >(),0,steps);
 }
 bool StringMatcher::match(SP<const String> s,StringMatcherCallback<ConstStringPointer>& cb,
-    SPA<Pair<SP<ConstStringPointer> > > groups){
+    SPA<Pair<SP<ConstStringPointer> > > groups,unsigned long* steps){
   if(groups.isnull()){
     groups=SPA<Pair<SP<ConstStringPointer> > >(group_count);
   }
-  return match<const String,ConstStringPointer>(s,groups,&cb);
+  return match<const String,ConstStringPointer>(*s,groups,&cb,steps);
 }
 bool StringMatcher::match(SP<String> s,StringMatcherCallback<StringPointer>& cb,
-    SPA<Pair<SP<StringPointer> > >groups){
+    SPA<Pair<SP<StringPointer> > >groups,unsigned long* steps){
   if(groups.isnull()){
     groups=SPA<Pair<SP<StringPointer> > >(group_count);
   }
-  return match<String,StringPointer>(s,groups,&cb);
+  return match<String,StringPointer>(*s,groups,&cb,steps);
 }
 
 template <class STRING,class POINTER>
-bool StringMatcher::match(SP<STRING> s,SPA<Pair<SP<POINTER> > > groups,StringMatcherCallback<POINTER>* cb){
+bool StringMatcher::match(STRING& s,SPA<Pair<SP<POINTER> > > groups,StringMatcherCallback<POINTER>* cb,unsigned long* steps){
+  // finding every match for a callback needs the backtracking matcher
+  if(cb==0 && program_count>0)
+    return matchCompiled<STRING,POINTER>(s,groups,steps);
   SPA<PatternMatch<POINTER> > m;
   if(!groups.isnull())
     m=SPA<PatternMatch<POINTER> >(count);
-  return matchStep(s,s->begin(),m,0,groups,cb);
+  return matchStep(s,s.begin(),m,0,groups,cb,steps);
 }
 
 template <class STRING,class POINTER>
-bool StringMatcher::matchStep(SP<STRING> s,POINTER p,SPA<PatternMatch<POINTER> > matches,int level,
-    SPA<Pair<SP<POINTER> > > groups,StringMatcherCallback<POINTER>* cb){
+bool StringMatcher::matchStep(STRING& s,POINTER p,SPA<PatternMatch<POINTER> > matches,int level,
+    SPA<Pair<SP<POINTER> > > groups,StringMatcherCallback<POINTER>* cb,unsigned long* steps){
+  if(steps)
+    ++*steps;
   if(level==count){
-    if(p==s->end()){
+    if(p==s.end()){
       //valid so store in group if it's defined
       if(!groups.isnull()){
         for(int i=0;i<group_count;++i){
@@ -176,13 +276,13 @@ bool StringMatcher::matchStep(SP<STRING> s,POINTER p,SPA<PatternMatch<POINTER> >
     int i=0;
     // move p to point to element after end of current sections first match
     while(i<pt.min){
-      if(p==s->end()||!sec.matches(p))
+      if(p==s.end()||!sec.matches(p))
         return false;
       ++i;++p;
     }
     if(pt.greedy){
       //go to first that doesn't match or length is max+1 (i is max)  (whichevers first)
-      while(i<pt.max && p!=s->end() && sec.matches(p)){
+      while(i<pt.max && p!=s.end() && sec.matches(p)){
         ++i;++p;
       }
     }
@@ -192,7 +292,7 @@ bool StringMatcher::matchStep(SP<STRING> s,POINTER p,SPA<PatternMatch<POINTER> >
       if(!matches.isnull())
         matches[level].end=SP<POINTER>(new POINTER(p));
       //see if we can match the next group
-      match|=matchStep(s,p,matches,level+1,groups,cb);
+      match|=matchStep(s,p,matches,level+1,groups,cb,steps);
 
       //if we have a match and we don't have a call back then return match (true)
       if(match && cb==0)
@@ -205,7 +305,7 @@ bool StringMatcher::matchStep(SP<STRING> s,POINTER p,SPA<PatternMatch<POINTER> >
         --i; --p;
       }else{
         //stepping on. need to check everything as not yet checked.
-        if(i>= pt.max || p==s->end() || !sec.matches(p))
+        if(i>= pt.max || p==s.end() || !sec.matches(p))
           return match;
         ++i; ++p;
       }
@@ -214,24 +314,271 @@ bool StringMatcher::matchStep(SP<STRING> s,POINTER p,SPA<PatternMatch<POINTER> >
   }
 }
 
+bool StringMatcher::usesSelection() const{
+  for(int i=0;i<count;++i)
+    if(!(pattern[i].b.selectionCondition&2))
+      return true;
+  return false;
+}
+
+bool StringMatcher::compile(){
+  for(int i=0;i<count;++i)
+    pattern[i].b.compile();
+  program_count=0;
+  program=SPA<Instruction>();
+  slot_count=0;
+  group_slots=SPA<Pair<int> >();
+
+  // find the boundaries between pattern elements the groups need. Boundary
+  // i is the start of pattern element i and the end of element i-1
+  SPA<int> slots(count+1);
+  for(int i=0;i<=count;++i)
+    slots[i]=-1;
+  int nslots=0;
+  for(int i=0;i<group_count;++i){
+    // leave groups the backtracking matcher can't handle to it
+    if(groups[i].a<0 || groups[i].a>=count || groups[i].b<0 || groups[i].b>=count)
+      return false;
+    if(slots[groups[i].a]<0)
+      slots[groups[i].a]=nslots++;
+    if(slots[groups[i].b+1]<0)
+      slots[groups[i].b+1]=nslots++;
+  }
+
+  int size=1;
+  if(slots[count]>=0)
+    ++size;
+  for(int i=0;i<count;++i){
+    PatternTag& pt=pattern[i].a;
+    int min=pt.min<0?0:pt.min;
+    int max=pt.max<min?min:pt.max;
+    if(slots[i]>=0)
+      ++size;
+    if(min>MAX_PROGRAM)
+      return false;
+    size+=min;
+    if(max==INT_MAX)
+      size+=3;
+    else if(max-min>MAX_PROGRAM)
+      return false;
+    else
+      size+=2*(max-min);
+    if(size>MAX_PROGRAM)
+      return false;
+  }
+
+  SPA<Instruction> prog(size);
+  int pc=0;
+  for(int i=0;i<count;++i){
+    PatternTag& pt=pattern[i].a;
+    int min=pt.min<0?0:pt.min;
+    int max=pt.max<min?min:pt.max;
+    if(slots[i]>=0)
+      prog[pc++]=Instruction(OP_SAVE,slots[i]);
+    for(int j=0;j<min;++j)
+      prog[pc++]=Instruction(OP_ELEMENT,i);
+    if(max==INT_MAX){
+      // any number more: loop back to the split after each element
+      if(pt.greedy)
+        prog[pc]=Instruction(OP_SPLIT,pc+1,pc+3);
+      else
+        prog[pc]=Instruction(OP_SPLIT,pc+3,pc+1);
+      prog[pc+1]=Instruction(OP_ELEMENT,i);
+      prog[pc+2]=Instruction(OP_JUMP,pc);
+      pc+=3;
+    }else{
+      // up to max-min more: each optional element can skip to the end
+      int end=pc+2*(max-min);
+      for(int j=min;j<max;++j){
+        if(pt.greedy)
+          prog[pc]=Instruction(OP_SPLIT,pc+1,end);
+        else
+          prog[pc]=Instruction(OP_SPLIT,end,pc+1);
+        prog[pc+1]=Instruction(OP_ELEMENT,i);
+        pc+=2;
+      }
+    }
+  }
+  if(slots[count]>=0)
+    prog[pc++]=Instruction(OP_SAVE,slots[count]);
+  prog[pc++]=Instruction(OP_MATCH,0);
+
+  group_slots=SPA<Pair<int> >(group_count);
+  for(int i=0;i<group_count;++i){
+    group_slots[i].a=slots[groups[i].a];
+    group_slots[i].b=slots[groups[i].b+1];
+  }
+  slot_count=nslots;
+  program=prog;
+  program_count=pc;
+  return true;
+}
+
+/// Get a pointer to an element of a string by its index
+/**
+ * @tparam STRING the type of the string. Either String or const String
+ * @tparam POINTER the type of a pointer to an element of the string of type STRING.
+ * @param s the string
+ * @param index the index of the element. The length of the string gives the end
+ * @return a new pointer to the element
+ */
+template <class STRING,class POINTER>
+static SP<POINTER> elementAt(STRING& s,int index){
+  POINTER p=s.begin();
+  for(int i=0;i<index;++i)
+    ++p;
+  return SP<POINTER>(new POINTER(p));
+}
+
+template <class STRING,class POINTER>
+bool StringMatcher::matchCompiled(STRING& s,SPA<Pair<SP<POINTER> > > groups,unsigned long* steps){
+  int n=program_count;
+  int nslots=groups.isnull()?0:slot_count;
+  // two lists of threads in priority order, the current one and the next one
+  std::vector<int> pcs[2];
+  std::vector<int> caps[2];
+  int threads[2]={0,0};
+  for(int i=0;i<2;++i){
+    pcs[i].resize(n);
+    caps[i].resize(n*nslots+1);
+  }
+  std::vector<int> added(n,-1); // the position each instruction was last added at
+  std::vector<int> current(nslots+1); // the captures for the thread being added
+  // instructions still to follow for the thread being added. A negative value
+  // -1-slot means restore that slot to the second value on the way back.
+  std::vector<Pair<int> > stack;
+  stack.reserve(3*n);
+  std::vector<int> tested(count,-1); // the position each pattern element was last tested at
+  std::vector<char> accepted(count);
+
+  int cur=0;
+  int pos=0;
+  POINTER p=s.begin();
+  bool first=true;
+  while(true){
+    int next=1-cur;
+    int nextpos=first?0:pos+1;
+    threads[next]=0;
+    int todo=first?1:threads[cur];
+    for(int t=0;t<todo;++t){
+      int pc;
+      if(first){
+        pc=0;
+        for(int i=0;i<nslots;++i)
+          current[i]=-1;
+      }else{
+        pc=pcs[cur][t];
+        const Instruction& ins=program[pc];
+        if(ins.op!=OP_ELEMENT)
+          continue;
+        if(tested[ins.arg]!=pos){
+          if(steps)
+            ++*steps;
+          tested[ins.arg]=pos;
+          accepted[ins.arg]=pattern[ins.arg].b.matches(p);
+        }
+        if(!accepted[ins.arg])
+          continue;
+        for(int i=0;i<nslots;++i)
+          current[i]=caps[cur][t*nslots+i];
+        ++pc;
+      }
+      // follow everything reachable without using an element in priority order
+      stack.push_back(Pair<int>(pc,0));
+      while(!stack.empty()){
+        Pair<int> e=stack.back();
+        stack.pop_back();
+        if(e.a<0){
+          current[-1-e.a]=e.b;
+          continue;
+        }
+        if(added[e.a]==nextpos)
+          continue;
+        added[e.a]=nextpos;
+        const Instruction& ins=program[e.a];
+        switch(ins.op){
+          case OP_JUMP:
+            stack.push_back(Pair<int>(ins.arg,0));
+            break;
+          case OP_SPLIT:
+            stack.push_back(Pair<int>(ins.arg2,0));
+            stack.push_back(Pair<int>(ins.arg,0));
+            break;
+          case OP_SAVE:
+            if(ins.arg<nslots){
+              stack.push_back(Pair<int>(-1-ins.arg,current[ins.arg]));
+              current[ins.arg]=nextpos;
+            }
+            stack.push_back(Pair<int>(e.a+1,0));
+            break;
+          default:
+            pcs[next][threads[next]]=e.a;
+            for(int i=0;i<nslots;++i)
+              caps[next][threads[next]*nslots+i]=current[i];
+            ++threads[next];
+        }
+      }
+    }
+    if(first)
+      first=false;
+    else{
+      ++p;
+      ++pos;
+    }
+    cur=next;
+    if(threads[cur]==0)
+      return false;
+    if(p==s.end())
+      break;
+  }
+
+  // the highest priority thread at the end of the program is the match
+  for(int t=0;t<threads[cur];++t){
+    if(program[pcs[cur][t]].op!=OP_MATCH)
+      continue;
+    for(int i=0;i<group_count && nslots>0;++i){
+      groups[i].a=elementAt<STRING,POINTER>(s,caps[cur][t*nslots+group_slots[i].a]);
+      groups[i].b=elementAt<STRING,POINTER>(s,caps[cur][t*nslots+group_slots[i].b]);
+    }
+    return true;
+  }
+  return false;
+}
+
 IOResult read(HypIStream& s,StringMatcher& sm){
   IOResult r;
-  if(!(r=read(s,sm.count,0)).ok){
-    sm.count=0;
-    return r;
+  sm.group_count=0;
+  sm.groups=SPA<Pair<int> >(0);
+  int count;
+  r=readCount(s,count);
+  std::vector<Pair<PatternTag,StringElementCondition> > pattern;
+  pattern.reserve(count<READ_RESERVE?count:READ_RESERVE);
+  for(int i=0;r.ok && i<count;++i){
+    pattern.push_back(Pair<PatternTag,StringElementCondition>());
+    (r=read(s,pattern.back().a)).ok && (r=read(s,pattern.back().b)).ok;
   }
-  sm.pattern=SPA<Pair<PatternTag,StringElementCondition> >(sm.count);
-  for(int i=0;i<sm.count;++i)
-    if(!((r=read(s,sm.pattern[i].a)).ok && (r=read(s,sm.pattern[i].b)).ok))
-      return r;
-  if(!(r=read(s,sm.group_count,0)).ok){
-    sm.group_count=0;
+  sm.count=pattern.size();
+  sm.pattern=toArray(pattern);
+  if(!r.ok)
     return r;
+  r=readCount(s,count);
+  std::vector<Pair<int> > groups;
+  groups.reserve(count<READ_RESERVE?count:READ_RESERVE);
+  for(int i=0;r.ok && i<count;++i){
+    groups.push_back(Pair<int>());
+    (r=read(s,groups.back().a,0)).ok && (r=read(s,groups.back().b,0)).ok;
+    // a group outside the pattern is dropped with the ones after it
+    if(groups.back().a<0 || groups.back().a>=sm.count || groups.back().b<0 || groups.back().b>=sm.count){
+      groups.pop_back();
+      if(r.ok)
+        r=IOResult(false,false);
+    }
   }
-  sm.groups=SPA<Pair<int> >(sm.group_count);
-  for(int i=0;i<sm.group_count;++i)
-    if(!((r=read(s,sm.groups[i].a,0)).ok && (r=read(s,sm.groups[i].b,0)).ok))
-      return r;
+  sm.group_count=groups.size();
+  sm.groups=toArray(groups);
+  if(!r.ok)
+    return r;
+  sm.compile();
   return r;
 }
 bool write(HypOStream& s,const StringMatcher& sm){
@@ -251,26 +598,19 @@ bool write(HypOStream& s,const StringMatcher& sm){
 
 template <class T>
 IOResult read(HypIStream& s,SPA<SP<T> >& a, int& c){
-  IOResult r=read(s,c,0);
-  if(!r.ok){
-    c=0;
+  IOResult r=readCount(s,c);
+  if(!r.ok)
     return r;
+  std::vector<SP<T> > items;
+  items.reserve(c<READ_RESERVE?c:READ_RESERVE);
+  for(int i=0;r.ok && i<c;++i){
+    items.push_back(SP<T>());
+    r=read(s,items.back());
   }
-  a=SPA<SP<T> >(c);
-  int i=0;
-  for(;i<c;++i){
-    if(!(r=read(s,a[i])).ok){
-      ++i;
-      break;
-    }
-  }
-  if(i<c){
-    for(;i<c;++i)
-      a[i]=T::defaultvalue;
-    return IOResult(false,r.eof);
-  }else{
-    return IOResult(true,r.eof);
-  }
+  // if one couldn't be read it is kept as it was left and the ones after it are dropped
+  c=items.size();
+  a=toArray(items);
+  return r;
 }
 template <class T>
 bool write(HypOStream& s,const SPA<const SP<const T> >& a, const int& c){
@@ -329,12 +669,25 @@ bool write(HypOStream& s,const SP<const Condition>& c){
   return c->dowrite(s);
 }
 
-bool ConditionOr::is(int time,const Script& script,SP<const String> s){
+bool ConditionOr::is(int time,const Script& script,const String& s){
+  if(cachedResult(s)==1)
+    return true;
   for(int i=0;i<count;++i)
-    if(conditions[i]->is(time,script,s))
+    if(conditions[i]->cachedResult(s)!=0 && conditions[i]->is(time,script,s))
       return true;
   return false;
 }
+int ConditionOr::cachedResult(const String& s){
+  int r=0;
+  for(int i=0;i<count;++i){
+    int c=conditions[i]->cachedResult(s);
+    if(c==1)
+      return 1;
+    if(c<0)
+      r=-1;
+  }
+  return r;
+}
 IOResult read(HypIStream& s,ConditionOr& c){
   return read(s,c.conditions,c.count);
 }
@@ -342,12 +695,25 @@ bool write(HypOStream& s,const ConditionOr& c){
   return write(s,(SPA<const SP<const Condition> >&)c.conditions,c.count);
 }
 
-bool ConditionAnd::is(int time,const Script& script,SP<const String> s){
+bool ConditionAnd::is(int time,const Script& script,const String& s){
+  if(cachedResult(s)==0)
+    return false;
   for(int i=0;i<count;++i)
-    if(!conditions[i]->is(time,script,s))
+    if(conditions[i]->cachedResult(s)!=1 && !conditions[i]->is(time,script,s))
       return false;
   return true;
 }
+int ConditionAnd::cachedResult(const String& s){
+  int r=1;
+  for(int i=0;i<count;++i){
+    int c=conditions[i]->cachedResult(s);
+    if(c==0)
+      return 0;
+    if(c<0)
+      r=-1;
+  }
+  return r;
+}
 IOResult read(HypIStream& s,ConditionAnd& c){
   return read(s,c.conditions,c.count);
 }
@@ -362,7 +728,7 @@ bool write(HypOStream& s,const ConditionNot& c){
   return write(s,(SP<const Condition>&)c.condition);
 }
 
-bool ConditionAfter::is(int time,const Script& script,SP<const String> s){
+bool ConditionAfter::is(int time,const Script& script,const String& s){
   int eventtime=script.getTime(event);
   return eventtime!=-1 &&
    (eventtime+delay)
@@ -378,7 +744,7 @@ bool write(HypOStream& s,const ConditionAfter& c){
   return write(s,c.event,0) && write(s,c.delay,0);
 }
 
-bool ConditionBefore::is(int time,const Script& script,SP<const String> s){
+bool ConditionBefore::is(int time,const Script& script,const String& s){
   return script.getTime(event)==-1;
 }
 IOResult read(HypIStream& s,ConditionBefore& c){
@@ -388,25 +754,34 @@ bool write(HypOStream& s,const ConditionBefore& c){
   return write(s,c.event,0);
 }
 
-IOResult read(HypIStream& s,Message& m){
-  IOResult r=read(s,m.count,0);
-  if(!r.ok){
-    m.count=0;
+bool ConditionStringPattern::is(int time,const Script& script,const String& s){
+  int r=cachedResult(s);
+  if(r>=0)
     return r;
-  }
-  m.paragraphs=SPA<Pair<SPA<const char> > >(m.count);
-  int i=0;
-  for(;i<m.count;++i)
-    if(!((r=read(s,m.paragraphs[i].a,false)).ok && (r=read(s,m.paragraphs[i].b,true)).ok))
-      break;
-  if(i<m.count){
-    SPA<char> defaultvalue(1);
-    defaultvalue[0]='\0';
-    for(;i<m.count;++i){
-      m.paragraphs[i].a=defaultvalue;
-      m.paragraphs[i].b=defaultvalue;
+  // only patterns that look at the selection need to be checked again when just the selection changes
+  selection=sm.usesSelection();
+  stamp=selection?s.getSelectionStamp():s.getRouteStamp();
+  result=sm.match(s,script.getMatchSteps());
+  return result;
+}
+
+IOResult read(HypIStream& s,Message& m){
+  int count;
+  IOResult r=readCount(s,count);
+  std::vector<Pair<SPA<const char> > > paragraphs;
+  paragraphs.reserve(count<READ_RESERVE?count:READ_RESERVE);
+  for(int i=0;r.ok && i<count;++i){
+    paragraphs.push_back(Pair<SPA<const char> >());
+    if(!((r=read(s,paragraphs.back().a,false)).ok && (r=read(s,paragraphs.back().b,true)).ok)){
+      // the paragraph that couldn't be read is kept empty and the ones after it are dropped
+      SPA<char> defaultvalue(1);
+      defaultvalue[0]='\0';
+      paragraphs.back().a=defaultvalue;
+      paragraphs.back().b=defaultvalue;
     }
   }
+  m.count=paragraphs.size();
+  m.paragraphs=toArray(paragraphs);
   return r;
 }
 
@@ -529,12 +904,123 @@ bool write(HypOStream& s,const ActionStringConditionSelect& a){
   return write(s,a.change) && write(s,a.select);
 }
 
+/// Check if a pattern element matches any number of any elements
+/**
+ * @param p the pattern element
+ * @return true if it matches anything
+ */
+static bool matchesAnything(const Pair<PatternTag,StringElementCondition>& p){
+  const StringElementCondition& c=p.b;
+  return p.a.min==0 && p.a.max==INT_MAX && (c.selectionCondition&2)!=0 && (c.dirnsCondition&ALLDIRNSMASK)==ALLDIRNSMASK &&
+      c.xrange_count==0 && c.yrange_count==0 && c.zrange_count==0;
+}
+
+/// Check if a fixed length section of pattern matches the string at a point
+/**
+ * @param core the condition for each element of the section
+ * @param p the element to start at
+ * @param end the end of the string
+ * @param steps if not 0 the call is added to it as a matcher step
+ * @return true if it matches
+ */
+static bool matchesAt(std::vector<StringElementCondition*>& core,StringPointer p,StringPointer end,unsigned long* steps){
+  if(steps)
+    ++*steps;
+  for(unsigned int i=0;i<core.size();++i,++p)
+    if(p==end || !core[i]->matches(p))
+      return false;
+  return true;
+}
+
+bool ActionSetStringRoute::singlePass() const{
+  int n=ranges.count;
+  if(n<3 || ranges.group_count!=1 || ranges.groups[0].a!=1 || ranges.groups[0].b!=n-2)
+    return false;
+  if(!matchesAnything(ranges.pattern[0]) || !matchesAnything(ranges.pattern[n-1]))
+    return false;
+  bool empty=true;
+  for(int i=1;i<n-1;++i){
+    const Pair<PatternTag,StringElementCondition>& p=ranges.pattern[i];
+    // the locations aren't right until the end so they can't be checked
+    if(p.a.min!=p.a.max || p.a.min<0 || p.b.xrange_count!=0 || p.b.yrange_count!=0 || p.b.zrange_count!=0)
+      return false;
+    if(p.a.min>0)
+      empty=false;
+  }
+  return !empty;
+}
+
+bool ActionSetStringRoute::rewriteAll(ScriptResponse& r,SP<String> s){
+  if(!singlePass())
+    return false;
+  int n=ranges.count;
+  int length=s->length();
+  std::vector<StringElementCondition*> core;
+  for(int i=1;i<n-1;++i){
+    Pair<PatternTag,StringElementCondition>& p=ranges.pattern[i];
+    // too long to ever match
+    if(p.a.min>length-(int)core.size())
+      return true;
+    core.insert(core.end(),p.a.min,&p.b);
+  }
+
+  // the first part of the pattern picks the first match if it is lazy or the last if it is greedy.
+  // Replacing a section can only make new matches that overlap it so the search carries on from there.
+  StringEdit se(s);
+  bool changed=false;
+  int size=core.size();
+  if(!ranges.pattern[0].a.greedy){
+    StringPointer t=s->begin();
+    while(t!=s->end()){
+      if(!matchesAt(core,t,s->end(),r.matchSteps)){
+        ++t;
+        continue;
+      }
+      StringPointer ep=t;
+      for(int i=0;i<size;++i)
+        ++ep;
+      // the elements before t aren't changed so find where to carry on from first
+      StringPointer back=t;
+      int i=0;
+      for(;i<size && back!=s->begin();++i)
+        --back;
+      se.replaceStringSegment(t,ep,count,route);
+      changed=true;
+      if(i<size)
+        t=s->begin();
+      else
+        t=++back;
+    }
+  }else{
+    StringPointer t=s->end();
+    while(t!=s->begin()){
+      --t;
+      if(!matchesAt(core,t,s->end(),r.matchSteps))
+        continue;
+      StringPointer ep=t;
+      for(int i=0;i<size;++i)
+        ++ep;
+      se.replaceStringSegment(t,ep,count,route);
+      changed=true;
+      // the matches starting from ep on have already been ruled out
+      t=ep;
+    }
+  }
+  if(changed){
+    se.relayoutString();
+    r.stringChanged=true;
+  }
+  return true;
+}
+
 void ActionSetStringRoute::doCommon(ScriptResponse& r,SP<String> s){
   if(!ranges.groupCount())
     return;
+  if(all && rewriteAll(r,s))
+    return;
   StringEdit se(s);
   SPA<Pair<SP<StringPointer> > > groups(ranges.groupCount());
-  while(ranges.match(s,groups)){
+  while(ranges.match(s,groups,r.matchSteps)){
     for(int i=0;i<ranges.groupCount();++i){
       se.setStringSegment(*groups[i].a,*groups[i].b,count,route);
     }
@@ -547,15 +1033,20 @@ IOResult read(HypIStream& s,ActionSetStringRoute& a){
   IOResult r=read(s,a.ranges);
   if(!r.ok)
     return r;
-  if(!(r=read(s,a.count,0)).ok){
-    a.count=0;
-    return r;
-  }
-  a.route=SPA<Dirn>(a.count);
-  for(int i=0;i<a.count;++i){
-    if(!(r=read(s,(int&)a.route[i],0)).ok)
-      return r;
+  int count;
+  r=readCount(s,count);
+  std::vector<Dirn> route;
+  route.reserve(count<READ_RESERVE?count:READ_RESERVE);
+  for(int i=0;r.ok && i<count;++i){
+    int d;
+    if((r=read(s,d,0)).ok && (d<0 || d>=6))
+      r=IOResult(false,r.eof);
+    route.push_back(r.ok?from_id(d):UP);
   }
+  a.count=route.size();
+  a.route=toArray(route);
+  if(!r.ok)
+    return r;
   return read(s,a.all);
 }
 bool write(HypOStream& s,const ActionSetStringRoute& a){
@@ -607,18 +1098,22 @@ IOResult read(HypIStream& s,Script& sc){
     else
       return IOResult(false,false);
   }
+  if(n<0)
+    return IOResult(false,r.eof);
+  std::vector<Event> es;
+  es.reserve(n<READ_RESERVE?n:READ_RESERVE);
+  for(int i=0;r.ok && i<n;++i){
+    es.push_back(Event());
+    r=read(s,es.back());
+  }
+  // if an event couldn't be read it is kept as it was left and the ones after it are dropped
+  n=es.size();
   sc.eventcount=n;
-  SPA<Event> es(n);
-  for(int i=0;i<n;++i)
-    if(!(r=read(s,es[i])).ok){
-      sc.events=es;
-      sc.times=SPA<int>(n);
-      return r;
-    }
-  sc.events=es;
+  sc.events=toArray(es);
   sc.times=SPA<int>(n);
   for(int i=0;i<n;++i)
     sc.times[i]=-1;
+  sc.reindex();
   return r;
 }
 bool write(HypOStream& s,const Script& sc){
@@ -630,52 +1125,206 @@ bool write(HypOStream& s,const Script& sc){
   return true;
 }
 
-ScriptResponseStart Script::runStart(SP<String> s){
-  ScriptResponseStart r;
+/// Compile a condition and add it to a program
+/**
+ * @param c the condition
+ * @param program the program to add to
+ */
+static void compileCondition(Condition* c,std::vector<ConditionInstruction>& program){
+  typedef ConditionInstruction I;
+  if(c==0){
+    program.push_back(I(I::CONST,0));
+    return;
+  }
+  switch(c->getid()){
+    case ConditionTrue::id:
+      program.push_back(I(I::CONST,1));
+      return;
+    case ConditionOr::id:
+    case ConditionAnd::id:
+      {
+        bool isOr=c->getid()==ConditionOr::id;
+        int count=isOr?static_cast<ConditionOr*>(c)->count:static_cast<ConditionAnd*>(c)->count;
+        SPA<SP<Condition> >& conditions=isOr?static_cast<ConditionOr*>(c)->conditions:static_cast<ConditionAnd*>(c)->conditions;
+        if(count<=0){
+          program.push_back(I(I::CONST,isOr?0:1));
+          return;
+        }
+        // every jump goes to the end once the result is known
+        std::vector<int> jumps;
+        for(int i=0;i<count;++i){
+          compileCondition(&*conditions[i],program);
+          if(i+1<count){
+            jumps.push_back(program.size());
+            program.push_back(I(isOr?I::JUMPIFTRUE:I::JUMPIFFALSE,0));
+          }
+        }
+        for(unsigned int i=0;i<jumps.size();++i)
+          program[jumps[i]].arg=program.size();
+      }
+      return;
+    case ConditionNot::id:
+      compileCondition(&*static_cast<ConditionNot*>(c)->condition,program);
+      program.push_back(I(I::NOT,0));
+      return;
+    case ConditionAfter::id:
+      program.push_back(I(I::AFTER,static_cast<ConditionAfter*>(c)->event,static_cast<ConditionAfter*>(c)->delay));
+      return;
+    case ConditionBefore::id:
+      program.push_back(I(I::BEFORE,static_cast<ConditionBefore*>(c)->event));
+      return;
+    case ConditionStringPattern::id:
+      program.push_back(I(I::PATTERN,0,0,c));
+      return;
+    default:
+      program.push_back(I(I::CALL,0,0,c));
+  }
+}
+
+void Script::reindex(){
+  std::vector<ConditionInstruction> code;
+  programstart=SPA<int>(eventcount);
   for(int i=0;i<eventcount;++i){
-    if((events[i].trigger&TRIGGER_START)!=0){
-      if(events[i].condition->is(now,*this,SP<const String>(s))){
-        events[i].action->doStart(r,s);
+    programstart[i]=code.size();
+    compileCondition(&*events[i].condition,code);
+    code.push_back(ConditionInstruction());
+  }
+  program=SPA<ConditionInstruction>(code.size());
+  for(unsigned int i=0;i<code.size();++i)
+    program[i]=code[i];
+
+  for(int t=TRIGGER_SLOT_START;t<TRIGGER_COUNT;++t){
+    // the trigger in slot t has the value 1<<t
+    int n=0;
+    for(int i=0;i<eventcount;++i)
+      if(events[i].trigger&(1<<t))
+        ++n;
+    triggeredcount[t]=n;
+    triggered[t]=SPA<int>(n);
+    n=0;
+    for(int i=0;i<eventcount;++i)
+      if(events[i].trigger&(1<<t))
+        triggered[t][n++]=i;
+  }
+}
+
+bool Script::test(int event,const String& s){
+  bool result=false;
+  for(int pc=programstart[event];;++pc){
+    const ConditionInstruction& in=program[pc];
+    switch(in.op){
+      case ConditionInstruction::END:
+        return result;
+      case ConditionInstruction::CONST:
+        result=in.arg;
+        break;
+      case ConditionInstruction::BEFORE:
+        result=getTime(in.arg)==-1;
+        break;
+      case ConditionInstruction::AFTER:
+        {
+          int eventtime=getTime(in.arg);
+          result=eventtime!=-1 && eventtime+in.arg2<=now;
+        }
+        break;
+      case ConditionInstruction::PATTERN:
+        // the type is known so skip the virtual call
+        result=static_cast<ConditionStringPattern*>(in.condition)->ConditionStringPattern::is(now,*this,s);
+        break;
+      case ConditionInstruction::CALL:
+        result=in.condition->is(now,*this,s);
+        break;
+      case ConditionInstruction::NOT:
+        result=!result;
+        break;
+      case ConditionInstruction::JUMPIFTRUE:
+        if(result)
+          pc=in.arg-1;
+        break;
+      case ConditionInstruction::JUMPIFFALSE:
+        if(!result)
+          pc=in.arg-1;
+        break;
+    }
+  }
+}
+
+template <class RESPONSE>
+void Script::run(TriggerSlot trigger,RESPONSE& r,SP<String> s,void (Action::*action)(RESPONSE&,SP<String>)){
+  if(!profile){
+    for(int j=0;j<triggeredcount[trigger];++j){
+      int i=triggered[trigger][j];
+      if(test(i,*s)){
+        ((*events[i].action).*action)(r,s);
         times[i]=now;
       }
     }
+    return;
+  }
+  clock_t start=clock();
+  unsigned long steps;
+  matchSteps=&steps;
+  r.matchSteps=&steps;
+  for(int j=0;j<triggeredcount[trigger];++j){
+    int i=triggered[trigger][j];
+    steps=0;
+    clock_t before=clock();
+    bool matched=test(i,*s);
+    profile->condition(i,clock()-before,steps,matched);
+    if(matched){
+      steps=0;
+      before=clock();
+      ((*events[i].action).*action)(r,s);
+      profile->action(i,clock()-before,steps);
+      times[i]=now;
+    }
   }
+  matchSteps=0;
+  r.matchSteps=0;
+  profile->run(clock()-start);
+}
+
+ScriptResponseStart Script::runStart(SP<String> s){
+  ScriptResponseStart r;
+  run(TRIGGER_SLOT_START,r,s,&Action::doStart);
   return r;
 }
 ScriptResponseWin Script::runWin(SP<String> s){
   ScriptResponseWin r;
-  for(int i=0;i<eventcount;++i){
-    if((events[i].trigger&TRIGGER_WIN)!=0){
-      if(events[i].condition->is(now,*this,SP<const String>(s))){
-        events[i].action->doWin(r,s);
-        times[i]=now;
-      }
-    }
-  }
+  run(TRIGGER_SLOT_WIN,r,s,&Action::doWin);
   return r;
 }
 ScriptResponseMove Script::runMove(SP<String> s){
   ScriptResponseMove r;
-  for(int i=0;i<eventcount;++i){
-    if((events[i].trigger&TRIGGER_MOVE)!=0){
-      if(events[i].condition->is(now,*this,SP<const String>(s))){
-        events[i].action->doMove(r,s);
-        times[i]=now;
-      }
-    }
-  }
+  run(TRIGGER_SLOT_MOVE,r,s,&Action::doMove);
   return r;
 }
 ScriptResponseSelect Script::runSelect(SP<String> s){
   ScriptResponseSelect r;
-  for(int i=0;i<eventcount;++i){
-    if((events[i].trigger&TRIGGER_SELECT)!=0){
-      if(events[i].condition->is(now,*this,SP<const String>(s))){
-        events[i].action->doSelect(r,s);
-        times[i]=now;
-      }
-    }
-  }
+  run(TRIGGER_SLOT_SELECT,r,s,&Action::doSelect);
   return r;
 }
 
+/// Find the last ActionWinNextLevel in an action
+/**
+ * @param a the action
+ * @param next set to the next level of the last ActionWinNextLevel found
+ */
+static void findNextLevel(const SP<Action>& a,Pair<SPA<const char> >& next){
+  if(a.isnull())
+    return;
+  if(a->getid()==ActionMulti::id){
+    ActionMulti& m=static_cast<ActionMulti&>(*a);
+    for(int i=0;i<m.num;++i)
+      findNextLevel(m.actions[i],next);
+  }else if(a->getid()==ActionWinNextLevel::id)
+    next=static_cast<ActionWinNextLevel&>(*a).nextLevel;
+}
+
+Pair<SPA<const char> > Script::findNextLevel() const{
+  Pair<SPA<const char> > next;
+  for(int i=0;i<triggeredcount[TRIGGER_SLOT_WIN];++i)
+    ::findNextLevel(events[triggered[TRIGGER_SLOT_WIN][i]].action,next);
+  return next;
+}
+
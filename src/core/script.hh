@@ -76,15 +76,24 @@ class PolymorphicHypIO{
     virtual int getid() const=0;
 };
 
-///the different maze events that can trigger scripts
+///the index of each trigger in the tables a Script keeps for each trigger
+enum TriggerSlot{
+  TRIGGER_SLOT_START,///<the slot for TRIGGER_START
+  TRIGGER_SLOT_WIN,///<the slot for TRIGGER_WIN
+  TRIGGER_SLOT_MOVE,///<the slot for TRIGGER_MOVE
+  TRIGGER_SLOT_SELECT,///<the slot for TRIGGER_SELECT
+  TRIGGER_COUNT///<the number of different triggers
+};
+///the different maze events that can trigger scripts. The trigger in slot n has the value 1<<n
 enum Trigger{
-  TRIGGER_START=1,///<trigger when the maze is loaded
-  TRIGGER_WIN=2,///<trigger when they have won the maze
-  TRIGGER_MOVE=4,///<trigger when the string is moved
-  TRIGGER_SELECT=8///<trigger when the string selection is changed
+  TRIGGER_START=1<<TRIGGER_SLOT_START,///<trigger when the maze is loaded
+  TRIGGER_WIN=1<<TRIGGER_SLOT_WIN,///<trigger when they have won the maze
+  TRIGGER_MOVE=1<<TRIGGER_SLOT_MOVE,///<trigger when the string is moved
+  TRIGGER_SELECT=1<<TRIGGER_SLOT_SELECT///<trigger when the string selection is changed
 };
 
 class Script;
+class ScriptProfile; // defined in scriptprofile.hh
 
 ///A Condition to select if an event should trigger or not
 class Condition: public virtual PolymorphicHypIO{
@@ -96,7 +105,16 @@ class Condition: public virtual PolymorphicHypIO{
      * @param s the current string object
      * @return true if the condition is matched and the event should trigger
      */
-    virtual bool is(int time,const Script& script,SP<const String> s)=0;
+    virtual bool is(int time,const Script& script,const String& s)=0;
+    ///Get the result of the condition without doing any work if it is already known
+    /**
+     * Conditions that remember their last result can give it back here while the
+     * string is unchanged so ConditionOr and ConditionAnd can skip the rest.
+     * @param s the current string object
+     * @return 1 if the condition is known to be matched, 0 if it is known not to
+     * be or -1 if it must be checked with is()
+     */
+    virtual int cachedResult(const String& s){return -1;}
     ///virtual destructor to allow overiding in subclasses
     virtual ~Condition(){};
   public:
@@ -156,8 +174,9 @@ struct ScriptResponse{
   bool stringSelectionChanged;///<has the selection been changed by the script
   int messageCount;///<the number of messages that need to be shown
   SPA<Message> messages;///<the messages that need to be shown
+  unsigned long* matchSteps;///<where the actions count their string matcher steps while the script is profiled or 0
   ///default constructor to setup the response as no actions taken or to take
-  ScriptResponse():stringChanged(false),stringSelectionChanged(false),messageCount(0),messages(0){};
+  ScriptResponse():stringChanged(false),stringSelectionChanged(false),messageCount(0),messages(0),matchSteps(0){};
 };
 ///response from a script for a start event
 /**
@@ -262,6 +281,40 @@ class Event{
        trigger(trigger),condition(condition),action(action){};
 };
 
+///An instruction in the compiled form of the conditions of a script
+/**
+ * Each instruction updates a single result value. Or and And are compiled to
+ * jumps past the rest of their conditions once the result is known.
+ */
+struct ConditionInstruction{
+  ///The operations
+  enum Op{
+    END,///<stop and give the result
+    CONST,///<set the result to arg
+    BEFORE,///<set the result to if event arg hasn't run
+    AFTER,///<set the result to if event arg ran at least arg2 seconds ago
+    PATTERN,///<set the result to if the string matches the ConditionStringPattern in condition
+    CALL,///<set the result to condition->is() for any other condition
+    NOT,///<negate the result
+    JUMPIFTRUE,///<carry on at arg if the result is true
+    JUMPIFFALSE///<carry on at arg if the result is false
+  };
+  Op op;///<the operation
+  int arg;///<the first argument
+  int arg2;///<the second argument
+  Condition* condition;///<the condition for PATTERN and CALL which is kept alive by its event
+  ///default constructor for an END instruction
+  ConditionInstruction():op(END),arg(0),arg2(0),condition(0){};
+  ///Create an instruction
+  /**
+   * @param op the operation
+   * @param arg the first argument
+   * @param arg2 the second argument
+   * @param condition the condition for PATTERN and CALL
+   */
+  ConditionInstruction(Op op,int arg,int arg2=0,Condition* condition=0):op(op),arg(arg),arg2(arg2),condition(condition){};
+};
+
 ///The core script object
 class Script{
   private:
@@ -269,29 +322,92 @@ class Script{
     SPA<Event> events; ///< The array of events for this script
     SPA<int> times; ///< The last trigger times for each event
     int now; ///< The time now
+    int triggeredcount[TRIGGER_COUNT]; ///< The number of events with each trigger
+    SPA<int> triggered[TRIGGER_COUNT]; ///< The indices of the events with each trigger in order
+    SPA<ConditionInstruction> program; ///< The compiled conditions of all the events
+    SPA<int> programstart; ///< The start in program of each event's condition
+    ScriptProfile* profile; ///< Where to record the cost of running the events or 0 to not record it
+    unsigned long* matchSteps; ///< Where the conditions count their string matcher steps while profiled or 0
+
+    ///Run the events for a trigger
+    /**
+     * @tparam RESPONSE the type of response for the trigger
+     * @param trigger the slot of the trigger
+     * @param r the response to record the actions in
+     * @param s the string
+     * @param action the method of Action to run for the trigger
+     */
+    template <class RESPONSE>
+    void run(TriggerSlot trigger,RESPONSE& r,SP<String> s,void (Action::*action)(RESPONSE&,SP<String>));
+
+    ///Check if the condition for an event is matched using the compiled conditions
+    /**
+     * This gives the same result as the event's condition itself.
+     * @param event the index of the event
+     * @param s the current string
+     * @return true if the condition is matched
+     */
+    bool test(int event,const String& s);
   public:
     ///Create a new empty script
-    Script():eventcount(0),events(),times(),now(0){};
+    Script():eventcount(0),events(),times(),now(0),profile(0),matchSteps(0){
+      reindex();
+    };
     ///Create a script for some events
     /**
      * @param eventcount the number of events the new script will have
      * @param events the actual event for the new script
      */
-    Script(int eventcount,const SPA<Event>& events):eventcount(eventcount),events(events),times(eventcount),now(0){
+    Script(int eventcount,const SPA<Event>& events):eventcount(eventcount),events(events),times(eventcount),now(0),profile(0),matchSteps(0){
       for(int i=0;i<eventcount;++i)
         times[i]=-1;
+      reindex();
     };
+
+    /// Rebuild the lists of events for each trigger and compile their conditions
+    /**
+     * This is done when the script is created or read. It must be called again after
+     * any event is changed.
+     */
+    void reindex();
     /// Get the time the specified event last ran
     /**
+     * A condition read from a damaged level can refer to an event that was
+     * dropped so an event that isn't in the script has never run.
      * @param event the index of the event in question
-     * @return the time the specified event ran
+     * @return the time the specified event ran or -1 if it hasn't
      */
     inline int getTime(int event) const{
       if(event<0 || event>=eventcount)
-        return *((int*)0);
+        return -1;
       return times[event];
     }
 
+    /// Start or stop recording the cost of running the events
+    /**
+     * The profile isn't owned by the script and must last as long as it is set.
+     * It is copied along with the script so it must be set again after a new
+     * script is assigned.
+     * @param p the profile to add to or 0 to stop recording
+     */
+    inline void setProfile(ScriptProfile* p){
+      profile=p;
+    }
+    /// Get the profile being recorded
+    /**
+     * @return the profile or 0 if there isn't one
+     */
+    inline ScriptProfile* getProfile() const{
+      return profile;
+    }
+    /// Get where the conditions count their string matcher steps
+    /**
+     * @return the count while an event's condition is being profiled or 0
+     */
+    inline unsigned long* getMatchSteps() const{
+      return matchSteps;
+    }
+
     /// Update the scripts version of the current time
     /**
      * @param t the time now
@@ -325,10 +441,21 @@ class Script{
      */
     ScriptResponseSelect runSelect(SP<String> s);
 
+    /// Find the next level a win would offer
+    /**
+     * This is the level of the last ActionWinNextLevel in the events for a win, which
+     * is the one offered if all their conditions are true. It lets the level be
+     * loaded before the maze is won.
+     * @return the url and name of the level which are null if there isn't one
+     */
+    Pair<SPA<const char> > findNextLevel() const;
+
     /// Private access so it can load the script into it
     friend IOResult read(HypIStream& s,Script& sc);
     /// Private access so it write the data out
     friend bool write(HypOStream& s,const Script& sc);
+    /// Private access so the unit tests can compare the compiled conditions with the events
+    friend struct ScriptTest;
 
     /// Get the events in this script
     inline const SPA<Event>& getevents() const{
@@ -77,14 +77,61 @@ struct StringElementCondition{
   SPA<Range> zrange;///<a list of the valid ranges in the z direction
   ///Check if a string element matches this condition
   /**
+   * This uses the compiled form of the condition
    * @tparam the type for the string pointer
    * @param el the element of the string
    * @returns true if the string matches this condition
    */
   template <class T>
   inline bool matches(T el);
+  ///Compile the condition into the form used by matches
+  /**
+   * This is done when the condition is read. It must be called again after any of the
+   * conditions are changed or else matching will still use the old conditions.
+   */
+  void compile();
+  ///Check if a string element could match both this condition and another
+  /**
+   * This uses the compiled form of both conditions
+   * @param o the other condition
+   * @return true if there is an element that matches both
+   */
+  bool overlaps(const StringElementCondition& o) const;
+  ///Check if no string element can match this condition
+  /**
+   * This uses the compiled form of the condition
+   * @return true if nothing matches
+   */
+  inline bool matchesNothing() const{
+    return accept==0 || interval_count[0]==0 || interval_count[1]==0 || interval_count[2]==0;
+  }
   ///Default constructor that initialises the condition to match everything
-  StringElementCondition():selectionCondition(2),dirnsCondition(ALLDIRNSMASK),xrange_count(0),xrange(),yrange_count(0),yrange(),zrange_count(0),zrange(){};
+  StringElementCondition():selectionCondition(2),dirnsCondition(ALLDIRNSMASK),xrange_count(0),xrange(),yrange_count(0),yrange(),zrange_count(0),zrange(){
+    compile();
+  };
+  private:
+    /// Mask of the elements to accept by selection and direction. Bit selected*6+to_id(d) is set to accept.
+    int accept;
+    int interval_count[3];///<the number of intervals for each axis
+    /// Sorted inclusive intervals of the accepted positions along each axis
+    /**
+     * Overlapping and touching ranges are merged and the no limit values are replaced by INT_MIN and INT_MAX
+     * so each test is just two comparisons
+     */
+    SPA<Pair<int> > intervals[3];
+    ///Check if a position along an axis is in one of the intervals for the axis
+    /**
+     * @param axis the axis, 0 for x, 1 for y and 2 for z
+     * @param v the position along the axis
+     * @return true if it is in an interval
+     */
+    inline bool inIntervals(int axis,int v) const{
+      const Pair<int>* in=&intervals[axis][0];
+      bool found=false;
+      for(int i=0;i<interval_count[axis];++i)
+        found|=(v>=in[i].a)&(v<=in[i].b);
+      return found;
+    }
 };
 
 ///Read a StringElementCondition from a stream
@@ -161,9 +208,14 @@ class StringMatcherCallback{
 ///a class to implement matching against a string and optionally allow use of the matches
 /**
  * The pattern must match the entire string from start to end. A pattern that can match anywhere in the string
- * can be implemented by adding a pattern element that can match anything and any length. The match is done
- * using a recursive backtracking matcher function. The sections of the patter that we are interested in are
- * specified by groups property.
+ * can be implemented by adding a pattern element that can match anything and any length. The sections of the
+ * patter that we are interested in are specified by groups property.
+ *
+ * When the pattern is read it is compiled into a small program that is run as a Pike VM, stepping through
+ * the string once with every possible place in the pattern tracked at the same time. This takes time
+ * proportional to the length of the string times the size of the program. The first match found is the same
+ * one the recursive backtracking matcher would find. The backtracking matcher is still used to find every
+ * match for a callback and for patterns that haven't been compiled or are too large to compile.
  */
 class StringMatcher{
   public:
@@ -172,12 +224,31 @@ class StringMatcher{
     int group_count;///<the number of groups to output
     SPA<Pair<int> > groups;///<the indicies in the part of the start and end of each group to output
     ///default constructor that sets up with no pattern elements and no groups
-    StringMatcher():count(0),pattern(),group_count(0),groups(){};
+    StringMatcher():count(0),pattern(),group_count(0),groups(),program_count(0),program(),slot_count(0),group_slots(){};
+
+    ///Compile the pattern so it can be matched without backtracking
+    /**
+     * This is done when the pattern is read. It must be called again after the pattern or groups are changed
+     * or else matching will still use the old pattern. If the pattern can't be compiled then the backtracking
+     * matcher is used instead.
+     * @return true if the pattern was compiled
+     */
+    bool compile();
     ///get the number of groups this matchers will return
     /**
      * @return how many groups this matcher will return
      */
     inline int groupCount(){return group_count;}
+    ///check if matching depends on which elements of the string are selected
+    /**
+     * @return true if any element of the pattern has a condition on the selection
+     */
+    bool usesSelection() const;
+    ///get the size of the compiled pattern
+    /**
+     * @return the number of instructions in the compiled pattern or 0 if it isn't compiled
+     */
+    inline int programSize() const{return program_count;}
 
     ///check a match against a constant String
     /**
@@ -185,18 +256,27 @@ class StringMatcher{
      * it must have length groupCount()
      * @param s the string to match this pattern against
      * @param groups optional argument that will be filled with the groups matched by this pattern
+     * @param steps if not 0 the steps taken are added to it
      * @return true if there are any matches of this pattern to the string
      */
-    bool match(SP<const String> s,SPA<Pair<SP<ConstStringPointer> > > groups=SPA<Pair<SP<ConstStringPointer> > >());
+    bool match(SP<const String> s,SPA<Pair<SP<ConstStringPointer> > > groups=SPA<Pair<SP<ConstStringPointer> > >(),unsigned long* steps=0);
     ///check a match against a non-constant String
     /**
      * can also return the groups if the optional paramiter groups is included. If included
      * it must have length groupCount()
      * @param s the string to match this pattern against
      * @param groups optional argument that will be filled with the groups matched by this pattern
+     * @param steps if not 0 the steps taken are added to it
+     * @return true if there are any matches of this pattern to the string
+     */
+    bool match(      SP<String> s,SPA<Pair<SP<     StringPointer> > > groups=SPA<Pair<SP<     StringPointer> > >(),unsigned long* steps=0);
+    ///check a match against a String without finding the groups
+    /**
+     * @param s the string to match this pattern against
+     * @param steps if not 0 the steps taken are added to it
      * @return true if there are any matches of this pattern to the string
      */
-    bool match(      SP<String> s,SPA<Pair<SP<     StringPointer> > > groups=SPA<Pair<SP<     StringPointer> > >());
+    bool match(const String& s,unsigned long* steps=0);
     ///check a match against a constant String and process each match found
     /**
      * can also return the groups if the optional paramiter groups is included. If included
@@ -204,10 +284,11 @@ class StringMatcher{
      * @param s the string to match this pattern against
      * @param cb the call back class to use to process the matches
      * @param groups optional argument that will be filled with the groups matched by this pattern
+     * @param steps if not 0 the steps taken are added to it
      * @return true if there are any matches of this pattern to the string
      */
     bool match(SP<const String> s,StringMatcherCallback<ConstStringPointer>& cb,
-        SPA<Pair<SP<ConstStringPointer> > > groups=SPA<Pair<SP<ConstStringPointer> > >());
+        SPA<Pair<SP<ConstStringPointer> > > groups=SPA<Pair<SP<ConstStringPointer> > >(),unsigned long* steps=0);
     ///check a match against a non-constant String
     /**
      * can also return the groups if the optional paramiter groups is included. If included
@@ -215,12 +296,56 @@ class StringMatcher{
      * @param s the string to match this pattern against
      * @param cb the call back class to use to process the matches
      * @param groups optional argument that will be filled with the groups matched by this pattern
+     * @param steps if not 0 the steps taken are added to it
      * @return true if there are any matches of this pattern to the string
      */
     bool match(      SP<String> s,StringMatcherCallback<     StringPointer>& cb,
-        SPA<Pair<SP<     StringPointer> > > groups=SPA<Pair<SP<     StringPointer> > >());
+        SPA<Pair<SP<     StringPointer> > > groups=SPA<Pair<SP<     StringPointer> > >(),unsigned long* steps=0);
 
   private:
+    ///The operations for the compiled form of the pattern
+    enum OpCode{
+      OP_ELEMENT,///<match one element against the condition for pattern element arg and move on
+      OP_SPLIT,///<carry on at arg and at arg2 with arg taking priority
+      OP_JUMP,///<carry on at arg
+      OP_SAVE,///<store the position in capture slot arg
+      OP_MATCH///<a match if the whole string has been used
+    };
+    ///An instruction for the compiled form of the pattern
+    struct Instruction{
+      OpCode op;///<the operation
+      int arg;///<the first argument
+      int arg2;///<the second argument
+      ///default constructor for a match instruction
+      Instruction():op(OP_MATCH),arg(0),arg2(0){};
+      ///Create an instruction
+      /**
+       * @param op the operation
+       * @param arg the first argument
+       * @param arg2 the second argument
+       */
+      Instruction(OpCode op,int arg,int arg2=0):op(op),arg(arg),arg2(arg2){};
+    };
+    ///The largest program a pattern will be compiled to
+    static const int MAX_PROGRAM=4096;
+
+    int program_count;///<the number of instructions in the compiled pattern or 0 if it isn't compiled
+    SPA<Instruction> program;///<the compiled pattern
+    int slot_count;///<the number of capture slots used by the compiled pattern
+    SPA<Pair<int> > group_slots;///<the capture slots for the start and end of each group
+
+    ///Match using the compiled pattern
+    /**
+     * @tparam STRING the type of the string. Either String or const String
+     * @tparam POINTER the type of a pointer to an element of the string of type STRING.
+     * Either StringPointer or ConstStringPointer respectively
+     * @param s the string to match this pattern against
+     * @param groups optional argument that will be filled with the groups matched by this pattern
+     * @param steps if not 0 the elements tested are added to it
+     * @return true if there is a match of this pattern to the string
+     */
+    template <class STRING,class POINTER>
+    bool matchCompiled(STRING& s,SPA<Pair<SP<POINTER> > > groups,unsigned long* steps);
     ///The internal implementation function for matches
     /**
      * called by all the other match functions. This sets up some data storage and then called
@@ -231,10 +356,11 @@ class StringMatcher{
      * @param s the string to match this pattern against
      * @param groups optional argument that will be filled with the groups matched by this pattern
      * @param cb option pointer to the callback
+     * @param steps if not 0 the steps taken are added to it
      * @return true if there are any matches of this pattern to the string
      */
     template <class STRING,class POINTER>
-    bool match(SP<STRING> s,SPA<Pair<SP<POINTER> > > groups,StringMatcherCallback<POINTER>* cb);
+    bool match(STRING& s,SPA<Pair<SP<POINTER> > > groups,StringMatcherCallback<POINTER>* cb,unsigned long* steps);
     ///The internal implementation function for a step in matching against a string
     /**
      * This function does the actual processing. It finds the "best" match for this segment of the pattern
@@ -251,11 +377,12 @@ class StringMatcher{
      * @param level the index into the pattern that we are matching against
      * @param groups optional argument that will be filled with the groups matched by this pattern
      * @param cb option pointer to the callback
+     * @param steps if not 0 the calls of this are added to it
      * @return true if there are any matches of this pattern to the string
      */
     template <class STRING,class POINTER>
-    bool matchStep(SP<STRING> s,POINTER p,SPA<PatternMatch<POINTER> > matches,int level,
-        SPA<Pair<SP<POINTER> > > groups,StringMatcherCallback<POINTER>* cb);
+    bool matchStep(STRING& s,POINTER p,SPA<PatternMatch<POINTER> > matches,int level,
+        SPA<Pair<SP<POINTER> > > groups,StringMatcherCallback<POINTER>* cb,unsigned long* steps);
 };
 
 ///Read a StringMatcher from a stream
@@ -280,7 +407,10 @@ class ConditionTrue: public Condition, public PolymorphicHypIOImpl<ConditionTrue
     /**
      * @copydoc Condition::is
      */
-    virtual bool is(int time,const Script& script,SP<const String> s){return true;}
+    virtual bool is(int time,const Script& script,const String& s){return true;}
+    ///@copydoc Condition::cachedResult
+    ///always known to be matched
+    virtual int cachedResult(const String& s){return 1;}
 };
 ///Read a ConditionTrue from a stream
 /**
@@ -306,9 +436,13 @@ class ConditionOr: public Condition, public PolymorphicHypIOImpl<ConditionOr,2>{
     int count;///< the number of conditions we combine the results of
     ///return true if any of the contained conditions return true
     /**
+     * conditions that already know their result are checked first
      * @copydoc Condition::is
      */
-    virtual bool is(int time,const Script& script,SP<const String> s);
+    virtual bool is(int time,const Script& script,const String& s);
+    ///@copydoc Condition::cachedResult
+    ///known to be true if any of the contained conditions are
+    virtual int cachedResult(const String& s);
 };
 ///Read a ConditionOr from a stream
 /**
@@ -332,9 +466,13 @@ class ConditionAnd: public Condition, public PolymorphicHypIOImpl<ConditionAnd,3
     int count;///< the number of conditions we combine the results of
     ///return false if any of the contained conditions return false
     /**
+     * conditions that already know their result are checked first
      * @copydoc Condition::is
      */
-    virtual bool is(int time,const Script& script,SP<const String> s);
+    virtual bool is(int time,const Script& script,const String& s);
+    ///@copydoc Condition::cachedResult
+    ///known to be false if any of the contained conditions are
+    virtual int cachedResult(const String& s);
 };
 ///Read a ConditionAnd from a stream
 /**
@@ -359,9 +497,15 @@ class ConditionNot: public Condition, public PolymorphicHypIOImpl<ConditionNot,4
     /**
      * @copydoc Condition::is
      */
-    virtual bool is(int time,const Script& script,SP<const String> s){
+    virtual bool is(int time,const Script& script,const String& s){
       return !condition->is(time,script,s);
     }
+    ///@copydoc Condition::cachedResult
+    ///the negation of the contained condition's cached result
+    virtual int cachedResult(const String& s){
+      int r=condition->cachedResult(s);
+      return r<0?-1:!r;
+    }
 };
 ///Read a ConditionNot from a stream
 /**
@@ -387,7 +531,7 @@ class ConditionAfter: public Condition, public PolymorphicHypIOImpl<ConditionAft
     /**
      * @copydoc Condition::is
      */
-    virtual bool is(int time,const Script& script,SP<const String> s);
+    virtual bool is(int time,const Script& script,const String& s);
 };
 ///Read a ConditionAfter from a stream
 /**
@@ -412,7 +556,7 @@ class ConditionBefore: public Condition, public PolymorphicHypIOImpl<ConditionBe
     /**
      * @copydoc Condition::is
      */
-    virtual bool is(int time,const Script& script,SP<const String> s);
+    virtual bool is(int time,const Script& script,const String& s);
 };
 ///Read a ConditionBefore from a stream
 /**
@@ -433,13 +577,30 @@ bool write(HypOStream& s,const ConditionBefore& c);
 class ConditionStringPattern: public Condition, public PolymorphicHypIOImpl<ConditionStringPattern,7>{
   public:
     StringMatcher sm;///<the string matcher to check the string against
+  private:
+    unsigned int stamp;///<the stamp of the string the last result was for, 0 if there is none
+    bool selection;///<if stamp is a selection stamp rather than a route stamp
+    bool result;///<the last result
+  public:
+    ///Create a condition with an empty pattern
+    ConditionStringPattern():sm(),stamp(0),selection(false),result(false){};
 
     ///return true if the string matches the StringMatcher
     /**
+     * The result is remembered until the string changes
      * @copydoc Condition::is
      */
-    virtual bool is(int time,const Script& script,SP<const String> s){
-      return sm.match(s);
+    virtual bool is(int time,const Script& script,const String& s);
+    ///@copydoc Condition::cachedResult
+    ///the last result if the string hasn't changed since
+    virtual int cachedResult(const String& s){
+      if(stamp!=0 && stamp==(selection?s.getSelectionStamp():s.getRouteStamp()))
+        return result;
+      return -1;
+    }
+    ///Forget the last result after the pattern has been changed
+    inline void resetCache(){
+      stamp=0;
     }
 };
 ///Read a ConditionStringPattern from a stream
@@ -449,6 +610,7 @@ class ConditionStringPattern: public Condition, public PolymorphicHypIOImpl<Cond
  * @return an IOResult object that contains the status of the read
  */
 inline IOResult read(HypIStream& s,ConditionStringPattern& c){
+  c.resetCache();
   return read(s,c.sm);
 }
 ///write a ConditionStringPattern to a stream
@@ -753,6 +915,23 @@ class ActionSetStringRoute:public ActionCommon, public PolymorphicHypIOImpl<Acti
     ///this calls the StringMatcher to find a match then edits the retuned match.
     ///if all is true this is repeated till the pattern fails to match. this can lead to infinite loops
     virtual void doCommon(ScriptResponse& r,SP<String> s);
+    ///Check if all the matches can be set in a single pass over the string
+    /**
+     * @return true if the pattern is one rewriteAll can handle
+     */
+    bool singlePass() const;
+  private:
+    ///Set the route for all matches in a single pass over the string
+    /**
+     * This only works for patterns that are anything, then a fixed length section with no conditions on the
+     * location that is the only group, then anything. Each match is found by carrying on from just before the
+     * last one and the locations are fixed once at the end. The result is the same as matching from the start
+     * again after each change. This is only used when singlePass() is true.
+     * @param r the response to record our actions in
+     * @param s the string to act on
+     * @return false if the pattern isn't one this can handle and nothing was done
+     */
+    bool rewriteAll(ScriptResponse& r,SP<String> s);
 };
 ///Read an ActionSetStringRoute from a stream
 /**
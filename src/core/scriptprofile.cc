@@ -0,0 +1,95 @@
+/**
+ * @file scriptprofile.cc
+ * @brief The implementation of scriptprofile.hh
+ */
+#include "scriptprofile.hh"
+#include <algorithm>
+#include <cstdio>
+
+ScriptProfile::ScriptProfile():events(),runs(0),runTime(0),worstRun(0){};
+
+void ScriptProfile::clear(){
+  events.clear();
+  runs=0;
+  runTime=0;
+  worstRun=0;
+}
+
+void ScriptProfile::condition(int event,clock_t time,unsigned long steps,bool matched){
+  if(event>=(int)events.size())
+    events.resize(event+1);
+  EventStats& e=events[event];
+  e.evaluations++;
+  if(matched)
+    e.triggers++;
+  e.conditionTime+=time;
+  e.conditionSteps+=steps;
+}
+
+void ScriptProfile::action(int event,clock_t time,unsigned long steps){
+  if(event>=(int)events.size())
+    events.resize(event+1);
+  events[event].actionTime+=time;
+  events[event].actionSteps+=steps;
+}
+
+void ScriptProfile::run(clock_t time){
+  runs++;
+  runTime+=time;
+  if(time>worstRun)
+    worstRun=time;
+}
+
+ScriptProfile::EventStats ScriptProfile::get(int event) const{
+  if(event<0 || event>=(int)events.size())
+    return EventStats();
+  return events[event];
+}
+
+/// Sorts event indices with the most expensive first
+struct CostlierEvent{
+  const std::vector<ScriptProfile::EventStats>& events; ///< the totals being sorted
+  /// Create a comparison for some totals
+  /**
+   * @param events the totals
+   */
+  CostlierEvent(const std::vector<ScriptProfile::EventStats>& events):events(events){};
+  /// Compare two events
+  /**
+   * @param a the index of the first event
+   * @param b the index of the second event
+   * @return true if a should come before b
+   */
+  bool operator()(int a,int b) const{
+    clock_t ta=events[a].conditionTime+events[a].actionTime;
+    clock_t tb=events[b].conditionTime+events[b].actionTime;
+    if(ta!=tb)
+      return ta>tb;
+    unsigned long sa=events[a].conditionSteps+events[a].actionSteps;
+    unsigned long sb=events[b].conditionSteps+events[b].actionSteps;
+    if(sa!=sb)
+      return sa>sb;
+    return a<b;
+  }
+};
+
+std::string ScriptProfile::report() const{
+  std::string out;
+  char line[200];
+  double ms=1000.0/CLOCKS_PER_SEC;
+  sprintf(line,"script runs: %lu, average %.4fms, worst %.4fms\n",runs,getAverageRun()*ms,worstRun*ms);
+  out+=line;
+  out+="event   checked triggered condition ms   action ms   condition steps   action steps\n";
+  std::vector<int> order;
+  for(unsigned int i=0;i<events.size();++i)
+    if(events[i].evaluations>0)
+      order.push_back(i);
+  std::sort(order.begin(),order.end(),CostlierEvent(events));
+  for(unsigned int i=0;i<order.size();++i){
+    const EventStats& e=events[order[i]];
+    sprintf(line,"%5d %9lu %9lu %12.3f %11.3f %17lu %14lu\n",order[i],e.evaluations,e.triggers,
+        e.conditionTime*ms,e.actionTime*ms,e.conditionSteps,e.actionSteps);
+    out+=line;
+  }
+  return out;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file scriptprofile.hh
+ * @brief A record of how long each event of a script takes to run
+ */
+
+#include <vector>
+#include <string>
+#include <ctime>
+
+#ifndef SCRIPTPROFILE_HH_INC
+#define SCRIPTPROFILE_HH_INC
+
+/// The cost of running each event of a Script
+/**
+ * A Script only fills this in when it is given one with Script::setProfile so
+ * normal play pays nothing for it. Times are measured with clock() so they are
+ * the processor time used and are only meaningful added up over many runs.
+ * Matcher steps count the calls of the backtracking string matcher plus the
+ * elements tested by the compiled one so they don't depend on the machine.
+ */
+class ScriptProfile{
+  public:
+    /// The totals for a single event
+    struct EventStats{
+      unsigned long evaluations; ///< the number of times the condition was checked
+      unsigned long triggers; ///< the number of times the condition matched and the action was run
+      clock_t conditionTime; ///< the time spent checking the condition
+      clock_t actionTime; ///< the time spent running the action
+      unsigned long conditionSteps; ///< the matcher steps used checking the condition
+      unsigned long actionSteps; ///< the matcher steps used running the action
+      /// Create totals for an event that hasn't been run
+      EventStats():evaluations(0),triggers(0),conditionTime(0),actionTime(0),conditionSteps(0),actionSteps(0){};
+    };
+
+  private:
+    std::vector<EventStats> events; ///< the totals for each event
+    unsigned long runs; ///< the number of times the script was run for any trigger
+    clock_t runTime; ///< the total time of all the runs
+    clock_t worstRun; ///< the time of the slowest run
+
+  public:
+    /// Create an empty profile
+    ScriptProfile();
+
+    /// Forget everything recorded
+    void clear();
+
+    /// Record checking the condition for an event
+    /**
+     * @param event the index of the event
+     * @param time the time taken
+     * @param steps the matcher steps used
+     * @param matched if the condition matched
+     */
+    void condition(int event,clock_t time,unsigned long steps,bool matched);
+    /// Record running the action for an event
+    /**
+     * @param event the index of the event
+     * @param time the time taken
+     * @param steps the matcher steps used
+     */
+    void action(int event,clock_t time,unsigned long steps);
+    /// Record a whole run of the script for a trigger
+    /**
+     * @param time the time taken
+     */
+    void run(clock_t time);
+
+    /// Get the totals for an event
+    /**
+     * @param event the index of the event
+     * @return the totals which are all zero if the event hasn't been run
+     */
+    EventStats get(int event) const;
+    /// Get the number of times the script was run
+    /**
+     * @return the number of runs
+     */
+    inline unsigned long getRuns() const{
+      return runs;
+    }
+    /// Get the time of the slowest run
+    /**
+     * @return the time in clock() ticks
+     */
+    inline clock_t getWorstRun() const{
+      return worstRun;
+    }
+    /// Get the average time of a run
+    /**
+     * @return the time in clock() ticks
+     */
+    inline double getAverageRun() const{
+      return runs?(double)runTime/runs:0;
+    }
+
+    /// Write a report of the events sorted by the time they took
+    /**
+     * @return the report as lines of text
+     */
+    std::string report() const;
+};
+
+#endif
@@ -3,8 +3,32 @@
  * @brief The implementation of string.hh
  */
 #include "string.hh"
+#include "movelog.hh"
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/// Get a new stamp for a String
+/**
+ * Strings on different threads can change at the same time so this is atomic.
+ * @return a stamp that hasn't been given out before
+ */
+static unsigned int nextStamp(){
+#if defined(_MSC_VER)
+  static volatile long last=0;
+  return (unsigned int)_InterlockedIncrement(&last);
+#elif defined(__GNUC__)
+  static unsigned int last=0;
+  return __sync_add_and_fetch(&last,1);
+#else
+  static unsigned int last=0;
+  return ++last;
+#endif
+}
 
 String::String(Maze m,Dirn stringDir,Dirn targetDir):maze(m),endPos(0,0,0),route(),stringDir(stringDir),targetDir(targetDir){
+  touch();
   Vector start=m.size().dotProduct(to_shift_vector(stringDir))*to_shift_vector(stringDir)+
       m.size().dotProduct(to_shift_vector(targetDir))*to_shift_vector(targetDir)+
       m.size().dotProduct(to_vector(perpendicular(stringDir,targetDir)))/2*to_vector(perpendicular(stringDir,targetDir));
@@ -16,6 +40,14 @@ String::String(Maze m,Dirn stringDir,Dirn targetDir):maze(m),endPos(0,0,0),route
   endPos=pos;
 };
 
+void String::touch(){
+  routeStamp=selectionStamp=nextStamp();
+}
+
+void String::touchSelection(){
+  selectionStamp=nextStamp();
+}
+
 bool String::hasWon() const{
   Vector d=to_vector(targetDir);
   int t=maze.size().dotProduct(-to_shift_vector(opposite(targetDir)));
@@ -27,165 +59,708 @@ bool String::hasWon() const{
   return true;
 }
 
-///A fixed size stack
-template <class T>
-class LimitedStack{
-  private:
-    SPA<T> start;///< The start of the stacks storage
-    SPA<T> end;///< The end of the stacks storage
-    SPA<T> top;///< The top of the stack
-    SPA<T> bottom;///< The bottom of the stack
+/// The changes a step of a move made to the route of a string
+/**
+ * Undo normally makes the opposite step which puts back what the step changed
+ * at the ends of each selection. That doesn't work when a step takes out both
+ * halves of a zero length spike, a step out and straight back, or joins two
+ * selections so for those steps these are kept to reverse the step exactly.
+ */
+struct StepChanges{
+  std::vector<int> added; ///< the positions in the route after the step of the elements it added in order
+  std::vector<std::pair<int,StringElement> > removed; ///< the elements it removed as they were before the step with their positions in the route then in order
+  bool endMoved; ///< if the end of the string moved
+  bool needed; ///< if the opposite step doesn't undo the step
+  /// Create empty changes
+  StepChanges():added(),removed(),endMoved(false),needed(false){};
+  /// Forget the changes keeping the space for the next step
+  void clear(){
+    added.clear();
+    removed.clear();
+    endMoved=false;
+    needed=false;
+  }
+  /// Record an element that was removed
+  /**
+   * The elements are kept in order of their positions before the step but the
+   * start of a selection can be removed after the end of the one before it.
+   * @param at the position of the element in the route before the step
+   * @param e the element as it was before the step
+   */
+  void remove(int at,const StringElement& e){
+    std::vector<std::pair<int,StringElement> >::iterator it=removed.end();
+    while(it!=removed.begin() && (it-1)->first>at)
+      --it;
+    removed.insert(it,std::make_pair(at,e));
+  }
+};
 
+/// The history of moves for a StringPlay
+/**
+ * The history is a tree of states. Each state other than a root was reached by
+ * a move from it's parent which is stored as a delta encoded record in a single
+ * growable arena so it only costs a few bytes. A record holds:
+ * - a flags byte with the direction of the move in the low 3 bits
+ * - for a compound move, the number of steps in it
+ * - unless it is a root, the selection just before the move as the lengths of
+ *   the alternating unselected and selected runs of the string ended by a 0
+ * - then for each step the selection just after the step followed by the route
+ *   segments collapsed from the start and the end of the string packed 3 bits
+ *   per Dirn in the order they were removed, each ended by ENDDIRNS
+ * - if it has steps the opposite step doesn't undo, the number of them then for
+ *   each the step and its StepChanges
+ * - if it is a checkpoint, a full copy of the string after the move
+ *
+ * Checkpoints are added every few moves so any state can be rebuilt without
+ * replaying the whole history.
+ */
+class MoveHistory{
   public:
-    /// Create a new stack
+    /// A state in the history
+    struct Node{
+      int parent; ///< the state this was reached from or -1 for a root
+      int child; ///< the state redo moves to or -1 if there isn't one
+      int record; ///< the start of the record for this state
+      int score; ///< the score at this state
+      /// Create a new state
+      /**
+       * @param parent the state this was reached from or -1 for a root
+       * @param record the start of the record for this state
+       * @param score the score at this state
+       */
+      Node(int parent,int record,int score):parent(parent),child(-1),record(record),score(score){};
+    };
+
+    /// The code used to terminate a run of packed Dirns
+    static const unsigned int ENDDIRNS=7;
+    /// Flag for records containing a full copy of the string
+    static const unsigned int CHECKPOINT=8;
+    /// Flag for records that don't contain a move
+    static const unsigned int ROOT=16;
+    /// Flag for records that contain several steps in the same direction
+    static const unsigned int COMPOUND=32;
+    /// Flag for records with steps the opposite step doesn't undo
+    static const unsigned int CHANGES=64;
+
+  private:
+    unsigned char* data; ///< the arena holding the records
+    int len; ///< the allocated length of the arena
+    int end; ///< the end of the used part of the arena
+    unsigned int acc; ///< bits of packed Dirns waiting to be written
+    int accbits; ///< the number of bits in acc
+
+    /// Make sure there is space to add more bytes to the arena
     /**
-     * @param len the length of the new stack
+     * @param n the number of bytes that will be added
      */
-    LimitedStack(int len):start(len),end(start+len-1),top(start),bottom(start){};
+    void reserve(int n){
+      if(end+n<=len)
+        return;
+      int newlen=len*2;
+      while(newlen<end+n)
+        newlen*=2;
+      unsigned char* newdata=new unsigned char[newlen];
+      memcpy(newdata,data,end);
+      delete[] data;
+      data=newdata;
+      len=newlen;
+    }
+
+  public:
+    std::vector<Node> nodes; ///< the states in the history
+    int current; ///< the current state
+    int interval; ///< the number of moves between checkpoints
+    int budget; ///< the maximum number of bytes to keep or 0 for no limit
+
+    /// Read back a record from the history
+    class Reader{
+      const unsigned char* p; ///< the next byte to read
+      unsigned int acc; ///< bits of packed Dirns read but not used
+      int accbits; ///< the number of bits in acc
+      public:
+        /// Create a reader starting at the specified byte
+        /**
+         * @param p the first byte to read
+         */
+        Reader(const unsigned char* p):p(p),acc(0),accbits(0){};
+        /// Read a single byte
+        /**
+         * @return the byte
+         */
+        inline unsigned int getByte(){
+          return *p++;
+        }
+        /// Read a variable length unsigned integer
+        /**
+         * @return the integer
+         */
+        inline unsigned int getVarint(){
+          unsigned int v=0;
+          int shift=0;
+          while(*p&0x80){
+            v|=(*p++&0x7f)<<shift;
+            shift+=7;
+          }
+          return v|(*p++<<shift);
+        }
+        /// Read a variable length signed integer
+        /**
+         * @return the integer
+         */
+        inline int getSigned(){
+          unsigned int v=getVarint();
+          return (v&1)?-(int)(v>>1)-1:(int)(v>>1);
+        }
+        /// Read a packed Dirn
+        /**
+         * @return the id of the Dirn or ENDDIRNS at the end of the run
+         */
+        inline unsigned int getDirn(){
+          if(accbits<3){
+            acc|=*p++<<accbits;
+            accbits+=8;
+          }
+          unsigned int ret=acc&7;
+          acc>>=3;
+          accbits-=3;
+          if(ret==ENDDIRNS){
+            // the rest of the byte is padding
+            acc=0;
+            accbits=0;
+          }
+          return ret;
+        }
+        /// Skip over a selection
+        inline void skipSelection(){
+          getVarint();
+          while(getVarint()!=0);
+        }
+        /// Skip over a run of packed Dirns
+        inline void skipDirns(){
+          while(getDirn()!=ENDDIRNS);
+        }
+        /// Skip over a single step of a move
+        inline void skipStep(){
+          skipSelection();
+          skipDirns();
+          skipDirns();
+        }
+        /// Read the changes made by a step
+        /**
+         * @param c the changes to fill in
+         */
+        void getChanges(StepChanges& c){
+          c.clear();
+          for(unsigned int n=getVarint();n>0;--n)
+            c.added.push_back(getVarint());
+          for(unsigned int n=getVarint();n>0;--n){
+            int at=getVarint();
+            int x=getSigned();
+            int y=getSigned();
+            int z=getSigned();
+            unsigned int e=getVarint();
+            c.removed.push_back(std::make_pair(at,StringElement(Vector(x,y,z),from_id(e&7),e&8)));
+          }
+          c.endMoved=getVarint();
+          c.needed=true;
+        }
+        /// Skip over the move in a record that isn't a root
+        /**
+         * @param flags the flags byte of the record which has already been read
+         */
+        inline void skipMove(unsigned int flags){
+          unsigned int steps=(flags&COMPOUND)?getVarint():1;
+          skipSelection();
+          for(unsigned int i=0;i<steps;++i)
+            skipStep();
+          if(flags&CHANGES){
+            StepChanges c;
+            for(unsigned int n=getVarint();n>0;--n){
+              getVarint();
+              getChanges(c);
+            }
+          }
+        }
+        /// Get the position of the next byte to read
+        /**
+         * @return the position of the next byte
+         */
+        inline const unsigned char* position() const{
+          return p;
+        }
+    };
+
+    /// Create a new empty history
+    MoveHistory():data(new unsigned char[256]),len(256),end(0),acc(0),accbits(0),nodes(),current(-1),interval(32),budget(0){};
+    /// Release the memory used by the history
+    ~MoveHistory(){
+      delete[] data;
+    }
 
-    /// Check if the stack is empty
+    /// Forget all of the states
+    void clear(){
+      end=0;
+      acc=0;
+      accbits=0;
+      nodes.clear();
+      current=-1;
+    }
+    /// Get the number of bytes being used
     /**
-     * @return true if the stack is empty else false
+     * @return the number of bytes used by the records and states
      */
-    bool empty(){
-      return top==bottom;
+    inline int size() const{
+      return end+nodes.size()*sizeof(Node);
     }
 
-    /// Get the value at the top of the stack
+    /// Add a byte to the arena
     /**
-     * @return the top element on the stack
+     * @param b the byte to add
      */
-    inline const T& getTop(){
-      return *top;
+    inline void putByte(unsigned char b){
+      reserve(1);
+      data[end++]=b;
     }
-
-    /// remove and return the value at the top of the stack
+    /// Add bytes to the arena
     /**
-     * @return the top element on the stack
+     * @param p the bytes which mustn't be in the arena
+     * @param n the number of bytes
      */
-    const T& popTop(){
-      const T& tmp=*top;
-      if(top==start)
-        top=end;
-      else
-        --top;
-      return tmp;
+    inline void putBytes(const unsigned char* p,int n){
+      reserve(n);
+      memcpy(data+end,p,n);
+      end+=n;
     }
-
-    /// Add an element to the top of the stack
+    /// Start writing a new record
     /**
-     * This may replace elements at the bottom of the stack if space runs out
-     * @param el the element to add
+     * @param flags the direction of the move and any flags
+     * @return the start of the record
      */
-    void pushTop(const T& el){
-      if(top==end){
-        top=start;
-        if(top==bottom)
-          ++bottom;
-      }else{
-        ++top;
-        if(top==bottom)
-          if(bottom==end)
-             bottom=top;
-          else
-             ++bottom;
+    inline int beginRecord(unsigned int flags){
+      putByte(flags);
+      return end-1;
+    }
+    /// Write a variable length unsigned integer
+    /**
+     * @param v the integer to write
+     */
+    inline void putVarint(unsigned int v){
+      reserve(5);
+      while(v>=0x80){
+        data[end++]=(v&0x7f)|0x80;
+        v>>=7;
       }
-      *top=el;
+      data[end++]=v;
     }
-
-    ///Clear the stack
+    /// Leave space for a variable length unsigned integer to be written later
     /**
-     * Doesn't actually delete any elements but they won't be accessed again
+     * @return the position to pass to patchVarint
      */
-    void clear(){
-      top=bottom=start;
+    inline int reserveVarint(){
+      reserve(5);
+      end+=5;
+      return end-5;
     }
-};
-
-/// A Bitset
-class Bitset{
-  SPA<unsigned char> bits; ///< the actual bits in this bitset
-  public:
-    /// Construct an empty bitset.
+    /// Write a variable length unsigned integer in space left by reserveVarint
+    /**
+     * @param at the position of the space
+     * @param v the integer to write
+     */
+    inline void patchVarint(int at,unsigned int v){
+      for(int i=0;i<4;++i,v>>=7)
+        data[at+i]=(v&0x7f)|0x80;
+      data[at+4]=v;
+    }
+    /// Write a variable length signed integer
     /**
-     * All accesses to this bitset are invalid
+     * @param v the integer to write
      */
-    Bitset():bits(){};
-    /// Construct a bitset of the specified size
+    inline void putSigned(int v){
+      putVarint(v<0?((unsigned int)(-(v+1))<<1)|1:(unsigned int)v<<1);
+    }
+    /// Write a packed Dirn
     /**
-     * @param length the length to make the bitset.
+     * @param d the id of the Dirn or ENDDIRNS to end a run
      */
-    explicit Bitset(const unsigned int& length):bits((length+CHAR_BIT-1)/CHAR_BIT){};
-    /// Get a single bit from the bitset
+    inline void putDirn(unsigned int d){
+      acc|=d<<accbits;
+      accbits+=3;
+      if(accbits>=8){
+        putByte(acc&0xff);
+        acc>>=8;
+        accbits-=8;
+      }
+    }
+    /// End a run of packed Dirns
+    inline void endDirns(){
+      putDirn(ENDDIRNS);
+      if(accbits>0)
+        putByte(acc);
+      acc=0;
+      accbits=0;
+    }
+    /// Write a selection
     /**
-     * @param i the index of the bit.
-     * @return true if the bit is set else false
+     * @param route the route of the string with the selection
      */
-    inline bool get(int i){
-      return (bits[i/CHAR_BIT]&(1<<(i%CHAR_BIT)))!=0;
+    void putSelection(const std::list<StringElement>& route){
+      bool sel=false;
+      unsigned int run=0;
+      for(std::list<StringElement>::const_iterator it=route.begin();it!=route.end();++it){
+        if(it->selected!=sel){
+          putVarint(run);
+          run=0;
+          sel=it->selected;
+        }
+        ++run;
+      }
+      putVarint(run);
+      putVarint(0);
     }
-    /// Set a single bit in the bitset
+    /// Write the changes made by a step
     /**
-     * @param i the index of the bit to set
+     * @param c the changes
      */
-    inline void set(int i){
-      bits[i/CHAR_BIT]|=(1<<(i%CHAR_BIT));
+    void putChanges(const StepChanges& c){
+      putVarint(c.added.size());
+      for(unsigned int i=0;i<c.added.size();++i)
+        putVarint(c.added[i]);
+      putVarint(c.removed.size());
+      for(unsigned int i=0;i<c.removed.size();++i){
+        const StringElement& e=c.removed[i].second;
+        putVarint(c.removed[i].first);
+        putSigned(e.pos.X);
+        putSigned(e.pos.Y);
+        putSigned(e.pos.Z);
+        putVarint(to_id(e.d)|(e.selected?8:0));
+      }
+      putVarint(c.endMoved);
     }
-    /// Unset a single bit in the bitset
+    /// Write the changes made by some of the steps of a move
     /**
-     * @param i the index of the bit to unset
+     * @param record the start of the record being written
+     * @param changes the changes made by the steps of the move that need them with the step of each
+     * @param from the first step to write the changes of
+     * @param to one more than the last step
      */
-    inline void unset(int i){
-      bits[i/CHAR_BIT]&=~(1<<(i%CHAR_BIT));
+    void putChanges(int record,const std::vector<std::pair<int,StepChanges> >& changes,int from,int to){
+      int n=0;
+      for(unsigned int i=0;i<changes.size();++i)
+        if(changes[i].first>=from && changes[i].first<to)
+          ++n;
+      if(n==0)
+        return;
+      data[record]|=CHANGES;
+      putVarint(n);
+      for(unsigned int i=0;i<changes.size();++i)
+        if(changes[i].first>=from && changes[i].first<to){
+          putVarint(changes[i].first-from);
+          putChanges(changes[i].second);
+        }
     }
-};
 
-///An element in the move history
-class HistoryElement{
-  public:
-    int length; ///< The length of the string just after the move
-    Bitset selected; ///< The selection state of the string just after the move
-    /// was an element of the string selected
+    /// Add a new state and make it the current state
     /**
-     * @param i the index of the element to check
-     * @return true it was selected
+     * @param parent the state the new state was reached from or -1 for a root
+     * @param record the start of the record for the new state
+     * @param score the score at the new state
      */
-    bool isselected(int i){
-      return selected.get(i);
+    void addNode(int parent,int record,int score){
+      nodes.push_back(Node(parent,record,score));
+      current=nodes.size()-1;
+      if(parent>=0)
+        nodes[parent].child=current;
     }
-    Dirn d; ///< the direction the move was in
-    std::list<Dirn> startcollapsed; ///< the route segments that where collapsed from the start of the string
-    std::list<Dirn> endcollapsed; ///< the route segments that where collapsed from the end of the string
-
-    /// Create a new history element
+    /// Get a reader for the record of a state
+    /**
+     * @param node the state
+     * @return a reader positioned at the start of the record
+     */
+    inline Reader reader(int node) const{
+      return Reader(data+nodes[node].record);
+    }
+    /// Get the flags for a state
+    /**
+     * @param node the state
+     * @return the flags byte of the record
+     */
+    inline unsigned int flags(int node) const{
+      return data[nodes[node].record];
+    }
+    /// Count the moves since the last checkpoint
+    /**
+     * @param node the state to count back from
+     * @return the number of moves
+     */
+    int sinceCheckpoint(int node) const{
+      int n=0;
+      for(;!(flags(node)&CHECKPOINT);node=nodes[node].parent)
+        ++n;
+      return n;
+    }
+    /// Find the length of the record for a state
+    /**
+     * @param node the state
+     * @return the length of the record
+     */
+    int recordLength(int node) const;
+    /// Copy the record for a state from another history
     /**
-     * @param length The length of the string just after the move
-     * @param selected The selection state of the string just after the move
-     * @param d the direction the move was in
-     * @param startcollapsed the route segments that where collapsed from the start of the string
-     * @param endcollapsed the route segments that where collapsed from the end of the string
+     * @param o the history to copy from
+     * @param node the state in o
+     * @return the start of the new record
      */
-    HistoryElement(int length,Bitset selected,Dirn d,std::list<Dirn> startcollapsed,std::list<Dirn> endcollapsed):
-        length(length),selected(selected),d(d),startcollapsed(startcollapsed),endcollapsed(endcollapsed){};
-    /// Create a new empty history element
-    HistoryElement():length(0),selected(),d(),startcollapsed(),endcollapsed(){};
+    int copyRecord(const MoveHistory& o,int node);
+    /// Split a move made in several steps into two moves
+    /**
+     * The state becomes the one part way through the move and a new state is
+     * added after it for the rest of the move, which the states after the move
+     * now come from. The current state isn't changed.
+     * @param node the state reached by the move
+     * @param first the number of steps in the first part which must be fewer than in the move
+     * @param score the score part way through the move
+     * @param route the route of the string part way through the move
+     * @return the new state
+     */
+    int splitMove(int node,int first,int score,const std::list<StringElement>& route);
 };
 
-StringPlay::StringPlay(SP<String> s):s(s),score(0),undohistory(new LimitedStack<HistoryElement>(10+2*s->maze.size().dotProduct(Vector(1,1,1)))),inextendedmove(false){};
+int MoveHistory::recordLength(int node) const{
+  Reader r=reader(node);
+  unsigned int f=r.getByte();
+  if(!(f&ROOT))
+    r.skipMove(f);
+  if(f&CHECKPOINT){
+    r.getVarint();
+    r.getVarint();
+    r.getVarint();
+    r.skipDirns();
+    r.skipSelection();
+  }
+  return r.position()-(data+nodes[node].record);
+}
+
+int MoveHistory::copyRecord(const MoveHistory& o,int node){
+  int l=o.recordLength(node);
+  putBytes(o.data+o.nodes[node].record,l);
+  return end-l;
+}
+
+int MoveHistory::splitMove(int node,int first,int score,const std::list<StringElement>& route){
+  // find the parts of the record as offsets as the arena can move
+  const unsigned char* start=data+nodes[node].record;
+  Reader r(start);
+  unsigned int f=r.getByte();
+  int steps=r.getVarint();
+  int selection=r.position()-start;
+  r.skipSelection();
+  std::vector<int> step(steps+1);
+  for(int i=0;i<steps;++i){
+    step[i]=r.position()-start;
+    r.skipStep();
+  }
+  step[steps]=r.position()-start;
+  std::vector<std::pair<int,StepChanges> > changes;
+  if(f&CHANGES)
+    for(unsigned int n=r.getVarint();n>0;--n){
+      int i=r.getVarint();
+      changes.push_back(std::make_pair(i,StepChanges()));
+      r.getChanges(changes.back().second);
+    }
+  int state=r.position()-start;
+  int length=recordLength(node);
+  std::vector<unsigned char> old(start,start+length);
+  // the space can be used again if it is the last record
+  if(nodes[node].record+length==end)
+    end=nodes[node].record;
+
+  // the first part keeps the selection from before the move
+  int record=beginRecord((f&7)|(first>1?COMPOUND:0));
+  if(first>1)
+    putVarint(first);
+  putBytes(&old[selection],step[first]-selection);
+  putChanges(record,changes,0,first);
+  // the steps keep the selection from before the ends were collapsed so the
+  // selection the rest starts from is taken from the string
+  int rest=beginRecord((f&(7|CHECKPOINT))|(steps-first>1?COMPOUND:0));
+  if(steps-first>1)
+    putVarint(steps-first);
+  putSelection(route);
+  putBytes(&old[step[first]],step[steps]-step[first]);
+  putChanges(rest,changes,first,steps);
+  if(f&CHECKPOINT)
+    putBytes(&old[state],length-state);
+
+  // the states after the move now come from the rest of it
+  int next=nodes.size();
+  for(int i=0;i<next;++i)
+    if(nodes[i].parent==node)
+      nodes[i].parent=next;
+  nodes.push_back(Node(node,rest,nodes[node].score));
+  nodes[next].child=nodes[node].child;
+  nodes[node].child=next;
+  nodes[node].record=record;
+  nodes[node].score=score;
+  return next;
+}
+
+/// Restore the selection state of a string from the history
+/**
+ * @param r the reader positioned at the selection
+ * @param route the route of the string to update
+ */
+static void readSelection(MoveHistory::Reader& r,std::list<StringElement>& route){
+  std::list<StringElement>::iterator it=route.begin();
+  bool sel=false;
+  unsigned int run=r.getVarint();
+  do{
+    for(;run>0 && it!=route.end();--run,++it)
+      it->selected=sel;
+    sel=!sel;
+    run=r.getVarint();
+  }while(run!=0);
+  // the string may not be exactly the same length as it was
+  for(;it!=route.end();++it)
+    it->selected=false;
+}
+
+/// Restore a full copy of a string from the history
+/**
+ * @param r the reader positioned at the copy
+ * @param route the route of the string to update
+ * @param endPos the end of the string to update
+ */
+static void readState(MoveHistory::Reader& r,std::list<StringElement>& route,Vector& endPos){
+  int x=r.getSigned();
+  int y=r.getSigned();
+  int z=r.getSigned();
+  Vector pos(x,y,z);
+  route.clear();
+  for(unsigned int c=r.getDirn();c!=MoveHistory::ENDDIRNS;c=r.getDirn()){
+    route.push_back(StringElement(pos,from_id(c),false));
+    pos+=to_vector(from_id(c));
+  }
+  endPos=pos;
+  readSelection(r,route);
+}
+
+/// Put back the ends of a string that were collapsed after a step of a move
+/**
+ * This also restores the selection to how it was just after the step.
+ * @param r the reader positioned at the step
+ * @param route the route of the string to update
+ * @param endPos the end of the string to update
+ */
+static void restoreEnds(MoveHistory::Reader r,std::list<StringElement>& route,Vector& endPos){
+  MoveHistory::Reader selection=r;
+  r.skipSelection();
+
+  // the start was collapsed from the front so first find where the string used to start
+  MoveHistory::Reader startcollapsed=r;
+  Vector pos=route.front().pos;
+  for(unsigned int c=r.getDirn();c!=MoveHistory::ENDDIRNS;c=r.getDirn())
+    pos-=to_vector(from_id(c));
+  std::list<StringElement>::iterator front=route.begin();
+  for(unsigned int c=startcollapsed.getDirn();c!=MoveHistory::ENDDIRNS;c=startcollapsed.getDirn()){
+    route.insert(front,StringElement(pos,from_id(c),false));
+    pos+=to_vector(from_id(c));
+  }
+  // the end was collapsed from the back so first find where the string used to end
+  MoveHistory::Reader endcollapsed=r;
+  for(unsigned int c=r.getDirn();c!=MoveHistory::ENDDIRNS;c=r.getDirn())
+    endPos+=to_vector(from_id(c));
+  pos=endPos;
+  std::list<StringElement>::iterator back=route.end();
+  for(unsigned int c=endcollapsed.getDirn();c!=MoveHistory::ENDDIRNS;c=endcollapsed.getDirn()){
+    pos-=to_vector(from_id(c));
+    back=route.insert(back,StringElement(pos,from_id(c),false));
+  }
+
+  // fix selection (both for end elements that have been added back in and
+  // in case the user has changed the selection.
+  readSelection(selection,route);
+}
+
+/// Reverse a step of a move using the changes it made
+/**
+ * @param c the changes made by the step
+ * @param d the direction of the move
+ * @param route the route of the string to update which must be as it was just after the step
+ * @param endPos the end of the string to update
+ * @return the score for the step
+ */
+static int reverseStep(const StepChanges& c,Dirn d,std::list<StringElement>& route,Vector& endPos){
+  std::list<StringElement>::iterator it=route.begin();
+  unsigned int added=0,removed=0;
+  int movescore=0;
+  for(int after=0,before=0;;){
+    if(removed<c.removed.size() && c.removed[removed].first==before){
+      const StringElement& e=c.removed[removed++].second;
+      if(e.selected && e.d!=d && e.d!=opposite(d))
+        ++movescore;
+      route.insert(it,e);
+      ++before;
+    }else if(it==route.end()){
+      break;
+    }else if(added<c.added.size() && c.added[added]==after){
+      it=route.erase(it);
+      ++added;
+      ++after;
+    }else{
+      if(it->selected){
+        it->pos-=to_vector(d);
+        if(it->d!=d && it->d!=opposite(d))
+          ++movescore;
+      }
+      ++it;
+      ++after;
+      ++before;
+    }
+  }
+  if(c.endMoved)
+    endPos-=to_vector(d);
+  return movescore;
+}
+
+StringPlay::StringPlay(SP<String> s):s(s),score(0),undohistory(new MoveHistory()),inextendedmove(false),recorder(0){
+  newRoot();
+};
 
 void StringPlay::SetString(SP<String> s){
   this->s=s;
   score=0;
   inextendedmove=false;
-  delete undohistory;
-  undohistory=new LimitedStack<HistoryElement>(10+2*s->maze.size().dotProduct(Vector(1,1,1)));
+  undohistory->clear();
+  newRoot();
+}
+
+void StringPlay::startExtendedMove(){
+  if(recorder)
+    recorder->extended();
+  inextendedmove=true;
 }
 
 void StringPlay::externalEditHappened(){
   inextendedmove=false;
-  undohistory->clear();
+  newRoot();
+}
+
+void StringPlay::setUndoBudget(int bytes){
+  undohistory->budget=bytes;
+  trimHistory();
+}
+
+int StringPlay::getUndoMemory() const{
+  return undohistory->size();
 }
+
+void StringPlay::setCheckpointInterval(int moves){
+  undohistory->interval=moves<1?1:moves;
+}
+
 bool StringPlay::slide(bool moveEnd,bool out){
+  if(recorder)
+    recorder->slide(moveEnd,out);
   if(moveEnd){
     std::list<StringElement>::reverse_iterator it;
     for(it=s->route.rbegin();it!=s->route.rend();++it)
@@ -218,9 +793,22 @@ bool StringPlay::slide(bool moveEnd,bool out){
     }
   }
   inextendedmove=false;
+  s->touchSelection();
   return true;
 }
 
+void StringPlay::setSelected(StringPointer p,bool selected){
+  if(recorder){
+    int index=0;
+    for(std::list<StringElement>::iterator it=s->route.begin();it!=p.el;++it)
+      index++;
+    recorder->select(index,selected);
+  }
+  inextendedmove=false;
+  p.el->selected=selected;
+  s->touchSelection();
+}
+
 bool StringPlay::canMove(Dirn d){
   // Not allowed to try and drag the end elements out of the maze
   if(d==opposite(s->stringDir)){
@@ -287,30 +875,47 @@ bool StringPlay::canMove(Dirn d){
   return any;
 }
 
-std::pair<int,int> StringPlay::doMoveI(Dirn d){
+std::pair<int,int> StringPlay::doMoveI(String& s,Dirn d,StepChanges* changes){
   int length=0; // needed so we can store the selection state later
   int movescore=0;
   bool lastselected=false;
+  int before=0; // the position of it in the route before the move
+  int last=-1; // the position before the move of the element before it
 
   //do the move
-  for(std::list<StringElement>::iterator it=s->route.begin();it!=s->route.end();++it,++length){
+  for(std::list<StringElement>::iterator it=s.route.begin();it!=s.route.end();++it,++length,++before){
     if(it->selected){
       if(!lastselected){
         // At start of selection so need to ensure the route connects up
-        if(it!=s->route.begin()){
+        if(it!=s.route.begin()){
           std::list<StringElement>::iterator nit=it;
           --nit;
           if(nit->d==opposite(d)){
-            // nit can't be selected as at start of selection
-            s->route.erase(nit);
+            if(changes){
+              // the opposite step takes out the element before nit rather than
+              // putting nit back if they make a spike
+              std::list<StringElement>::iterator pit=nit;
+              if(nit->selected || (pit!=s.route.begin() && (--pit)->d==d))
+                changes->needed=true;
+              StringElement e=*nit;
+              if(e.selected)
+                e.pos-=to_vector(d);
+              changes->remove(last,e);
+            }
+            // nit is only selected if the end of the selection before was just taken out
+            s.route.erase(nit);
             --length;
           }else{
-            s->route.insert(it,StringElement(it->pos,d,false));
+            if(changes)
+              changes->added.push_back(length);
+            s.route.insert(it,StringElement(it->pos,d,false));
             ++length;
           }
-        }else if(d==s->stringDir){
+        }else if(d==s.stringDir){
           // start of string and dragging in to maze
-          s->route.insert(it,StringElement(it->pos,d,false));
+          if(changes)
+            changes->added.push_back(length);
+          s.route.insert(it,StringElement(it->pos,d,false));
           ++length;
         }
 
@@ -323,112 +928,394 @@ std::pair<int,int> StringPlay::doMoveI(Dirn d){
     }else if(lastselected){
       // just after end of selection
       if(it->d==d){
-        it=s->route.erase(it);
+        if(changes){
+          // likewise for the element after it or the selection after it
+          std::list<StringElement>::iterator nit=it;
+          ++nit;
+          if(nit!=s.route.end() && (nit->selected || nit->d==opposite(d)))
+            changes->needed=true;
+          changes->remove(before,*it);
+        }
+        it=s.route.erase(it);
         --length;
         // "it" is now the next element so decrement and continue the loop so it gets processed
         lastselected=false;
         --it;
         continue;
       }else{
-        s->route.insert(it,StringElement(it->pos+to_vector(d),opposite(d),false));
+        if(changes)
+          changes->added.push_back(length);
+        s.route.insert(it,StringElement(it->pos+to_vector(d),opposite(d),false));
         ++length;
       }
     }
     lastselected=it->selected;
+    last=before;
   }
   // fix up the end
   if(lastselected)
-    if(d==opposite(s->stringDir)){
-      s->route.insert(s->route.end(),StringElement(s->endPos+to_vector(d),opposite(d),false));
+    if(d==opposite(s.stringDir)){
+      if(changes)
+        changes->added.push_back(length);
+      s.route.insert(s.route.end(),StringElement(s.endPos+to_vector(d),opposite(d),false));
       ++length;
-    }else
-      s->endPos+=to_vector(d);
+    }else{
+      s.endPos+=to_vector(d);
+      if(changes)
+        changes->endMoved=true;
+    }
   return std::make_pair(movescore,length);
 }
 
-void StringPlay::doMove(Dirn d){
-  std::pair<int,int> ret=doMoveI(d);
-  score+=ret.first;
 
-  // record the selection state to ensure it is correct before undo
-  Bitset selection(ret.second);
-  int i=0;
-  for(std::list<StringElement>::iterator it=s->route.begin();it!=s->route.end();++it,++i)
-    if(it->selected)
-      selection.set(i);
-
-  // collapse any lines along the edge (or slightly sticking out)
-  std::list<Dirn> startcollapsed;
+void StringPlay::collapse(String& t,bool record){
   int out=0;
-  while(out!=0 || s->route.front().d!=s->stringDir){
+  while(out!=0 || t.route.front().d!=t.stringDir){
     // checks we end at the same distance as we started at
-    if(s->route.front().d == opposite(s->stringDir))
+    if(t.route.front().d == opposite(t.stringDir))
       out++;
-    else if(s->route.front().d == s->stringDir)
+    else if(t.route.front().d == t.stringDir)
       out--;
-    startcollapsed.push_front(s->route.front().d);
-    s->route.pop_front();
+    if(record)
+      undohistory->putDirn(to_id(t.route.front().d));
+    t.route.pop_front();
   }
+  if(record)
+    undohistory->endDirns();
 
-  std::list<Dirn> endcollapsed;
   out=0;
-  while(out!=0 || s->route.back().d!=s->stringDir){
+  while(out!=0 || t.route.back().d!=t.stringDir){
     // checks we end at the same distance as we started at
-    if(s->route.back().d == opposite(s->stringDir))
+    if(t.route.back().d == opposite(t.stringDir))
       out++;
-    else if(s->route.back().d == s->stringDir)
+    else if(t.route.back().d == t.stringDir)
       out--;
-    endcollapsed.push_front(s->route.back().d);
-    s->endPos=s->route.back().pos;
-    s->route.pop_back();
+    if(record)
+      undohistory->putDirn(to_id(t.route.back().d));
+    t.endPos=t.route.back().pos;
+    t.route.pop_back();
   }
+  if(record)
+    undohistory->endDirns();
+}
+
+int StringPlay::doMove(Dirn d,int steps){
+  int parent=undohistory->current;
+  bool checkpoint=undohistory->sinceCheckpoint(parent)+1>=undohistory->interval;
+  bool compound=steps>1;
+  int record=undohistory->beginRecord(to_id(d)|(checkpoint?MoveHistory::CHECKPOINT:0)|(compound?MoveHistory::COMPOUND:0));
+  int count=compound?undohistory->reserveVarint():0;
+  // record the selection state before the move so it can be redone
+  writeSelection(*s);
 
-  undohistory->pushTop(HistoryElement(ret.second,selection,d,startcollapsed,endcollapsed));
+  int n=0;
+  StepChanges changes;
+  std::vector<std::pair<int,StepChanges> > kept;
+  do{
+    std::pair<int,int> ret=doMoveI(*s,d,&changes);
+    score+=ret.first;
+    if(changes.needed)
+      kept.push_back(std::make_pair(n,changes));
+    changes.clear();
+
+    // record the selection state to ensure it is correct before undo
+    writeSelection(*s);
+
+    // collapse any lines along the edge (or slightly sticking out)
+    collapse(*s,true);
+    ++n;
+  }while(n<steps && canMove(d));
+  s->touch();
+
+  if(compound)
+    undohistory->patchVarint(count,n);
+  undohistory->putChanges(record,kept,0,n);
+  if(checkpoint)
+    writeState(*s);
+  undohistory->addNode(parent,record,score);
+  trimHistory();
+  return n;
 }
 
-bool StringPlay::undo(bool extendedmove){
-  if(extendedmove && !inextendedmove)
-    return false;
-  inextendedmove=extendedmove;
-  if(undohistory->empty())
-    return false;
-  HistoryElement histel=undohistory->popTop();
+void StringPlay::writeSelection(const String& t){
+  undohistory->putSelection(t.route);
+}
+
+void StringPlay::writeState(const String& t){
+  undohistory->putSigned(t.route.front().pos.X);
+  undohistory->putSigned(t.route.front().pos.Y);
+  undohistory->putSigned(t.route.front().pos.Z);
+  for(std::list<StringElement>::const_iterator it=t.route.begin();it!=t.route.end();++it)
+    undohistory->putDirn(to_id(it->d));
+  undohistory->endDirns();
+  writeSelection(t);
+}
 
-  // Add the ends back in
-  for(std::list<Dirn>::iterator it=histel.startcollapsed.begin();it!=histel.startcollapsed.end();++it){
-    s->route.push_front(StringElement(s->route.front().pos-to_vector(*it),*it,false));
+void StringPlay::newRoot(){
+  int record=undohistory->beginRecord(MoveHistory::ROOT|MoveHistory::CHECKPOINT);
+  writeState(*s);
+  undohistory->addNode(-1,record,score);
+  trimHistory();
+}
+
+int StringPlay::undoMove(int node,int keep,int* movescore){
+  MoveHistory::Reader r=undohistory->reader(node);
+  unsigned int f=r.getByte();
+  Dirn d=from_id(f&7);
+  unsigned int steps=(f&MoveHistory::COMPOUND)?r.getVarint():1;
+  r.skipSelection();
+  if(steps==1 && !(f&MoveHistory::CHANGES)){
+    restoreEnds(r,s->route,s->endPos);
+    int ms=doMoveI(*s,opposite(d)).first;
+    if(movescore)
+      *movescore=ms;
+    s->touch();
+    return 1;
+  }
+  // the steps can only be read forwards so find them all first
+  std::vector<MoveHistory::Reader> step(steps,r);
+  for(unsigned int i=0;i<steps;++i){
+    step[i]=r;
+    r.skipStep();
   }
-  for(std::list<Dirn>::iterator it=histel.endcollapsed.begin();it!=histel.endcollapsed.end();++it){
-    s->route.push_back(StringElement(s->endPos,*it,false));
-    s->endPos+=to_vector(*it);
+  std::vector<StepChanges> changes(steps);
+  if(f&MoveHistory::CHANGES)
+    for(unsigned int n=r.getVarint();n>0;--n){
+      unsigned int i=r.getVarint();
+      r.getChanges(changes[i]);
+    }
+  int ms=0;
+  for(int i=steps-1;i>=keep;--i){
+    restoreEnds(step[i],s->route,s->endPos);
+    if(changes[i].needed)
+      ms+=reverseStep(changes[i],d,s->route,s->endPos);
+    else
+      ms+=doMoveI(*s,opposite(d)).first;
   }
+  if(movescore)
+    *movescore=ms;
+  s->touch();
+  return steps-keep;
+}
 
-  // fix selection (both for end elements that have been added back in and
-  // in case the user has changed the selection.
-  int i=0;
-  for(std::list<StringElement>::iterator it=s->route.begin();it!=s->route.end();++it,++i)
-    it->selected=histel.isselected(i);
+int StringPlay::redoMove(String& t,int node){
+  MoveHistory::Reader r=undohistory->reader(node);
+  unsigned int f=r.getByte();
+  Dirn d=from_id(f&7);
+  unsigned int steps=(f&MoveHistory::COMPOUND)?r.getVarint():1;
+  readSelection(r,t.route);
+  for(unsigned int i=0;i<steps;++i){
+    doMoveI(t,d);
+    collapse(t,false);
+  }
+  t.touch();
+  return steps;
+}
 
-  // Undo the actual move
-  score-=doMoveI(opposite(histel.d)).first;
-  return true;
+void StringPlay::load(String& t,int node){
+  // find the nearest checkpoint and replay the moves from there
+  std::vector<int> path;
+  for(;!(undohistory->flags(node)&MoveHistory::CHECKPOINT);node=undohistory->nodes[node].parent)
+    path.push_back(node);
+  MoveHistory::Reader r=undohistory->reader(node);
+  unsigned int f=r.getByte();
+  if(!(f&MoveHistory::ROOT))
+    r.skipMove(f);
+  readState(r,t.route,t.endPos);
+  for(std::vector<int>::reverse_iterator it=path.rbegin();it!=path.rend();++it)
+    redoMove(t,*it);
+  t.touch();
+}
+
+void StringPlay::trimHistory(){
+  MoveHistory* old=undohistory;
+  if(old->budget<=0 || old->size()<=old->budget)
+    return;
+  // keep as much as fits in three quarters of the budget of the moves leading
+  // to the current state so we don't need to do this every move
+  int target=old->budget-old->budget/4;
+  std::vector<int> path;
+  int used=0;
+  for(int node=old->current;node>=0 && (path.empty() || used<target);node=old->nodes[node].parent){
+    path.push_back(node);
+    used+=old->recordLength(node)+sizeof(MoveHistory::Node);
+  }
+  for(;;){
+    undohistory=old;
+    SP<String> t=materialise(path.back());
+
+    undohistory=new MoveHistory();
+    undohistory->interval=old->interval;
+    undohistory->budget=old->budget;
+    int record=undohistory->beginRecord(MoveHistory::ROOT|MoveHistory::CHECKPOINT);
+    writeState(*t);
+    undohistory->addNode(-1,record,old->nodes[path.back()].score);
+    for(int i=path.size()-2;i>=0;--i)
+      undohistory->addNode(undohistory->current,undohistory->copyRecord(*old,path[i]),old->nodes[path[i]].score);
+    // the oldest state kept becomes a root with a full copy of the string which
+    // is bigger than its record for a long string so forget more until it fits
+    int over=undohistory->size()-old->budget;
+    if(over<=0 || path.size()==1)
+      break;
+    delete undohistory;
+    for(;over>0 && path.size()>1;path.pop_back())
+      over-=old->recordLength(path.back())+sizeof(MoveHistory::Node);
+  }
+  delete old;
+}
+
+int StringPlay::undoCurrent(){
+  int node=undohistory->current;
+  int parent=undohistory->nodes[node].parent;
+  if(parent<0)
+    return 0;
+  int steps=undoMove(node);
+  undohistory->current=parent;
+  score=undohistory->nodes[parent].score;
+  return steps;
+}
+
+int StringPlay::undo(bool extendedmove){
+  if(recorder)
+    recorder->undo(extendedmove);
+  if(extendedmove && !inextendedmove)
+    return 0;
+  inextendedmove=extendedmove;
+  return undoCurrent();
+}
+
+int StringPlay::undoSteps(int steps,bool extendedmove){
+  if(recorder)
+    recorder->undoSteps(steps,extendedmove);
+  if(extendedmove && !inextendedmove)
+    return 0;
+  inextendedmove=extendedmove;
+  int node=undohistory->current;
+  if(steps<=0 || undohistory->nodes[node].parent<0)
+    return 0;
+  MoveHistory::Reader r=undohistory->reader(node);
+  unsigned int f=r.getByte();
+  int total=(f&MoveHistory::COMPOUND)?r.getVarint():1;
+  if(steps>=total)
+    return undoCurrent();
+  // undo the last steps and split the move so they are a move of their own
+  int movescore;
+  undoMove(node,total-steps,&movescore);
+  score-=movescore;
+  undohistory->splitMove(node,total-steps,score,s->route);
+  return steps;
+}
+
+int StringPlay::redo(bool extendedmove){
+  if(recorder)
+    recorder->redo(extendedmove);
+  if(extendedmove && !inextendedmove)
+    return 0;
+  inextendedmove=extendedmove;
+  int child=undohistory->nodes[undohistory->current].child;
+  if(child<0)
+    return 0;
+  int steps=redoMove(*s,child);
+  undohistory->current=child;
+  score=undohistory->nodes[child].score;
+  return steps;
 }
 
 bool StringPlay::tryMove(Dirn d,bool extendedmove){
+  if(recorder)
+    recorder->move(d,extendedmove);
   if(extendedmove && !inextendedmove)
     return false;
   inextendedmove=extendedmove;
   if(canMove(d)){
-    doMove(d);
+    doMove(d,1);
     return true;
   }else{
     return false;
   }
 }
 
+int StringPlay::tryMoves(Dirn d,int steps,bool extendedmove){
+  if(recorder)
+    recorder->moves(d,steps,extendedmove);
+  if(extendedmove && !inextendedmove)
+    return 0;
+  inextendedmove=extendedmove;
+  if(steps>0 && canMove(d))
+    return doMove(d,steps);
+  else
+    return 0;
+}
+
+int StringPlay::snapshot() const{
+  return undohistory->current;
+}
+
+int StringPlay::getHistoryParent(int node) const{
+  if(node<0 || node>=getHistorySize())
+    return -1;
+  return undohistory->nodes[node].parent;
+}
+
+int StringPlay::getHistorySize() const{
+  return undohistory->nodes.size();
+}
+
+bool StringPlay::jumpTo(int node){
+  if(node<0 || node>=getHistorySize())
+    return false;
+  if(recorder)
+    recorder->jump(node);
+  inextendedmove=false;
+  load(*s,node);
+  undohistory->current=node;
+  score=undohistory->nodes[node].score;
+  return true;
+}
+
+SP<String> StringPlay::materialise(int node){
+  if(node<0 || node>=getHistorySize())
+    return SP<String>();
+  // share the maze data rather than copying it
+  SP<String> t(new String(const_cast<Maze&>(s->maze),s->stringDir,s->targetDir));
+  load(*t,node);
+  return t;
+}
+
 StringPlay::~StringPlay(){delete undohistory; };
 
 void StringEdit::setStringSegment(StringPointer sp,StringPointer ep,int count,SPA<Dirn> newRoute){
+  Vector pos=spliceStringSegment(sp,ep,count,newRoute);
+  //slide the rest of the string across to line up
+  layoutString(ep.el,pos);
+}
+
+void StringEdit::replaceStringSegment(StringPointer sp,StringPointer ep,int count,SPA<Dirn> newRoute){
+  Vector pos=spliceStringSegment(sp,ep,count,newRoute);
+  // keep ep right so the start of the string is always right for relayoutString
+  if(ep==s->end())
+    s->endPos=pos;
+  else
+    ep.el->pos=pos;
+  s->touch();
+}
+
+void StringEdit::relayoutString(){
+  if(s->route.empty())
+    return;
+  layoutString(s->route.begin(),s->route.front().pos);
+}
+
+void StringEdit::layoutString(std::list<StringElement>::iterator it,Vector pos){
+  for(;it!=s->route.end();++it){
+    it->pos=pos;
+    pos+=to_vector(it->d);
+  }
+  s->endPos=pos;
+  s->touch();
+}
+
+Vector StringEdit::spliceStringSegment(StringPointer sp,StringPointer ep,int count,SPA<Dirn> newRoute){
   std::list<StringElement>::iterator it=sp.el;
   Vector pos=it->pos;
   bool endSel=true;
@@ -471,13 +1358,7 @@ void StringEdit::setStringSegment(StringPointer sp,StringPointer ep,int count,SP
   //delete any spares
   while(it!=ep.el)
     it=s->route.erase(it);
-
-  //slide the rest of the string across to line up
-  for(it=ep.el;it!=s->route.end();++it){
-    it->pos=pos;
-    pos+=to_vector(it->d);
-  }
-  s->endPos=pos;
+  return pos;
 }
 
 void StringEdit::translateString(StringPointer sp,Vector newpos){
@@ -491,4 +1372,5 @@ void StringEdit::translateString(StringPointer sp,Vector newpos){
   for(std::list<StringElement>::iterator it=s->route.begin();it!=s->route.end();++it)
     it->pos+=delta;
   s->endPos+=delta;
+  s->touch();
 }
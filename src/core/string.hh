@@ -221,6 +221,13 @@ inline std::ostream& operator<<(std::ostream& o,const ConstStringPointer& e){
 class String{
     std::list<StringElement> route;///< The actual route of the string
     Vector endPos;///< The end location for the string
+    unsigned int routeStamp;///< The stamp for the current route
+    unsigned int selectionStamp;///< The stamp for the current selection
+
+    ///Give the string new stamps after the route (and maybe the selection) has changed
+    void touch();
+    ///Give the string a new selection stamp after the selection has changed
+    void touchSelection();
   public:
     const Maze maze; ///< The maze this string is on
     const Dirn stringDir;///< the direction the string is in
@@ -292,6 +299,26 @@ class String{
      */
     bool hasWon() const;
 
+    ///Get a stamp that changes whenever the route changes
+    /**
+     * Stamps are never reused (until they wrap around) even between different
+     * strings so anything that depends only on the string can remember its
+     * result along with the stamp and reuse it until the stamp changes.
+     * @return the stamp
+     */
+    inline unsigned int getRouteStamp() const{
+      return routeStamp;
+    }
+
+    ///Get a stamp that changes whenever the selection or the route changes
+    /**
+     * @see getRouteStamp
+     * @return the stamp
+     */
+    inline unsigned int getSelectionStamp() const{
+      return selectionStamp;
+    }
+
   private:
     ///Copying isn't allowed
     String& operator=(const String& o);
@@ -310,19 +337,23 @@ class String{
     #endif
 };
 
-template <class T>
-class LimitedStack;
-
-class HistoryElement;
+class MoveHistory;
+struct StepChanges;
+class MoveLog;
 
 /// give access to update the string following the rules of the puzzle
+/**
+ * All of the moves made are kept in a history tree so as well as undo and redo
+ * it is possible to jump back to any earlier state and branch off from there.
+ */
 class StringPlay{
   SP<String> s;///< The string we are working on
 
   int score; ///< The current score for the play so far
 
-  LimitedStack<HistoryElement>* undohistory;///< the undo history
+  MoveHistory* undohistory;///< the undo history
   bool inextendedmove; ///< are we in an extended move
+  MoveLog* recorder; ///< where to record the calls made or 0 for nowhere
 
   public:
     ///Create a new String Play
@@ -359,16 +390,59 @@ class StringPlay{
     /**
      * extended moves are used to ensure a script or keyboard edit breaks a drag
      */
-    inline void startExtendedMove(){
-      inextendedmove=true;
-    }
+    void startExtendedMove();
 
     /// Signal to this StringPlay that an external edit has happened
     /**
-     * This stops any extended move and clears the history
+     * This stops any extended move and starts a new branch of the history
+     * from the edited string so the edit can't be undone.
      */
     void externalEditHappened();
 
+    /// Limit the amount of memory used by the undo history
+    /**
+     * By default the undo history is unlimited. When a limit is set and the
+     * history grows past it everything except the most recent moves leading to
+     * the current state is forgotten. The current state is always kept so a
+     * string too long for the budget on its own still goes over it.
+     * @note this invalidates any ids returned by snapshot
+     * @param bytes the maximum number of bytes to use or 0 for no limit
+     */
+    void setUndoBudget(int bytes);
+
+    /// Get the amount of memory the undo history is currently using
+    /**
+     * @return the number of bytes of undo history stored
+     */
+    int getUndoMemory() const;
+
+    /// Set how often a full copy of the string is stored in the history
+    /**
+     * Rebuilding an old state replays at most this many moves.
+     * @param moves the number of moves between copies
+     */
+    void setCheckpointInterval(int moves);
+
+    /// Record every call that changes the string in a log
+    /**
+     * Calls are recorded whether or not they change anything so replaying
+     * the log through another StringPlay repeats them exactly. Changes made
+     * by SetString and externalEditHappened aren't recorded.
+     * @param log the log to add to which isn't owned by this or 0 to stop
+     * recording
+     */
+    inline void setRecorder(MoveLog* log){
+      recorder=log;
+    }
+
+    /// Get the log calls are being recorded to
+    /**
+     * @return the log or 0 if calls aren't being recorded
+     */
+    inline MoveLog* getRecorder(){
+      return recorder;
+    }
+
     /// Slide the selection in our out
     /**
      * @param moveEnd true for move the end or false for moving the start
@@ -382,10 +456,7 @@ class StringPlay{
      * @param p the element to set the selection state of
      * @param selected if it should be set to selected or unselected
      */
-    void setSelected(StringPointer p,bool selected){
-      inextendedmove=false;
-      p.el->selected=selected;
-    }
+    void setSelected(StringPointer p,bool selected);
 
     ///Check if a move of the string in the specified direction is allowed
     /**
@@ -398,30 +469,102 @@ class StringPlay{
     ///Internal function to move the string in the specified direction
     /**
      * @note this will do the move even if it isn't valid. Always called via
-     * tryMove (and doMove) or undo
+     * tryMove (and doMove), undo or when replaying the history
+     * @param s the string to move
      * @param d the direction to move in
+     * @param changes if not 0 the changes made to the route are recorded here
      * @return a pair containing the score change for the move and the length of the string after the move
      */
-    std::pair<int,int> doMoveI(Dirn d);
+    static std::pair<int,int> doMoveI(String& s,Dirn d,StepChanges* changes=0);
+
+    ///Collapse any lines along the edge at the ends of the string after a move
+    /**
+     * @param t the string to collapse the ends of
+     * @param record true to record the removed segments in the history
+     */
+    void collapse(String& t,bool record);
 
     ///Move the string in the specified direction
     /**
-     * @note this will do the move even if it isn't valid. Always called via
-     * tryMove or undo
+     * @note this will do the first step even if it isn't valid. Always called via
+     * tryMove or tryMoves
      * This does the correct extra logic needed when this is a new move not an undo
      * and uses doMoveI for anything that is common to both cases.
-     * This also stores the move in the undo history.
+     * This also stores the move in the undo history as a single entry.
      * @param d the direction to move in
+     * @param steps the maximum number of steps to move
+     * @return the number of steps moved
+     */
+    int doMove(Dirn d,int steps);
+
+    ///Record the selection state of a string in the history
+    /**
+     * @param t the string
+     */
+    void writeSelection(const String& t);
+    ///Record a full copy of a string in the history
+    /**
+     * @param t the string
+     */
+    void writeState(const String& t);
+    ///Start a new tree in the history from the current string
+    void newRoot();
+    ///Reverse the move stored in a node of the history on our string
+    /**
+     * @param node the node to reverse
+     * @param keep the number of steps at the start of the move to leave
+     * @param movescore if not 0 set to the score of the steps reversed
+     * @return the number of steps reversed
+     */
+    int undoMove(int node,int keep=0,int* movescore=0);
+    ///Repeat the move stored in a node of the history on a string
+    /**
+     * @param t the string in the state of the parent of the node
+     * @param node the node to repeat
+     * @return the number of steps repeated
+     */
+    int redoMove(String& t,int node);
+    ///Rebuild the state of a string at a node of the history
+    /**
+     * @param t the string to update
+     * @param node the node
+     */
+    void load(String& t,int node);
+    ///Forget old history if we are over the memory budget
+    void trimHistory();
+    ///Undo the move in the current state of the history
+    /**
+     * @return the number of steps undone or 0 if there is nothing to undo
      */
-    void doMove(Dirn d);
+    int undoCurrent();
 
   public:
     /// Undo a previous move
     /**
+     * A move made by tryMoves is undone in one go.
      * @param extendedmove if this undo is part of an extended move.
-     * @return true if a move was undone false otherwise
+     * @return the number of steps undone or 0 if nothing was undone
+     */
+    int undo(bool extendedmove=false);
+
+    /// Undo some of the steps of a previous move
+    /**
+     * If the move was made by tryMoves and has more steps than this it is split
+     * in two in the history, the steps that are kept and the steps that are
+     * undone, so the steps undone can be redone. Otherwise this is the same as undo.
+     * @param steps the maximum number of steps to undo
+     * @param extendedmove if this undo is part of an extended move.
+     * @return the number of steps undone or 0 if nothing was undone
+     */
+    int undoSteps(int steps,bool extendedmove=false);
+
+    /// Redo a move that was undone
+    /**
+     * If there are several branches the one used most recently is followed.
+     * @param extendedmove if this redo is part of an extended move.
+     * @return the number of steps redone or 0 if nothing was redone
      */
-    bool undo(bool extendedmove=false);
+    int redo(bool extendedmove=false);
 
     ///Try to move the string in the specified direction
     /**
@@ -432,6 +575,53 @@ class StringPlay{
      */
     bool tryMove(Dirn d,bool extendedmove=false);
 
+    ///Try to move the string several steps in the specified direction
+    /**
+     * This keeps moving until either the number of steps is reached or a move
+     * isn't allowed. The steps are stored as a single entry in the undo history
+     * so anything watching the string only needs to update once.
+     * @param d the direction to move in.
+     * @param steps the maximum number of steps to move.
+     * @param extendedmove if this move is part of an extended move.
+     * @return the number of steps moved
+     */
+    int tryMoves(Dirn d,int steps,bool extendedmove=false);
+
+    /// Get an id for the current state
+    /**
+     * The selection is remembered as it was just after the last move.
+     * @return an id that can be passed to jumpTo or materialise
+     */
+    int snapshot() const;
+
+    /// Get the id of the state a state was reached from
+    /**
+     * @param node the id of the state
+     * @return the id of the previous state or -1 if there isn't one
+     */
+    int getHistoryParent(int node) const;
+
+    /// Get the number of states stored in the history
+    /**
+     * @return the number of states, ids run from 0 to this minus 1
+     */
+    int getHistorySize() const;
+
+    /// Change the string back to an earlier state
+    /**
+     * Any moves made after this start a new branch of the history.
+     * @param node the id of the state to change to
+     * @return true if the string was changed false if the id isn't valid
+     */
+    bool jumpTo(int node);
+
+    /// Build a copy of the string at an earlier state
+    /**
+     * @param node the id of the state
+     * @return a new string or a null pointer if the id isn't valid
+     */
+    SP<String> materialise(int node);
+
     #ifdef IOSTREAM
     friend std::ostream& operator <<(std::ostream& o,const StringPlay& s);
     #endif
@@ -449,6 +639,23 @@ class StringPlay{
 class StringEdit{
   SP<String> s; ///< The string we are working on
 
+  /// Set the route for a section of the string without moving anything after it
+  /**
+   * @see setStringSegment
+   * @param sp the start of the range to replace with the new route
+   * @param ep the element after range to replace with the new route
+   * @param count the number of elements in the new route
+   * @param newRoute the Dirns that make up the new wroute
+   * @return the position the element ep should now be at
+   */
+  Vector spliceStringSegment(StringPointer sp,StringPointer ep,int count,SPA<Dirn> newRoute);
+  /// Set the positions of the elements from one on to follow the route
+  /**
+   * @param it the first element to move
+   * @param pos the position for it
+   */
+  void layoutString(std::list<StringElement>::iterator it,Vector pos);
+
   public:
     ///Create a new String Edit
     /**
@@ -474,6 +681,7 @@ class StringEdit{
      */
     inline void setSelected(StringPointer p,bool selected){
       p.el->selected=selected;
+      s->touchSelection();
     }
 
     /// Set the route for a section of the string to a new route
@@ -497,6 +705,28 @@ class StringEdit{
      * 
      */
     void setStringSegment(StringPointer sp,StringPointer ep,int count,SPA<Dirn> newRoute);
+
+    /// Set the route for a section of the string leaving the rest to be lined up later
+    /**
+     * This is setStringSegment without sliding the elements after ep. Only ep
+     * itself (or the end if ep is the end) is moved to its new position.
+     * Many sections can be replaced like this and then relayoutString called once,
+     * giving the same string as calling setStringSegment for each in turn. Until
+     * then the positions of the other elements after a replaced section are only
+     * right in the String::stringDir direction.
+     * @note StringPlay::externalEditHappened() should be called for any
+     * StringPlays using the same String
+     * @param sp the start of the range to replace with the new route
+     * @param ep the element after range to replace with the new route
+     * @param count the number of elements in the new route
+     * @param newRoute the Dirns that make up the new wroute
+     */
+    void replaceStringSegment(StringPointer sp,StringPointer ep,int count,SPA<Dirn> newRoute);
+    /// Line up the whole string with its route after replaceStringSegment
+    /**
+     * The first element stays where it is and the rest follow the route from it.
+     */
+    void relayoutString();
     
     /// Translate the whole string around.
     /**
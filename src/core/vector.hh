@@ -2,8 +2,8 @@
  * @file vector.hh
  * @brief This file provides a vector class and a few functions for use with it.
  *
- * If we are using irrlicht then the Vector class is just an alias for irr::code::vector3di
- * otherwise we have to implement one ourselves.
+ * The game converts a Vector to an irrlicht vector where it needs one (see con() in irrdisp.hh)
+ * so the core is the same with and without irrlicht and is only compiled once.
  */
 
 #ifdef IOSTREAM
@@ -15,101 +15,89 @@
 
 #include "hypio.hh"
 
-#ifdef IRRLICHT
-  #include "vector3d.h"
-  /// A vector for locations in the maze
-  /**
-   * We use the irrlicht vector when we are linking with irrlicht
-   */
-  typedef irr::core::vector3di Vector;
-#else
-  /// A vector for locations in the maze
-  /**
-   * The manual implementation for when we don't have irrlicht
-   */
-  class Vector{
-    public:
-      int X,///< @brief the x coordinates of the point
-          Y,///< @brief the y coordinates of the point
-          Z;///< @brief the z coordinates of the point
-      /// Construct a vector for a point
-      /**
-       * @param x the x coordinate of the new Vector
-       * @param y the y coordinate of the new Vector
-       * @param z the z coordinate of the new Vector
-       */
-      Vector(int x,int y,int z):X(x),Y(y),Z(z){};
-      /// Construct a new vector for the orign
-      Vector():X(0),Y(0),Z(0){};
-      /// return a vector that is the sum of this vector and another
-      /**
-       * @param o the vector to add to this one
-       * @return a new vector containing the result of the addition
-       */
-      Vector operator+(const Vector& o) const{
-        return Vector(X+o.X,Y+o.Y,Z+o.Z);
-      }
-      /// Add a vector to this vector
-      /**
-       * @param o the vector to add to this vector
-       * @return *this
-       */
-      Vector& operator+=(const Vector& o){
-        X+=o.X;Y+=o.Y;Z+=o.Z;
-        return *this;
-      }
-      /// return a vector that is the difference between this vector and another
-      /**
-       * @param o the vector to subtract from this one
-       * @return a new vector containing the result of the subtraction
-       */
-      Vector operator-(const Vector& o) const{
-        return Vector(X-o.X,Y-o.Y,Z-o.Z);
-      }
-      /// return the opposite of this vector
-      /**
-       * @return a new vector pointing in the opposite direction with the same length
-       */
-      Vector operator-() const{
-        return Vector(-X,-Y,-Z);
-      }
-      /// subtract a vector from this vector
-      /**
-       * @param o the vector to subtract
-       * @return *this
-       */
-      Vector& operator-=(const Vector& o){
-        X-=o.X;Y-=o.Y;Z-=o.Z;
-        return *this;
-      }
-      /// return a vector that is the result of multiplying this vector by a scalar
-      /**
-       * @param i the scalar to multiply by
-       * @return a new vector containing the result of the multiplication
-       */
-      Vector operator*(int i) const {
-        return Vector(X*i,Y*i,Z*i);
-      }
-      /// check if vectors are different.
-      /**
-       * This is a component wise comparison
-       * @param o the vector to compare against
-       * @return true if they are different and false otherwise
-       */
-      bool operator !=(const Vector& o)const {
-        return X!=o.X||Y!=o.Y||Z!=o.Z;
-      }
-      /// check if vectors are the same.
-      /**
-       * This is a component wise comparison
-       * @param o the vector to compare against
-       * @return true if they are the same and false otherwise
-       */
-      int dotProduct(const Vector& o) const{
-        return X*o.X+Y*o.Y+Z*o.Z;
-      }
-  };
-#endif
+/// A vector for locations in the maze
+class Vector{
+  public:
+    int X,///< @brief the x coordinates of the point
+        Y,///< @brief the y coordinates of the point
+        Z;///< @brief the z coordinates of the point
+    /// Construct a vector for a point
+    /**
+     * @param x the x coordinate of the new Vector
+     * @param y the y coordinate of the new Vector
+     * @param z the z coordinate of the new Vector
+     */
+    Vector(int x,int y,int z):X(x),Y(y),Z(z){};
+    /// Construct a new vector for the orign
+    Vector():X(0),Y(0),Z(0){};
+    /// return a vector that is the sum of this vector and another
+    /**
+     * @param o the vector to add to this one
+     * @return a new vector containing the result of the addition
+     */
+    Vector operator+(const Vector& o) const{
+      return Vector(X+o.X,Y+o.Y,Z+o.Z);
+    }
+    /// Add a vector to this vector
+    /**
+     * @param o the vector to add to this vector
+     * @return *this
+     */
+    Vector& operator+=(const Vector& o){
+      X+=o.X;Y+=o.Y;Z+=o.Z;
+      return *this;
+    }
+    /// return a vector that is the difference between this vector and another
+    /**
+     * @param o the vector to subtract from this one
+     * @return a new vector containing the result of the subtraction
+     */
+    Vector operator-(const Vector& o) const{
+      return Vector(X-o.X,Y-o.Y,Z-o.Z);
+    }
+    /// return the opposite of this vector
+    /**
+     * @return a new vector pointing in the opposite direction with the same length
+     */
+    Vector operator-() const{
+      return Vector(-X,-Y,-Z);
+    }
+    /// subtract a vector from this vector
+    /**
+     * @param o the vector to subtract
+     * @return *this
+     */
+    Vector& operator-=(const Vector& o){
+      X-=o.X;Y-=o.Y;Z-=o.Z;
+      return *this;
+    }
+    /// return a vector that is the result of multiplying this vector by a scalar
+    /**
+     * @param i the scalar to multiply by
+     * @return a new vector containing the result of the multiplication
+     */
+    Vector operator*(int i) const {
+      return Vector(X*i,Y*i,Z*i);
+    }
+    /// check if vectors are different.
+    /**
+     * This is a component wise comparison
+     * @param o the vector to compare against
+     * @return true if they are different and false otherwise
+     */
+    bool operator !=(const Vector& o)const {
+      return X!=o.X||Y!=o.Y||Z!=o.Z;
+    }
+    /// check if vectors are the same.
+    /**
+     * This is a component wise comparison
+     * @param o the vector to compare against
+     * @return true if they are the same and false otherwise
+     */
+    int dotProduct(const Vector& o) const{
+      return X*o.X+Y*o.Y+Z*o.Z;
+    }
+};
 /// Extra multiplication operator to make multiplication of a scalar and a vector symmetric
 /**
  * This uses Vector::operator*(int i)
@@ -339,26 +339,31 @@ namespace irr{
         }
         if(dist==0 || currdir==dir){
           if(dist<beststeps){
-            if(pd.sp.tryMove(dir,true)){
+            // move all the way in one go so the display and script only update once
+            int moved=pd.sp.tryMoves(dir,beststeps-dist,true);
+            if(moved>0){
               pd.stringUpdated(base);
               currdir=dir;
-              dist+=1;
-            }else{
-              sm->playEffect(SoundManager::SE_BLOCK);
+              dist+=moved;
             }
+            if(dist<beststeps)
+              sm->playEffect(SoundManager::SE_BLOCK);
           }else if(dist>beststeps){
-            if(pd.sp.undo(true)){
+            // only go back as far as the mouse even if the steps were made in one go
+            int undone=pd.sp.undoSteps(dist-beststeps,true);
+            if(undone>0){
               pd.stringUpdated(base);
               currdir=dir;
-              dist-=1;
+              dist-=undone;
             }else{
               sm->playEffect(SoundManager::SE_BLOCK);
             }
           }
         }else{
-          if(pd.sp.undo(true)){
+          int undone=pd.sp.undo(true);
+          if(undone>0){
             pd.stringUpdated(base);
-            dist-=1;
+            dist-=undone;
           }else{
             sm->playEffect(SoundManager::SE_BLOCK);
           }
@@ -446,6 +446,15 @@ bool GenerateGui::run(){
   return true;
 }
 
+/// Check if a level should be saved in the binary form
+/**
+ * @param file the file name
+ * @return true if it has the .hmb extension
+ */
+static bool isBinaryLevel(irr::io::path file){
+  return file.size()>4 && samePath(file.subString(file.size() - 4, 4), ".hmb");
+}
+
 #ifndef USEOPENSAVE
 bool SaveGui::OnEventImpl(const irr::SEvent &event){
   if(event.EventType == irr::EET_GUI_EVENT){
@@ -510,8 +519,8 @@ bool SaveGui::run(){
         return true;
       }
     }
-    irr::IWriteFile* out=getDevice()->getFileSystem()->createAndWriteFile(fileField->getText());
-    if(!out){
+    // the level is written on another thread and any error writing it is reported once it is done
+    if(!pd->save(fileField->getText(),isBinaryLevel(fileField->getText()))){
       okClicked=false;
       getTopElement()->setVisible(false);
       ErrorGui eg;
@@ -520,19 +529,6 @@ bool SaveGui::run(){
       getDevice()->getGUIEnvironment()->setFocus(fileField);
       return true;
     }
-    IrrHypOStream os(out);
-    out->drop();
-    bool status=write(os,pd->m);
-    os.setNextSpace("\n\n");
-    status&=write(os,pd->sc);
-    if(!status){
-      okClicked=false;
-      getTopElement()->setVisible(false);
-      ErrorGui eg;
-      eg.error(getDevice(),getFontManager(),L"Error writing maze to file","There was an error while writing to the file. The file may only include a partial or broken level. Please try again.");
-      getTopElement()->setVisible(true);
-      return true;
-    }
     return false;
   }
   return true;
@@ -641,21 +637,12 @@ SaveGui::E_SELECTION_TYPE SaveGui::select(const irr::fschar_t* file,SaveGui::E_P
 }
 
 bool SaveGui::process(const irr::fschar_t* file){
-  irr::IWriteFile* out=getDevice()->getFileSystem()->createAndWriteFile(file);
-  if(!out){
+  // the level is written on another thread and any error writing it is reported once it is done
+  if(!pd->save(file,isBinaryLevel(file))){
     ErrorGui eg;
     eg.error(getDevice(),getFontManager(),L"Error Opening File","File can't be opened for writing.");
     return false;
   }
-  IrrHypOStream os(out);
-  out->drop();
-  bool status=write(os,pd->m);
-  os.setNextSpace("\n\n");
-  status&=write(os,pd->sc);
-  if(!status){
-    ErrorGui eg;
-    eg.error(getDevice(),getFontManager(),L"Error writing maze to file","There was an error while writing to the file. The file may only include a partial or broken level. Please try again.");
-  }
   return true;
 }
 
@@ -663,7 +650,7 @@ bool SaveGui::filterfiles(int i, const irr::fschar_t* file, bool folder) {
   if (folder)
     return true;
   irr::path filepath(file);
-  return samePath(filepath.subString(filepath.size() - 4, 4), ".hml");
+  return samePath(filepath.subString(filepath.size() - 4, 4), i==1?".hmb":".hml");
 }
 
 
@@ -726,7 +713,7 @@ bool OpenGui::filterfiles(int i, const irr::fschar_t* file, bool folder) {
   if (folder)
     return true;
   irr::path filepath(file);
-  return samePath(filepath.subString(filepath.size() - 4, 4), ".hml");
+  return samePath(filepath.subString(filepath.size() - 4, 4), i==1?".hmb":".hml");
 }
 #endif // USEOPENSAVE
 
@@ -853,6 +840,9 @@ bool WinGui::run(){
   }
   if(nextClicked){
     getTopElement()->setVisible(false);
+    // it is usually already loaded
+    if(pd->takePrefetched(&*nextLevel.a))
+      return false;
     irr::IReadFile* in=createAndOpen(getDevice()->getFileSystem(),&*nextLevel.a);
     if(!in){
       ErrorGui eg;
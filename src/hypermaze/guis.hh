@@ -283,11 +283,11 @@ class SaveGui: private OpenSaveGui{
     bool process(const irr::fschar_t* file);
     /// @copydoc OpenSaveGui::filtercount
     /**
-    * this has 1 filter
+    * this has 2 filters, one for text levels and one for binary levels
     */
-    int filtercount() { return 1; }
+    int filtercount() { return 2; }
     /// @copydoc OpenSaveGui::filtername
-    const wchar_t* filtername(int i) { return L"Hypermaze Levels (*.hml)"; }
+    const wchar_t* filtername(int i) { return i==1?L"Binary Hypermaze Levels (*.hmb)":L"Hypermaze Levels (*.hml)"; }
     /// @copydoc OpenSaveGui::filterfiles
     bool filterfiles(int i, const irr::fschar_t* file, bool folder);
   public:
@@ -329,11 +329,11 @@ class OpenGui: private OpenSaveGui{
     bool processURL(const wchar_t* url);
     /// @copydoc OpenSaveGui::filtercount
     /**
-     * this has 1 filter
+     * this has 2 filters, one for text levels and one for binary levels
      */
-    int filtercount() { return 1; }
+    int filtercount() { return 2; }
     /// @copydoc OpenSaveGui::filtername
-    const wchar_t* filtername(int i) { return L"Hypermaze Levels (*.hml)"; }
+    const wchar_t* filtername(int i) { return i==1?L"Binary Hypermaze Levels (*.hmb)":L"Hypermaze Levels (*.hml)"; }
     /// @copydoc OpenSaveGui::filterfiles
     bool filterfiles(int i, const irr::fschar_t* file, bool folder);
   public:
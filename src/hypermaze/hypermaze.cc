@@ -42,8 +42,12 @@ class MyNodeGen:public NodeGen{
     MyNodeGen(irr::ISceneManager* smgr,irr::ITexture* wall,irr::ITexture* string,irr::ITexture* activeString,irr::ITexture* handle):
         smgr(smgr),wall(wall),string(string),activeString(activeString),handle(handle){};
 
-    virtual irr::IMeshSceneNode* makeUnitWall(bool isNode){
-      irr::IMeshSceneNode* node = smgr->addCubeSceneNode(1);
+    virtual irr::IMesh* makeUnitWallMesh(){
+      return smgr->getGeometryCreator()->createCubeMesh(irr::vector3df(1,1,1));
+    }
+
+    virtual irr::IMeshSceneNode* makeWalls(irr::IMesh* mesh){
+      irr::IMeshSceneNode* node = smgr->addMeshSceneNode(mesh);
       node->setMaterialTexture( 0, wall);
       node->setMaterialFlag(irr::video::EMF_LIGHTING, true);
       return node;
@@ -277,7 +281,7 @@ int main(int argc,char* argv[]){
 
   PuzzleDisplay pd(ng,device,&fm,sm);
 
-  Controller* c=createController(pd,device,&fm,sm);
+  MultiInterfaceController* c=createController(pd,device,&fm,sm);
   device->setEventReceiver(c);
 
   while(device->run())
@@ -285,9 +289,12 @@ int main(int argc,char* argv[]){
     const irr::u32 now = device->getTimer()->getTime();
 
     pd.sc.setnow(now);
+    pd.log.setTime(now);
 
     c->run(now);
 
+    pd.reportSaves(c,now);
+
     sm->run();
 
     driver->beginScene(true, true, irr::SColor(255,100,101,140));
@@ -296,10 +303,13 @@ int main(int argc,char* argv[]){
 
     guienv->drawAll();
 
-    device->setWindowCaption((irr::stringw(L"Hypermaze: ")+=pd.sp.getScore()).c_str());
+    device->setWindowCaption(((irr::stringw(L"Hypermaze: ")+=pd.sp.getScore())+=pd.getStatus(now)).c_str());
 
     driver->endScene();
   }
+  pd.writeProfile();
+  // the level loading and saving threads use the filesystem so have to stop before the device is dropped
+  pd.finishBackground();
   delete ng;
   delete c;
   delete sm->getMusicSource();
@@ -7,6 +7,9 @@
 #include "controller.hh"
 #include "../core/script.hh"
 #include "guis.hh"
+#include "levelprefetch.hh"
+#include "levelsave.hh"
+#include <climits>
 
 #ifdef IOSTREAM
 #include <iostream>
@@ -21,101 +24,186 @@ namespace irr{
 const double WALL_SIZE = 5;
 const double GAP_SIZE = 20;
 
+/// Get the axis a direction is along
+/**
+ * @param d the direction
+ * @return 0, 1 or 2 for the X, Y or Z axis
+ */
+static int axisOf(Dirn d){
+  Vector v=to_vector(d);
+  return v.X!=0?0:v.Y!=0?1:2;
+}
+
+MazeBrick::MazeBrick():node(0),buffer(new irr::scene::SMeshBuffer()){
+  for(int a=0;a<3;++a){
+    first[a]=INT_MAX;
+    last[a]=INT_MIN;
+  }
+}
+
+MazeBrick::~MazeBrick(){
+  if(node!=0){
+    node->remove();
+    node->drop();
+  }
+  buffer->drop();
+}
+
+void MazeBrick::add(const vector<irr::video::S3DVertex>& unit,const irr::vector3df& position,const irr::vector3df& scale,const Vector& layer){
+  // update indexes the vertices with 16 bits
+  _IRR_DEBUG_BREAK_IF(buffer->Vertices.size()+unit.size()>65536);
+  for(vector<irr::video::S3DVertex>::const_iterator v=unit.begin();v!=unit.end();++v){
+    irr::video::S3DVertex w=*v;
+    w.Pos=position+v->Pos*scale;
+    buffer->Vertices.push_back(w);
+  }
+  int l[3]={layer.X,layer.Y,layer.Z};
+  for(int a=0;a<3;++a){
+    layers[a].push_back(l[a]);
+    first[a]=min(first[a],l[a]);
+    last[a]=max(last[a],l[a]);
+  }
+}
+
+void MazeBrick::makeNode(NodeGen* ng){
+  buffer->recalculateBoundingBox();
+  // the walls never move but the indices change whenever the maze is sliced
+  buffer->setHardwareMappingHint(irr::EHM_STATIC,irr::EBT_VERTEX);
+  buffer->setHardwareMappingHint(irr::EHM_DYNAMIC,irr::EBT_INDEX);
+  irr::SMesh* mesh=new irr::SMesh();
+  mesh->addMeshBuffer(buffer);
+  mesh->recalculateBoundingBox();
+  node=ng->makeWalls(mesh);
+  node->grab();
+  mesh->drop();
+}
+
+void MazeBrick::update(const int* low,const int* high,const vector<irr::u16>& unitIndices,int unitVertexCount){
+  bool all=true;
+  bool none=false;
+  for(int a=0;a<3;++a){
+    all&=low[a]<=first[a] && last[a]<=high[a];
+    none|=last[a]<low[a] || high[a]<first[a];
+  }
+  buffer->Indices.set_used(0);
+  if(!none){
+    int count=layers[0].size();
+    const int* x=count>0?&layers[0][0]:0;
+    const int* y=count>0?&layers[1][0]:0;
+    const int* z=count>0?&layers[2][0]:0;
+    for(int e=0;e<count;++e)
+      if(all || (low[0]<=x[e] && x[e]<=high[0] && low[1]<=y[e] && y[e]<=high[1] && low[2]<=z[e] && z[e]<=high[2]))
+        for(vector<irr::u16>::const_iterator i=unitIndices.begin();i!=unitIndices.end();++i)
+          buffer->Indices.push_back((irr::u16)(*i+e*unitVertexCount));
+  }
+  buffer->setDirty(irr::EBT_INDEX);
+  if(node!=0)
+    node->setVisible(buffer->Indices.size()>0);
+}
+
+void MazeDisplay::getUnitWall(NodeGen* ng,vector<irr::video::S3DVertex>& unitVertices,vector<irr::u16>& unitIndices){
+  irr::IMesh* unit=ng->makeUnitWallMesh();
+  irr::IMeshBuffer* unitBuffer=unit->getMeshBuffer(0);
+  const irr::video::S3DVertex* vertices=(const irr::video::S3DVertex*)unitBuffer->getVertices();
+  unitVertices.assign(vertices,vertices+unitBuffer->getVertexCount());
+  unitIndices.assign(unitBuffer->getIndices(),unitBuffer->getIndices()+unitBuffer->getIndexCount());
+  unit->drop();
+}
+
 void MazeDisplay::init(Maze& m,NodeGen* ng,irr::vector3df center){
-  for(set<Dirn>::iterator d=dirns.begin();d!=dirns.end();++d){
-    limits[*d].first.first=limits[*d].first.second=0;
-    limits[*d].second.first=*d;
-    limits[*d].second.second=true;
-    limits[opposite(*d)].first.first=limits[opposite(*d)].first.second=2*(m.size().dotProduct(to_vector(*d))-1);
-    limits[opposite(*d)].second.first=*d;
-    limits[opposite(*d)].second.second=false;
-
-    nodes[*d]=new vector<vector<VisibleCounter*>*>(
-        2*m.size().dotProduct(to_vector(*d))-1,(vector<VisibleCounter*>*)NULL);
+  vector<irr::video::S3DVertex> vertices;
+  vector<irr::u16> indices;
+  getUnitWall(ng,vertices,indices);
+  build(m,vertices,indices,center);
+  show(ng);
+}
+
+void MazeDisplay::build(const Maze& m,const vector<irr::video::S3DVertex>& _unitVertices,const vector<irr::u16>& _unitIndices,irr::vector3df center){
+  int size[3]={m.size().X,m.size().Y,m.size().Z};
+  for(int a=0;a<3;++a){
+    layerCount[a]=2*size[a]-1;
+    low[a]=0;
+    high[a]=layerCount[a]-1;
   }
 
+  unitVertices=_unitVertices;
+  unitIndices=_unitIndices;
+
+  brickSize=BRICK_SIZE;
+  while(brickSize>1 && brickSize*brickSize*brickSize*4*(int)unitVertices.size()>MAX_BRICK_VERTICES)
+    --brickSize;
+
+  brickCount=Vector((m.size().X+brickSize-1)/brickSize,(m.size().Y+brickSize-1)/brickSize,(m.size().Z+brickSize-1)/brickSize);
+  bricks.resize(brickCount.X*brickCount.Y*brickCount.Z);
+  for(vector<MazeBrick*>::iterator b=bricks.begin();b!=bricks.end();++b)
+    *b=new MazeBrick();
+
   irr::vector3df position=center-(WALL_SIZE+GAP_SIZE)*con(m.size()-Vector(1,1,1))/2;
 
   for(int x=0;x<m.size().X;++x)
     for(int y=0;y<m.size().Y;++y)
       for(int z=0;z<m.size().Z;++z){
         Vector pos(x,y,z);
-        irr::IMeshSceneNode* node = ng->makeUnitWall(true);
-        node->grab();
+        MazeBrick* brick=bricks[(x/brickSize*brickCount.Y+y/brickSize)*brickCount.Z+z/brickSize];
 
-        node->setScale(irr::vector3df(WALL_SIZE,WALL_SIZE,WALL_SIZE));
-        node->setPosition(position+con(pos)*(WALL_SIZE+GAP_SIZE));
-
-        VisibleCounter* vc=new VisibleCounter(node);
-        for(set<Dirn>::iterator dir=dirns.begin();dir!=dirns.end();++dir){
-          if((*nodes[*dir])[2*pos.dotProduct(to_vector(*dir))]==0)
-            (*nodes[*dir])[2*pos.dotProduct(to_vector(*dir))]=new vector<VisibleCounter*>();
-          (*nodes[*dir])[2*pos.dotProduct(to_vector(*dir))]->push_back(vc);
-        }
+        brick->add(unitVertices,position+con(pos)*(WALL_SIZE+GAP_SIZE),irr::vector3df(WALL_SIZE,WALL_SIZE,WALL_SIZE),2*pos);
 
         for(set<Dirn>::iterator d=dirns.begin();d!=dirns.end();++d)
-          if((*m[Vector(x,y,z)]&to_mask(*d))!=0){
-            irr::IMeshSceneNode* node = ng->makeUnitWall(false);
-            node->grab();
-
-            node->setScale(WALL_SIZE*irr::vector3df(1,1,1)+(GAP_SIZE-WALL_SIZE)*remSgn(con(to_vector(*d))));
+          if((*m[Vector(x,y,z)]&to_mask(*d))!=0&&inCube(pos+to_vector(*d),Vector(0,0,0),m.size()))
+            brick->add(unitVertices,
+                position+con(pos)*(WALL_SIZE+GAP_SIZE)+con(to_vector(*d))*(WALL_SIZE+GAP_SIZE)/2,
+                WALL_SIZE*irr::vector3df(1,1,1)+(GAP_SIZE-WALL_SIZE)*remSgn(con(to_vector(*d))),
+                2*pos+to_vector(*d));
+      }
+}
 
-            node->setPosition(position+con(pos)*(WALL_SIZE+GAP_SIZE)+con(to_vector(*d))*(WALL_SIZE+GAP_SIZE)/2);
+void MazeDisplay::show(NodeGen* ng){
+  for(vector<MazeBrick*>::iterator b=bricks.begin();b!=bricks.end();++b){
+    (*b)->makeNode(ng);
+    (*b)->update(low,high,unitIndices,unitVertices.size());
+  }
+}
 
-            VisibleCounter* vc=new VisibleCounter(node);
-            for(set<Dirn>::iterator dir=dirns.begin();dir!=dirns.end();++dir){
-              if((*nodes[*dir])[(2*pos+to_vector(*d)).dotProduct(to_vector(*dir))]==0)
-                (*nodes[*dir])[(2*pos+to_vector(*d)).dotProduct(to_vector(*dir))]=new vector<VisibleCounter*>();
-              (*nodes[*dir])[(2*pos+to_vector(*d)).dotProduct(to_vector(*dir))]->push_back(vc);
-            }
-          }
-      }
+void MazeDisplay::updateLayer(int axis,int layer){
+  // only the bricks with cells in the layer can change
+  int at=layer/2/brickSize;
+  int from[3]={0,0,0};
+  int to[3]={brickCount.X,brickCount.Y,brickCount.Z};
+  from[axis]=at;
+  to[axis]=at+1;
+  for(int x=from[0];x<to[0];++x)
+    for(int y=from[1];y<to[1];++y)
+      for(int z=from[2];z<to[2];++z)
+        bricks[(x*brickCount.Y+y)*brickCount.Z+z]->update(low,high,unitIndices,unitVertices.size());
 }
 
 void MazeDisplay::clear(){
-  for(vector<vector<VisibleCounter*>*>::iterator layer=nodes[UP]->begin();layer!=nodes[UP]->end();++layer){
-    if(*layer==0)
-      continue;
-    for(vector<VisibleCounter*>::iterator node=(*layer)->begin();node!=(*layer)->end();++node){
-      (*node)->node->remove();
-      (*node)->node->drop();
-      delete *node;
-    }
-  }
-  for(set<Dirn>::iterator d=dirns.begin();d!=dirns.end();++d){
-    for(vector<vector<VisibleCounter*>*>::iterator layer=nodes[*d]->begin();layer!=nodes[*d]->end();++layer){
-      if(*layer!=0)
-        delete *layer;
-    }
-    delete nodes[*d];
-  }
-  nodes.clear();
-  limits.clear();
+  for(vector<MazeBrick*>::iterator b=bricks.begin();b!=bricks.end();++b)
+    delete *b;
+  bricks.clear();
 }
 
 bool MazeDisplay::hideSide(Dirn side,bool out){
-  if(limits.empty())
+  if(bricks.empty())
     return false;
-  pair<pair<int,int>,pair<Dirn,bool> >& data=limits[side];
+  int axis=axisOf(side);
+  // UP, LEFT and FORWARD slice from the lowest layer, the others from the highest
+  bool fromLow=to_vector(side).dotProduct(Vector(1,1,1))>0;
+  int& limit=fromLow?low[axis]:high[axis];
+  int step=fromLow?1:-1;
+  int layer;
   if(!out){
-    if(limits[opposite(side)].first.first==data.first.first)
+    if(low[axis]==high[axis])
       return false;
-    vector<VisibleCounter*>* ns=(*nodes[data.second.first])[data.first.first];
-    if(!(ns==0))
-      for(vector<VisibleCounter*>::iterator it=ns->begin();it!=ns->end();++it)
-        (*it)->setVisible(false);
-  }else if(data.first.first==data.first.second)
+    layer=limit;
+    limit+=step;
+  }else{
+    if(limit==(fromLow?0:layerCount[axis]-1))
       return false;
-  if(out==data.second.second)
-    data.first.first--;
-  else
-    data.first.first++;
-  if(out){
-    vector<VisibleCounter*>* ns=(*nodes[data.second.first])[data.first.first];
-    if(!(ns==0))
-      for(vector<VisibleCounter*>::iterator it=ns->begin();it!=ns->end();++it)
-        (*it)->setVisible(true);
+    limit-=step;
+    layer=limit;
   }
+  updateLayer(axis,layer);
   return true;
 }
 void StringDisplay::update(){
@@ -227,13 +315,31 @@ pair<StringPointer,bool> StringDisplay::getStringPointer(irr::ISceneNode* node){
     return pair<StringPointer,bool>(sit,false);
 }
 
-PuzzleDisplay::PuzzleDisplay(NodeGen* ng,irr::IrrlichtDevice* device,FontManager* fm,SoundManager* sm):m(Vector(5,5,5)),sc(),s(new String(m)),sp(s),ng(ng),md(new MazeDisplay(m,ng)),sd(new StringDisplay(s,ng)),won(false),device(device),fm(fm),sm(sm){
+PuzzleDisplay::PuzzleDisplay(NodeGen* ng,irr::IrrlichtDevice* device,FontManager* fm,SoundManager* sm):m(Vector(5,5,5)),sc(),s(new String(m)),sp(s),ng(ng),md(new MazeDisplay(m,ng)),sd(new StringDisplay(s,ng)),won(false),device(device),fm(fm),sm(sm),prefetch(new LevelPrefetch(device?device->getFileSystem():0,ng)),displayBuilt(false),saver(new LevelSave()),saveStatus(),saveStatusEnd(0){
   for(Dirn* d=allDirns;d!=allDirns+6;++d){
     irr::scene::IMeshSceneNode* node = ng->makeUnitHandle(to_vector(*d).dotProduct(to_vector(s->targetDir)));
     node->setScale(irr::core::vector3df(1,1,1)*(WALL_SIZE+GAP_SIZE)/2);
     node->setPosition(-con(to_vector(*d))*(abs(to_vector(*d).dotProduct(m.size()))/2+2)*(WALL_SIZE+GAP_SIZE));
     slicers[node]=*d;
   }
+  const irr::fschar_t* record=
+  #ifdef _IRR_WCHAR_FILESYSTEM
+      _wgetenv(L"HYPERMAZE_RECORD");
+  #else
+      getenv("HYPERMAZE_RECORD");
+  #endif
+  if(record && *record){
+    recordpath=record;
+    sp.setRecorder(&log);
+  }
+  const irr::fschar_t* profiling=
+  #ifdef _IRR_WCHAR_FILESYSTEM
+      _wgetenv(L"HYPERMAZE_PROFILE");
+  #else
+      getenv("HYPERMAZE_PROFILE");
+  #endif
+  if(profiling && *profiling)
+    profilepath=profiling;
 };
 
 SP<Dirn> PuzzleDisplay::getSlicerDirn(irr::ISceneNode* slicer){
@@ -267,6 +373,13 @@ void PuzzleDisplay::win(MultiInterfaceController* c){
   if(r.block)
     return;
   won=true;
+  if(sp.getRecorder() && device){
+    irr::io::IWriteFile* out=device->getFileSystem()->createAndWriteFile(recordpath);
+    if(out){
+      out->write(log.bytes(),log.size());
+      out->drop();
+    }
+  }
   if(sm)
     sm->playEffect(SoundManager::SE_WIN);
   if(device){
@@ -279,6 +392,8 @@ void PuzzleDisplay::win(MultiInterfaceController* c){
 }
 
 void PuzzleDisplay::stringUpdated(MultiInterfaceController* c){
+  if(sp.getRecorder())
+    log.updated();
   ScriptResponseMove r=sc.runMove(s);
   sd->update();
   if(r.stringChanged||r.stringSelectionChanged)
@@ -294,6 +409,8 @@ void PuzzleDisplay::stringUpdated(MultiInterfaceController* c){
     win(c);
 };
 void PuzzleDisplay::stringSelectionUpdated(MultiInterfaceController* c){
+  if(sp.getRecorder())
+    log.selectionUpdated();
   ScriptResponseSelect r=sc.runSelect(s);
   if(r.stringChanged)
     sd->update();
@@ -312,19 +429,42 @@ void PuzzleDisplay::stringSelectionUpdated(MultiInterfaceController* c){
     win(c);
 };
 void PuzzleDisplay::mazeUpdated(MultiInterfaceController* c){
-  md->clear();
-  md->init(m,ng);
+  if(displayBuilt){
+    // the meshes were made while the last level was played
+    md->show(ng);
+    displayBuilt=false;
+  }else{
+    md->clear();
+    md->init(m,ng);
+  }
   s=SP<String>(new String(m));
   sp.SetString(s);
   sd->setString(s);
   for(map<irr::ISceneNode*,Dirn>::iterator slicer=slicers.begin();slicer!=slicers.end();++slicer)
     slicer->first->setPosition(-con(to_vector(slicer->second))*(abs(to_vector(slicer->second).dotProduct(m.size()))/2+2)*(WALL_SIZE+GAP_SIZE));
   won=false;
+  if(sp.getRecorder()){
+    log.clear();
+    log.start();
+  }
+  if(profilepath.size()>0){
+    // keep the report for the last level as the new one has different events
+    if(profile.getRuns()>0)
+      profilereport+=profile.report()+"\n";
+    profile.clear();
+    sc.setProfile(&profile);
+  }
+  // load the next level while this one is played. This also cancels loading
+  // the next level of the last maze if something else was loaded
+  Pair<SPA<const char> > next=sc.findNextLevel();
+  prefetch->start(next.a.isnull()?0:&*next.a);
   ScriptResponseStart r=sc.runStart(s);
   if(r.stringChanged)
     sd->update();
   else if(r.stringSelectionChanged)
     sd->updateActive();
+  if(r.stringChanged||r.stringSelectionChanged)
+    sp.externalEditHappened();
   if(r.messageCount>0){
     MessageGui g;
     c->showGUI(false);
@@ -337,7 +477,64 @@ bool PuzzleDisplay::hideSide(Dirn side,bool out){
   return md->hideSide(side,out);
 };
 
+bool PuzzleDisplay::takePrefetched(const char* url){
+  MazeDisplay* built=0;
+  if(!prefetch->take(url,m,sc,built))
+    return false;
+  delete md;
+  md=built;
+  displayBuilt=true;
+  return true;
+}
+
+bool PuzzleDisplay::save(const irr::io::path& file,bool binary){
+  return saver->save(device->getFileSystem(),file,m,sc,binary);
+}
+
+void PuzzleDisplay::reportSaves(MultiInterfaceController* c,irr::u32 now){
+  LevelSave::Result r;
+  while(saver->finished(r)){
+    if(r.ok){
+      saveStatus=L" (saved ";
+      saveStatus+=r.file;
+      saveStatus+=L")";
+      saveStatusEnd=now+3000;
+    }else{
+      ErrorGui eg;
+      c->showGUI(false);
+      eg.error(device,fm,L"Error writing maze to file","There was an error while writing to the file. The file hasn't been changed. Please try again.");
+      c->showGUI(true);
+    }
+  }
+}
+
+irr::core::stringw PuzzleDisplay::getStatus(irr::u32 now){
+  if(saveStatus.size()>0 && now>=saveStatusEnd)
+    saveStatus=L"";
+  return saveStatus;
+}
+
+void PuzzleDisplay::finishBackground(){
+  prefetch->cancel();
+  saver->finish();
+}
+
+void PuzzleDisplay::writeProfile(){
+  if(profilepath.size()==0 || !device)
+    return;
+  std::string report=profilereport;
+  if(profile.getRuns()>0)
+    report+=profile.report();
+  irr::io::IWriteFile* out=device->getFileSystem()->createAndWriteFile(profilepath);
+  if(out){
+    out->write(report.data(),report.size());
+    out->drop();
+  }
+}
+
 PuzzleDisplay::~PuzzleDisplay(){
+  delete prefetch;
+  delete saver;
   delete md;
   delete sd;
 }
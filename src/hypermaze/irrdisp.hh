@@ -5,10 +5,13 @@
 #include "irrlicht.h"
 #include "../core/maze.hh"
 #include "../core/string.hh"
+#include "../core/movelog.hh"
+#include "../core/scriptprofile.hh"
 #include <map>
 #include <vector>
 #include <set>
 #include <list>
+#include <string>
 #include "../core/dirns.hh"
 #include "../core/script.hh"
 #include "../shared/sound.hh"
@@ -27,7 +30,17 @@ inline irr::core::vector3df remSgn(irr::core::vector3df v){
 
 class NodeGen{
   public:
-    virtual irr::scene::IMeshSceneNode* makeUnitWall(bool isNode)=0;
+    /// Make the mesh of a unit wall which is copied for every wall of a maze
+    /**
+     * @return the mesh which the caller drops
+     */
+    virtual irr::scene::IMesh* makeUnitWallMesh()=0;
+    /// Make a node to show the merged walls of part of a maze
+    /**
+     * @param mesh the mesh of the walls which the node grabs
+     * @return the node
+     */
+    virtual irr::scene::IMeshSceneNode* makeWalls(irr::scene::IMesh* mesh)=0;
     virtual irr::scene::IMeshSceneNode* makeStringEnd()=0;
     virtual irr::scene::IMeshSceneNode* makeUnitString(bool isNode)=0;
     virtual void makeStringActive(irr::scene::IMeshSceneNode* node,bool active)=0;
@@ -37,6 +50,8 @@ class NodeGen{
 class MazeDisplay; // defined in irrdispimp.hh
 class StringDisplay; // defined in irrdispimp.hh
 class MultiInterfaceController; // defined in controller.hh
+class LevelPrefetch; // defined in levelprefetch.hh
+class LevelSave; // defined in levelsave.hh
 
 extern const double WALL_SIZE;
 extern const double GAP_SIZE;
@@ -48,6 +63,7 @@ class PuzzleDisplay{
     Script sc;
     SP<String> s;
     StringPlay sp;
+    MoveLog log;
   private:
     NodeGen* ng;
     MazeDisplay* md;
@@ -57,6 +73,15 @@ class PuzzleDisplay{
     irr::IrrlichtDevice *device;
     FontManager* fm;
     SoundManager *sm;
+    irr::io::path recordpath;
+    ScriptProfile profile;
+    irr::io::path profilepath;
+    std::string profilereport;
+    LevelPrefetch* prefetch;
+    bool displayBuilt;
+    LevelSave* saver;
+    irr::core::stringw saveStatus;
+    irr::u32 saveStatusEnd;
    public:
     PuzzleDisplay(NodeGen* ng,irr::IrrlichtDevice* device,FontManager* fm,SoundManager* sm);
 
@@ -74,6 +99,25 @@ class PuzzleDisplay{
 
     bool hideSide(Dirn side,bool out);
 
+    /// Take the next level if it was loaded in the background
+    /**
+     * The display of the maze is made but not shown until mazeUpdated is called,
+     * which must be next.
+     * @param url the path or url of the level
+     * @return false if it wasn't loaded and has to be opened the normal way
+     */
+    bool takePrefetched(const char* url);
+
+    bool save(const irr::io::path& file,bool binary);
+
+    void reportSaves(MultiInterfaceController* c,irr::u32 now);
+
+    irr::core::stringw getStatus(irr::u32 now);
+
+    void finishBackground();
+
+    void writeProfile();
+
     ~PuzzleDisplay();
 };
 
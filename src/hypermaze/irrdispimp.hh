@@ -7,37 +7,96 @@
 #ifndef IRRDISP_IMP_HH_INC
 #define IRRDISP_IMP_HH_INC
 
-class VisibleCounter{
-  int visible;
+/// A block of cells of the maze drawn as one mesh
+/**
+ * Every wall in the block is copied into one mesh buffer so the whole block is a
+ * single scene node and draw call. Each wall is an element made of a copy of the
+ * vertices of the unit wall mesh. The slice layer each element is in along each
+ * axis is kept in one array per axis, so which are shown can be worked out from
+ * the limits of the slices in a single pass over them.
+ */
+class MazeBrick{
+  std::vector<int> layers[3];
+  int first[3];
+  int last[3];
   public:
-  irr::scene::IMeshSceneNode* node;
-    VisibleCounter(irr::scene::IMeshSceneNode* node):node(node),visible(0){};
-    bool setVisible(bool isVisible){
-      if(isVisible)
-        visible++;
-      else
-        visible--;
-      if(visible<0&&node->isVisible()){
-        node->setVisible(false);
-        return true;
-      }else if(visible>=0&&!node->isVisible()){
-        node->setVisible(true);
-        return true;
-      }
-      return false;
-    }
+    irr::scene::IMeshSceneNode* node;
+    irr::scene::SMeshBuffer* buffer;
+
+    MazeBrick();
+    ~MazeBrick();
+
+    void add(const std::vector<irr::video::S3DVertex>& unit,const irr::core::vector3df& position,const irr::core::vector3df& scale,const Vector& layer);
+
+    void makeNode(NodeGen* ng);
+
+    /// Show the elements within the limits of the slices
+    /**
+     * @param low the lowest layer shown along each axis
+     * @param high the highest layer shown along each axis
+     * @param unitIndices the indices of the unit wall
+     * @param unitVertexCount the number of vertices in the unit wall
+     */
+    void update(const int* low,const int* high,const std::vector<irr::u16>& unitIndices,int unitVertexCount);
 };
 
 class MazeDisplay{
-  std::map<Dirn,std::pair<std::pair<int,int>,std::pair<Dirn,bool> > > limits;
-  std::map<Dirn,std::vector<std::vector<VisibleCounter*>*>*> nodes;
+  /// The most cells along each side of a MazeBrick
+  static const int BRICK_SIZE=8;
+  /// The number of vertices the 16 bit indices of a mesh buffer can reach
+  static const int MAX_BRICK_VERTICES=65536;
+  /// The number of cells along each side of a MazeBrick
+  /**
+   * A brick has at most 4 walls a cell, so this is made small enough in build that
+   * all the copies of the unit wall in a brick fit the 16 bit indices
+   */
+  int brickSize;
+  int low[3];
+  int high[3];
+  int layerCount[3];
+  Vector brickCount;
   std::set<Dirn> dirns;
+  std::vector<MazeBrick*> bricks;
+  std::vector<irr::video::S3DVertex> unitVertices;
+  std::vector<irr::u16> unitIndices;
+  void updateLayer(int axis,int layer);
   public:
+    /// Get the vertices and indices of the unit wall that is copied for each wall
+    /**
+     * @param ng the node generator to get the mesh from
+     * @param unitVertices set to the vertices
+     * @param unitIndices set to the indices
+     */
+    static void getUnitWall(NodeGen* ng,std::vector<irr::video::S3DVertex>& unitVertices,std::vector<irr::u16>& unitIndices);
+
     void init(Maze& m,NodeGen* ng,irr::core::vector3df center=irr::core::vector3df(0,0,0));
 
+    /// Make the meshes of a maze without adding them to the scene
+    /**
+     * This only makes new mesh buffers so it can be done on another thread as long
+     * as nothing else uses the display until it is done.
+     * @param m the maze
+     * @param unitVertices the vertices of the unit wall from getUnitWall
+     * @param unitIndices the indices of the unit wall from getUnitWall
+     * @param center the center of the maze
+     */
+    void build(const Maze& m,const std::vector<irr::video::S3DVertex>& unitVertices,const std::vector<irr::u16>& unitIndices,irr::core::vector3df center=irr::core::vector3df(0,0,0));
+
+    /// Add the meshes made by build to the scene
+    /**
+     * @param ng the node generator to make the nodes with
+     */
+    void show(NodeGen* ng);
+
     void clear();
 
-    MazeDisplay(Maze& m,NodeGen* ng,irr::core::vector3df center=irr::core::vector3df(0,0,0)){
+    MazeDisplay():brickSize(BRICK_SIZE){
+      dirns.insert(UP);
+      dirns.insert(LEFT);
+      dirns.insert(FORWARD);
+    }
+
+    MazeDisplay(Maze& m,NodeGen* ng,irr::core::vector3df center=irr::core::vector3df(0,0,0)):brickSize(BRICK_SIZE){
       dirns.insert(UP);
       dirns.insert(LEFT);
       dirns.insert(FORWARD);
@@ -0,0 +1,87 @@
+/**
+ * @file levelprefetch.cc
+ * @brief Implementation of levelprefetch.hh
+ */
+#include "levelprefetch.hh"
+#include "irrdispimp.hh"
+#include "../irrshared/irrcurl.hh"
+
+LevelPrefetch::LevelPrefetch(irr::io::IFileSystem* fs,NodeGen* ng):fs(fs),ng(ng),loader(),cancelled(false),path(),resolved(),
+    unitVertices(),unitIndices(),is(0),m(Vector(5,5,5)),md(0){}
+
+LevelPrefetch::~LevelPrefetch(){
+  cancel();
+}
+
+void LevelPrefetch::load(){
+  std::vector<char> data;
+  if(!readURL(resolved.c_str(),data,&cancelled))
+    return;
+  MemoryHypIStream* lis=new MemoryHypIStream(&data[0],data.size());
+  std::vector<char>().swap(data);
+  Maze lm(Vector(5,5,5));
+  if(cancelled || !read(*lis,lm).ok){
+    delete lis;
+    return;
+  }
+  MazeDisplay* lmd=new MazeDisplay();
+  lmd->build(lm,unitVertices,unitIndices);
+  m=lm;
+  is=lis;
+  md=lmd;
+}
+
+void LevelPrefetch::wait(){
+  if(loader.joinable())
+    loader.join();
+}
+
+void LevelPrefetch::start(const char* url){
+  if(!fs || !url || !*url){
+    cancel();
+    return;
+  }
+  if(path==url)
+    return;
+  cancel();
+  resolved=resolveURL(fs,url);
+  if(resolved.empty())
+    return;
+  if(unitVertices.empty())
+    MazeDisplay::getUnitWall(ng,unitVertices,unitIndices);
+  path=url;
+  cancelled=false;
+  loader=std::thread(&LevelPrefetch::load,this);
+}
+
+void LevelPrefetch::cancel(){
+  cancelled=true;
+  wait();
+  path.clear();
+  resolved.clear();
+  delete is;
+  is=0;
+  delete md;
+  md=0;
+  // don't keep a large maze around
+  m=Maze(Vector(5,5,5));
+}
+
+bool LevelPrefetch::take(const char* url,Maze& _m,Script& _sc,MazeDisplay*& _md){
+  if(!url || path.empty() || path!=url)
+    return false;
+  wait();
+  bool loaded=false;
+  if(is && md){
+    Script lsc;
+    if(read(*is,lsc).ok){
+      _m=m;
+      _sc=lsc;
+      _md=md;
+      md=0;
+      loaded=true;
+    }
+  }
+  cancel();
+  return loaded;
+}
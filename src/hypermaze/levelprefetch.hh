@@ -0,0 +1,85 @@
+/**
+ * @file levelprefetch.hh
+ * @brief Loading the next level in the background while the current one is played
+ */
+#include "irrlicht.h"
+#include "../core/maze.hh"
+#include "../shared/memoryhypioimp.hh"
+#include "../core/script.hh"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef LEVELPREFETCH_HH_INC
+#define LEVELPREFETCH_HH_INC
+
+class NodeGen; // defined in irrdisp.hh
+class MazeDisplay; // defined in irrdispimp.hh
+
+/// Loads a level on another thread so it is ready when it is asked for
+/**
+ * The path of the level is looked up in the irrlicht filesystem on the main thread
+ * as irrlicht isn't thread safe. The other thread then reads or downloads the file
+ * without irrlicht, reads the maze from memory and makes the meshes to display it,
+ * which is nearly all the work of loading a level. Adding the meshes to the scene
+ * is left for the main thread.
+ *
+ * The script is read when the level is taken as reading scripts copies the shared
+ * default conditions and actions, whose reference counts aren't safe to change
+ * from two threads. Scripts are small so this is quick.
+ *
+ * Only one level is loaded at a time. Starting another cancels the first, which
+ * stops part way through reading or downloading the file.
+ */
+class LevelPrefetch{
+  irr::io::IFileSystem* fs;///< the filesystem to look up levels in
+  NodeGen* ng;///< the node generator to get the unit wall from
+  std::thread loader;///< the thread loading the level if one was started
+  std::atomic<bool> cancelled;///< set to stop the load
+  std::string path;///< the path of the level being loaded or empty if there isn't one
+  std::string resolved;///< where the level is read from, as given by resolveURL
+  std::vector<irr::video::S3DVertex> unitVertices;///< the vertices of the unit wall
+  std::vector<irr::u16> unitIndices;///< the indices of the unit wall
+  MemoryHypIStream* is;///< the level being read with the script still to read or 0, only valid once loader is joined
+  Maze m;///< the maze of the level, only valid once loader is joined
+  MazeDisplay* md;///< the meshes of the maze not yet in the scene or 0, only valid once loader is joined
+
+  /// Read the level in resolved into is, m and md
+  void load();
+  /// Wait for the thread loading the level to finish
+  void wait();
+
+  public:
+    /// Create a prefetcher with nothing loading
+    /**
+     * @param fs the filesystem to look up levels in or 0 to never load anything
+     * @param ng the node generator the maze will be displayed with
+     */
+    LevelPrefetch(irr::io::IFileSystem* fs,NodeGen* ng);
+    /// Cancel any load and wait for it to stop
+    ~LevelPrefetch();
+
+    /// Start loading a level
+    /**
+     * Anything else being loaded is cancelled. If the level is already being loaded
+     * it carries on.
+     * @param url the path or url of the level as given to createAndOpen
+     */
+    void start(const char* url);
+    /// Cancel loading a level and forget it
+    void cancel();
+    /// Get a level that was loaded
+    /**
+     * If it is still loading this waits for it.
+     * @param url the path or url of the level
+     * @param m set to the maze if it was loaded
+     * @param sc set to the script if it was loaded
+     * @param md set to the display of the maze, which still has to be shown, if it was loaded
+     * @return false if the level wasn't being loaded or couldn't be read in which case
+     * it should be opened the normal way to report the error
+     */
+    bool take(const char* url,Maze& m,Script& sc,MazeDisplay*& md);
+};
+
+#endif
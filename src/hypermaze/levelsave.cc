@@ -0,0 +1,121 @@
+/**
+ * @file levelsave.cc
+ * @brief Implementation of levelsave.hh
+ */
+#include "levelsave.hh"
+#include "../shared/irrhypioimp.hh"
+#include "../shared/memoryhypioimp.hh"
+#include "../irrshared/platformcompat.hh"
+#include <cstdio>
+
+LevelSave::LevelSave():worker(),lock(),wake(),jobs(),done(),stopping(false){}
+
+LevelSave::~LevelSave(){
+  finish();
+  for(std::deque<Job*>::iterator it=done.begin();it!=done.end();++it)
+    delete *it;
+}
+
+bool LevelSave::save(irr::io::IFileSystem* fs,const irr::io::path& file,Maze& m,const Script& sc,bool binary){
+  Job* j=new Job(m);
+  j->file=file;
+  j->temp=file+".tmp";
+  j->binary=binary;
+
+  // the script is written as it would be after the maze, which is without the
+  // binary header and separated by a blank line in text
+  SPA<char> data;
+  MemoryHypOStream os(data);
+  if(binary)
+    os.setBinary();
+  os.flush();
+  int header=os.strlen;
+  bool status=::write(os,sc);
+  os.flush();
+  if(!status){
+    delete j;
+    return false;
+  }
+  if(!binary){
+    j->script.push_back('\n');
+    j->script.push_back('\n');
+  }
+  j->script.insert(j->script.end(),&*data+header,&*data+os.strlen);
+
+  j->out=fs->createAndWriteFile(j->temp);
+  if(!j->out){
+    delete j;
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> l(lock);
+    jobs.push_back(j);
+    stopping=false;
+  }
+  if(!worker.joinable())
+    worker=std::thread(&LevelSave::run,this);
+  wake.notify_one();
+  return true;
+}
+
+void LevelSave::run(){
+  std::unique_lock<std::mutex> l(lock);
+  for(;;){
+    while(jobs.empty() && !stopping)
+      wake.wait(l);
+    if(jobs.empty())
+      return;
+    Job* j=jobs.front();
+    jobs.pop_front();
+    l.unlock();
+    write(j);
+    l.lock();
+    done.push_back(j);
+  }
+}
+
+void LevelSave::write(Job* j){
+  bool status;
+  {
+    IrrHypOStream os(j->out);
+    if(j->binary)
+      os.setBinary();
+    status=::write(os,j->m);
+    os.flush();
+  }
+  if(!j->script.empty())
+    status&=j->out->write(&j->script[0],j->script.size())==(irr::s32)j->script.size();
+  // this closes the file
+  j->out->drop();
+  j->out=0;
+  j->ok=status && replaceFile(j->temp,j->file);
+  if(!j->ok)
+    remove(irr::core::stringc(j->temp).c_str());
+}
+
+bool LevelSave::finished(Result& r){
+  Job* j;
+  {
+    std::lock_guard<std::mutex> l(lock);
+    if(done.empty())
+      return false;
+    j=done.front();
+    done.pop_front();
+  }
+  r.file=j->file;
+  r.ok=j->ok;
+  // the maze shares its cells with ones used on this thread so it is freed here
+  delete j;
+  return true;
+}
+
+void LevelSave::finish(){
+  if(!worker.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> l(lock);
+    stopping=true;
+  }
+  wake.notify_one();
+  worker.join();
+}
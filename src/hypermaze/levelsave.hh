@@ -0,0 +1,95 @@
+/**
+ * @file levelsave.hh
+ * @brief Saving levels on another thread so the game doesn't stop while a large maze is written
+ */
+#include "irrlicht.h"
+#include "../core/maze.hh"
+#include "../core/script.hh"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef LEVELSAVE_HH_INC
+#define LEVELSAVE_HH_INC
+
+/// Writes levels to files on another thread
+/**
+ * Saving takes a snapshot of the level and queues it. The maze shares the cells with
+ * the one being played, which is fine as mazes are never changed once made, so
+ * that takes the same time whatever the size of the maze. The script is written to
+ * memory straight away as writing it copies pointers shared with the script being
+ * run. It is small so this is quick.
+ *
+ * The level is then written to a temporary file next to the file being saved on
+ * another thread which replaces the file once it has all been written, so the
+ * file is either the old one or the whole new level even if the game stops while
+ * saving. The results are passed back to be reported by the main thread.
+ */
+class LevelSave{
+  /// A level being saved
+  struct Job{
+    irr::io::path file;///< the file being saved
+    irr::io::path temp;///< the temporary file being written
+    irr::io::IWriteFile* out;///< the temporary file which the job keeps a reference to until it is written
+    bool binary;///< if the level is written in the binary form
+    Maze m;///< the maze sharing the cells of the one saved
+    std::vector<char> script;///< the script as it goes after the maze in the file
+    bool ok;///< if the level was saved
+    /// Create a job
+    /**
+     * @param m the maze to share the cells of
+     */
+    Job(Maze& m):out(0),binary(false),m(m),script(),ok(false){};
+  };
+
+  std::thread worker;///< the thread writing the levels if one was started
+  std::mutex lock;///< held to use jobs, done or stopping
+  std::condition_variable wake;///< signalled when a job is added or the worker should stop
+  std::deque<Job*> jobs;///< the levels waiting to be written
+  std::deque<Job*> done;///< the levels written waiting to be reported
+  bool stopping;///< set to make the worker stop once there are no more jobs
+
+  /// Write levels until told to stop
+  void run();
+  /// Write a level
+  /**
+   * @param j the level which is set as ok if it was written
+   */
+  void write(Job* j);
+
+  public:
+    /// The outcome of a save
+    struct Result{
+      irr::io::path file;///< the file that was saved
+      bool ok;///< if it was saved
+    };
+
+    /// Create a saver with nothing to save
+    LevelSave();
+    /// Finish writing any levels waiting to be saved
+    ~LevelSave();
+
+    /// Start saving a level
+    /**
+     * @param fs the filesystem to open the temporary file with
+     * @param file the path of the file to save to
+     * @param m the maze which shares its cells with the saved one
+     * @param sc the script
+     * @param binary true to write the binary form
+     * @return false if the temporary file couldn't be opened in which case nothing is saved
+     */
+    bool save(irr::io::IFileSystem* fs,const irr::io::path& file,Maze& m,const Script& sc,bool binary);
+    /// Get the result of a save that has finished
+    /**
+     * Each save gives exactly one result, in the order they were started.
+     * @param r set to the result
+     * @return false if there are no more results yet
+     */
+    bool finished(Result& r);
+    /// Wait for all the levels waiting to be saved to be written
+    void finish();
+};
+
+#endif
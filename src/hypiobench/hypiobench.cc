@@ -0,0 +1,450 @@
+/**
+ * @file hypiobench.cc
+ * @brief Throughput benchmark for reading and writing levels through hypio
+ *
+ * Usage: hypiobench [-z size]... [-w cells] [-d dir]
+ *
+ * For each size, 5, 10, 20, 50, 100 and 200 unless sizes are given, a maze is
+ * made along with a script that grows with it, with an event for each layer
+ * and a range for each layer in every event. The level is written in the text
+ * and binary forms, which compress the cells of larger mazes, and for mazes that
+ * are compressed also as text with the cells as numbers.
+ *
+ * Each form is then read back with every input stream:
+ * - cpp: CPPHypIStream from a std::istringstream
+ * - memory: MemoryHypIStream
+ * - file: a BufHypIStream reading a file a buffer at a time the same way
+ *   IrrHypIStream reads through Irrlicht, which the tools don't link
+ * - mapped: MappedHypIStream
+ *
+ * and written with the output streams that exist, cpp, memory and file. The speed
+ * is reported in MB of the level and in cells per second. Every level read is
+ * written again and checked against the level it was read from. Each is repeated
+ * until about the given number of cells (10 million by default) have been read or
+ * written. The files are made in dir, the current directory by default, and removed
+ * after.
+ *
+ * The exit status is 1 if any read didn't give back the same level.
+ */
+#include "../core/maze.hh"
+#include "../core/mazegen.hh"
+#include "../core/script.hh"
+#include "../shared/bufhypio.hh"
+#include "../shared/cpphypioimp.hh"
+#include "../shared/mappedhypioimp.hh"
+#include "../shared/memoryhypioimp.hh"
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+
+using namespace std;
+
+/// A HypIStream that reads a file a buffer at a time through stdio
+/**
+ * This reads in the same way as IrrHypIStream so it shows how that performs
+ * without needing Irrlicht.
+ */
+class FileHypIStream: public BufHypIStream{
+  FILE* f;///< the file to read
+  public:
+    /// Create a stream to read a file
+    /**
+     * @param f the file which is left open
+     */
+    FileHypIStream(FILE* f):f(f){};
+  protected:
+    // doc copied
+    void readtobuf(){
+      if(eof)
+        return;
+      if(start!=0){
+        memmove(buf,buf+start,end-start);
+        end-=start;
+        start=0;
+      }
+      if(end==len){
+        len*=2;
+        char* tmp=new char[len+1];
+        memcpy(tmp,buf,end);
+        delete[] buf;
+        buf=tmp;
+      }
+      size_t read=fread(buf+end,1,len-end,f);
+      end+=read;
+      buf[end]='\0';
+      if(read==0)
+        eof=true;
+    }
+};
+
+/// A HypOStream that writes a file a buffer at a time through stdio
+/**
+ * This writes in the same way as IrrHypOStream.
+ */
+class FileHypOStream: public BufHypOStream{
+  FILE* f;///< the file to write
+  public:
+    /// Create a stream to write a file
+    /**
+     * @param f the file which is left open
+     */
+    FileHypOStream(FILE* f):f(f){};
+    /// Write what is left in the buffer
+    ~FileHypOStream(){
+      writeToSink();
+    }
+  protected:
+    // doc copied
+    bool writeToSink(){
+      bool valid=fwrite(buf,1,end,f)==(size_t)end;
+      end=0;
+      return valid;
+    }
+};
+
+/// A form a level can be written in
+struct Form{
+  const char* name;///< the name to report
+  bool binary;///< if it is the binary form
+  bool compressed;///< if the cells are compressed
+};
+
+/// Write a level
+/**
+ * @param s the stream to write to
+ * @param m the maze
+ * @param sc the script
+ * @param form the form to write
+ * @return true if it was written
+ */
+bool writeLevel(HypOStream& s,const Maze& m,const Script& sc,const Form& form){
+  if(form.binary && !s.setBinary())
+    return false;
+  bool status=write(s,m,form.compressed);
+  s.setNextSpace("\n\n");
+  status&=write(s,sc);
+  return status;
+}
+
+/// Write a level to a string
+/**
+ * @param m the maze
+ * @param sc the script
+ * @param form the form to write
+ * @return the text or data written
+ */
+string format(const Maze& m,const Script& sc,const Form& form){
+  ostringstream os;
+  {
+    CPPHypOStream hos(os);
+    writeLevel(hos,m,sc,form);
+  }
+  return os.str();
+}
+
+/// Read a level
+/**
+ * @param s the stream to read from
+ * @param m set to the maze
+ * @param sc set to the script
+ * @return true if it was read
+ */
+bool readLevel(HypIStream& s,Maze& m,Script& sc){
+  return read(s,m).ok && read(s,sc).ok;
+}
+
+/// Make a maze quickly whatever its size
+/**
+ * Generating a maze takes far longer than linear time in the number of cells so
+ * larger mazes are made of blocks of up to MAZE_BLOCK cells a side generated
+ * separately. Each block is joined by a passage to the block before it so the
+ * whole maze is still connected, and every wall is still in both of the cells it
+ * is between, so the cells compress about as well as those of a generated maze.
+ * @param size the size of the maze
+ * @return the maze
+ */
+Maze makeMaze(int size){
+  const int MAZE_BLOCK=20;
+  int blocks=(size+MAZE_BLOCK-1)/MAZE_BLOCK;
+  Maze m(Vector(size,size,size));
+  // blocks of the same shape are only generated once
+  map<int,Maze> shapes;
+  for(int bx=0;bx<blocks;++bx)
+    for(int by=0;by<blocks;++by)
+      for(int bz=0;bz<blocks;++bz){
+        Vector start(size*bx/blocks,size*by/blocks,size*bz/blocks);
+        Vector end(size*(bx+1)/blocks,size*(by+1)/blocks,size*(bz+1)/blocks);
+        Vector shape=end-start;
+        int key=(shape.X*(MAZE_BLOCK+1)+shape.Y)*(MAZE_BLOCK+1)+shape.Z;
+        map<int,Maze>::iterator it=shapes.find(key);
+        if(it==shapes.end())
+          it=shapes.insert(make_pair(key,generate<RandLimitMazeGenHalf<Hunter<RandOrderWalker<DiagonalWalker> > > >(shape))).first;
+        const Maze& block=it->second;
+        for(int x=0;x<shape.X;++x)
+          for(int y=0;y<shape.Y;++y)
+            for(int z=0;z<shape.Z;++z)
+              *m[start+Vector(x,y,z)]=*block[Vector(x,y,z)];
+        Dirn back=bx>0?RIGHT:by>0?DOWN:BACK;
+        if(bx+by+bz>0){
+          Vector p=start+Vector(rand()%shape.X,rand()%shape.Y,rand()%shape.Z);
+          if(back==RIGHT)
+            p.X=start.X;
+          else if(back==DOWN)
+            p.Y=start.Y;
+          else
+            p.Z=start.Z;
+          *m[p]|=to_mask(back);
+          *m[p+to_vector(back)]|=to_mask(opposite(back));
+        }
+      }
+  return m;
+}
+
+/// Make a script that grows with the size of a maze
+/**
+ * Each layer has an event that happens some time after the one before it when part of
+ * the string is in a range of layers. Its condition has a range for every layer so
+ * the size of the script grows with the square of the size of the maze.
+ * @param size the size of the maze
+ * @return the script
+ */
+Script makeScript(int size){
+  ostringstream text;
+  text<<size;
+  for(int e=0;e<size;++e){
+    text<<" 2 3 2 5 "<<(e>0?e-1:0)<<" 100 7 1 1 * 1 3 63 "<<size;
+    for(int r=0;r<size;++r)
+      text<<" "<<r<<" "<<r+e%3;
+    text<<" 0 0 0 0 2 2 1 "<<e<<":B \"Layer "<<e<<" reached\" 1";
+  }
+  string data=text.str();
+  MemoryHypIStream in(data.data(),data.size());
+  Script sc;
+  read(in,sc);
+  return sc;
+}
+
+/// Report the speed of a read or write
+/**
+ * @param size the size of the maze
+ * @param stream the stream used
+ * @param form the form of the level
+ * @param what read or write
+ * @param bytes the size of the level
+ * @param cells the number of cells in the maze
+ * @param repeats the number of times it was done
+ * @param seconds the time taken
+ */
+void report(int size,const char* stream,const char* form,const char* what,size_t bytes,int cells,int repeats,double seconds){
+  cout<<size<<"^3 "<<what<<" "<<stream<<" "<<form<<": "<<bytes<<" bytes "<<repeats<<" times in "<<seconds<<"s";
+  if(seconds>0)
+    cout<<" ("<<bytes*(double)repeats/seconds/1e6<<" MB/s, "<<cells*(double)repeats/seconds/1e6<<" Mcells/s)";
+  cout<<endl;
+}
+
+/// Write data to a file
+/**
+ * @param name the name of the file
+ * @param data the data to write
+ * @return true if it was written
+ */
+bool writeFile(const string& name,const string& data){
+  FILE* f=fopen(name.c_str(),"wb");
+  if(!f)
+    return false;
+  bool ok=fwrite(data.data(),1,data.size(),f)==data.size();
+  return fclose(f)==0 && ok;
+}
+
+/// The streams that levels are read with
+enum Stream{
+  CPP,///< CPPHypIStream
+  MEMORY,///< MemoryHypIStream
+  FILESTREAM,///< FileHypIStream
+  MAPPED///< MappedHypIStream
+};
+/// The names of the streams
+const char* const STREAM_NAMES[]={"cpp","memory","file","mapped"};
+/// The number of streams
+const int STREAM_COUNT=4;
+
+/// Read a level with a stream
+/**
+ * @param stream the stream to use
+ * @param data the level
+ * @param file the name of a file holding the level
+ * @param m set to the maze
+ * @param sc set to the script
+ * @return true if it was read
+ */
+bool readWith(Stream stream,const string& data,const string& file,Maze& m,Script& sc){
+  switch(stream){
+    case CPP:{
+      istringstream is(data);
+      CPPHypIStream s(is);
+      return readLevel(s,m,sc);
+    }
+    case MEMORY:{
+      MemoryHypIStream s(data.data(),data.size());
+      return readLevel(s,m,sc);
+    }
+    case FILESTREAM:{
+      FILE* f=fopen(file.c_str(),"rb");
+      if(!f)
+        return false;
+      bool ok;
+      {
+        FileHypIStream s(f);
+        ok=readLevel(s,m,sc);
+      }
+      fclose(f);
+      return ok;
+    }
+    case MAPPED:{
+      MappedHypIStream s(file.c_str());
+      return s.isOpen() && readLevel(s,m,sc);
+    }
+  }
+  return false;
+}
+
+/// Write a level with a stream
+/**
+ * Mapped files can't be written
+ * @param stream the stream to use
+ * @param file the name of the file to write for the file stream
+ * @param m the maze
+ * @param sc the script
+ * @param form the form to write
+ * @return the number of bytes written or -1 if the level couldn't be written
+ */
+long writeWith(Stream stream,const string& file,const Maze& m,const Script& sc,const Form& form){
+  switch(stream){
+    case CPP:{
+      ostringstream os;
+      {
+        CPPHypOStream s(os);
+        if(!writeLevel(s,m,sc,form))
+          return -1;
+      }
+      return os.str().size();
+    }
+    case MEMORY:{
+      SPA<char> data;
+      MemoryHypOStream s(data);
+      if(!writeLevel(s,m,sc,form))
+        return -1;
+      s.flush();
+      return s.strlen;
+    }
+    case FILESTREAM:{
+      FILE* f=fopen(file.c_str(),"wb");
+      if(!f)
+        return -1;
+      bool ok;
+      {
+        FileHypOStream s(f);
+        ok=writeLevel(s,m,sc,form);
+      }
+      long size=ftell(f);
+      ok&=fclose(f)==0;
+      return ok?size:-1;
+    }
+    case MAPPED:
+      break;
+  }
+  return -1;
+}
+
+int main(int argc,char** argv){
+  vector<int> sizes;
+  double work=1e7;
+  string dir=".";
+  for(int i=1;i<argc;++i){
+    string arg=argv[i];
+    if(i+1<argc && arg=="-z")
+      sizes.push_back(atoi(argv[++i]));
+    else if(i+1<argc && arg=="-w")
+      work=atof(argv[++i]);
+    else if(i+1<argc && arg=="-d")
+      dir=argv[++i];
+    else{
+      cerr<<"Usage: "<<argv[0]<<" [-z size]... [-w cells] [-d dir]"<<endl;
+      return 2;
+    }
+  }
+  if(sizes.empty()){
+    const int defaults[]={5,10,20,50,100,200};
+    sizes.assign(defaults,defaults+sizeof(defaults)/sizeof(defaults[0]));
+  }
+  string file=dir+"/hypiobench.tmp";
+
+  int failures=0;
+  for(unsigned int z=0;z<sizes.size();++z){
+    int size=sizes[z]<3?3:sizes[z];
+    srand(1);
+    Maze m=makeMaze(size);
+    Script sc=makeScript(size);
+    int count=size*size*size;
+    int repeats=(int)(work/count);
+    if(repeats<1)
+      repeats=1;
+    bool compressed=count>=MAZE_COMPRESS_CELLS;
+
+    vector<Form> forms;
+    Form text={"text",false,compressed};
+    Form binary={"binary",true,compressed};
+    forms.push_back(text);
+    forms.push_back(binary);
+    if(compressed){
+      Form numbers={"text-numbers",false,false};
+      forms.push_back(numbers);
+    }
+
+    for(unsigned int f=0;f<forms.size();++f){
+      const Form& form=forms[f];
+      string data=format(m,sc,form);
+      if(!writeFile(file,data)){
+        cerr<<"Can't write "<<file<<endl;
+        return 2;
+      }
+      for(int st=0;st<STREAM_COUNT;++st){
+        Maze r(Vector(3,3,3));
+        Script rsc;
+        chrono::steady_clock::time_point start=chrono::steady_clock::now();
+        for(int i=0;i<repeats;++i)
+          if(!readWith((Stream)st,data,file,r,rsc))
+            failures++;
+        report(size,STREAM_NAMES[st],form.name,"read",data.size(),count,repeats,chrono::duration<double>(chrono::steady_clock::now()-start).count());
+        if(format(r,rsc,form)!=data){
+          cout<<"the level read back was different"<<endl;
+          failures++;
+        }
+      }
+      for(int st=0;st<STREAM_COUNT;++st){
+        if(st==MAPPED)
+          continue;
+        long written=0;
+        chrono::steady_clock::time_point start=chrono::steady_clock::now();
+        for(int i=0;i<repeats;++i)
+          written=writeWith((Stream)st,file,m,sc,form);
+        report(size,STREAM_NAMES[st],form.name,"write",data.size(),count,repeats,chrono::duration<double>(chrono::steady_clock::now()-start).count());
+        if(written!=(long)data.size()){
+          cout<<"the level written was a different size"<<endl;
+          failures++;
+        }
+      }
+    }
+  }
+  remove(file.c_str());
+
+  if(failures)
+    cout<<failures<<" reads or writes didn't give back the level"<<endl;
+  return failures?1:0;
+}
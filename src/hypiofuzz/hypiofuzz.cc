@@ -0,0 +1,319 @@
+/**
+ * @file hypiofuzz.cc
+ * @brief Fuzz harness for reading levels through hypio
+ *
+ * Usage: hypiofuzz [-n iterations] [-r seed] [-t ms] [-o prefix] file...
+ *
+ * Each input is read as a level, a maze followed by a script, from memory and
+ * through a c++ stream. Whatever could be read is then checked:
+ * - both streams can read the same parts of it and give back the same level
+ * - writing the maze and reading it back gives the same maze, in the text and
+ *   binary forms and with the cells as numbers and compressed
+ * - writing the script and reading it back writes exactly the same again, in
+ *   the text and binary forms
+ *
+ * Reading must never crash or take long, however broken the input. The files
+ * are tried as they are and then changed at random, with the sort of changes
+ * that break the counts and sizes in a level, for the given number of
+ * iterations. An input that fails a check is written to prefix-fail-N and one
+ * that takes longer than the time limit, 1000ms by default, to read to
+ * prefix-slow-N. The exit status is 1 if any were found. A small compressed
+ * maze can be very large once read, so the time limit is allowed again for
+ * every SLOW_CELLS cells of a maze that was read. Only the time spent on a maze
+ * that really was in the input is allowed for like this.
+ *
+ * When built with libFuzzer (the HYPIO_LIBFUZZER option) there is no main and
+ * libFuzzer calls LLVMFuzzerTestOneInput itself. Failed checks then abort so
+ * libFuzzer keeps the input.
+ */
+#include "../core/maze.hh"
+#include "../core/script.hh"
+#include "../shared/cpphypioimp.hh"
+#include "../shared/memoryhypioimp.hh"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <stdint.h>
+#include <chrono>
+#include <new>
+
+using namespace std;
+
+/// A level read from an input and what could be read of it
+struct Level{
+  bool mazeOk;///< if the maze was read
+  bool scriptOk;///< if the script was read
+  Maze m;///< the maze
+  Script sc;///< the script
+  /// Create a level with nothing read
+  Level():mazeOk(false),scriptOk(false),m(Vector(3,3,3)),sc(){};
+  /// Read a level
+  /**
+   * The script is only read if the maze was
+   * @param s the stream to read from
+   */
+  void read(HypIStream& s){
+    mazeOk=::read(s,m).ok;
+    if(mazeOk)
+      scriptOk=::read(s,sc).ok;
+  }
+};
+
+/// Write a maze to a string
+/**
+ * @param m the maze
+ * @param binary true for the binary form
+ * @param compressed true to compress the cells
+ * @return the text or data written
+ */
+static string format(const Maze& m,bool binary,bool compressed){
+  ostringstream os;
+  CPPHypOStream hos(os);
+  if(binary)
+    hos.setBinary();
+  write(hos,m,compressed);
+  return os.str();
+}
+
+/// Write a script to a string
+/**
+ * @param sc the script
+ * @param binary true for the binary form
+ * @return the text or data written
+ */
+static string format(const Script& sc,bool binary){
+  ostringstream os;
+  CPPHypOStream hos(os);
+  if(binary)
+    hos.setBinary();
+  write(hos,sc);
+  return os.str();
+}
+
+/// Describe why an input failed
+/**
+ * @param what the check that failed
+ * @return false
+ */
+static bool fail(const char* what){
+  cerr<<"check failed: "<<what<<endl;
+  return false;
+}
+
+/// Read an input and check everything read round trips
+/**
+ * @param data the input
+ * @param size the length of the input
+ * @param ms set to the time in milliseconds reading the input took, not counting the checks
+ * @param cells set to the number of cells in the maze read or 0 if no maze was read
+ * @return false if a check failed
+ */
+static bool check(const uint8_t* data,size_t size,double& ms,long long& cells){
+  chrono::steady_clock::time_point start=chrono::steady_clock::now();
+  Level mem;
+  {
+    MemoryHypIStream s((const char*)data,(int)size);
+    mem.read(s);
+  }
+  Level cpp;
+  {
+    istringstream is(string((const char*)data,size));
+    CPPHypIStream s(is);
+    cpp.read(s);
+  }
+  ms=chrono::duration<double,milli>(chrono::steady_clock::now()-start).count();
+  cells=mem.mazeOk?(long long)mem.m.size().X*mem.m.size().Y*mem.m.size().Z:0;
+  if(mem.mazeOk!=cpp.mazeOk || mem.scriptOk!=cpp.scriptOk)
+    return fail("the streams didn't agree on what could be read");
+  if(!mem.mazeOk)
+    return true;
+
+  string text=format(mem.m,false,false);
+  if(format(cpp.m,false,false)!=text)
+    return fail("the c++ stream read a different maze");
+  for(int f=0;f<4;++f){
+    bool binary=f&1;
+    bool compressed=f&2;
+    string out=format(mem.m,binary,compressed);
+    Level back;
+    MemoryHypIStream s(out.data(),out.size());
+    back.read(s);
+    if(!back.mazeOk)
+      return fail("a maze that was written couldn't be read");
+    // the compressed form only keeps the walls
+    if(format(back.m,binary,compressed)!=out)
+      return fail("a maze read back was different");
+  }
+
+  if(!mem.scriptOk)
+    return true;
+  string script=format(mem.sc,false);
+  if(format(cpp.sc,false)!=script)
+    return fail("the c++ stream read a different script");
+  for(int binary=0;binary<2;++binary){
+    string out=format(mem.sc,binary);
+    Script back;
+    MemoryHypIStream s(out.data(),out.size());
+    if(!read(s,back).ok)
+      return fail("a script that was written couldn't be read");
+    if(format(back,binary)!=out || format(back,false)!=script)
+      return fail("a script read back was different");
+  }
+  return true;
+}
+
+/// Entry point for libFuzzer
+/**
+ * @param data the input
+ * @param size the length of the input
+ * @return 0
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data,size_t size){
+  double ms;
+  long long cells;
+  if(!check(data,size,ms,cells))
+    abort();
+  return 0;
+}
+
+#ifndef HYPIO_LIBFUZZER
+
+/// The number of cells of a maze that was read that the time limit is allowed again for
+const long long SLOW_CELLS=1<<20;
+
+/// Numbers that are likely to break counts and sizes
+const char* const INTERESTING[]={"0","-1","1","3","-3","255","65536","1000000","-2147483648","2147483647","1073741824"};
+/// The number of entries in INTERESTING
+const int INTERESTING_COUNT=sizeof(INTERESTING)/sizeof(INTERESTING[0]);
+
+/// Change an input at random
+/**
+ * Most changes are to the numbers in the text form as those are the counts and
+ * sizes, but bytes are also changed, added, removed and copied for the binary
+ * form and the strings.
+ * @param in the input to change
+ * @return the changed input
+ */
+static string mutate(const string& in){
+  string out=in;
+  int changes=1+rand()%4;
+  for(int c=0;c<changes;++c){
+    size_t pos=out.empty()?0:rand()%out.size();
+    switch(rand()%6){
+      case 0:
+      case 1:{
+        // replace a number with one likely to break a count
+        size_t start=pos;
+        while(start<out.size() && !(isdigit((unsigned char)out[start]) || out[start]=='-'))
+          ++start;
+        size_t end=start;
+        while(end<out.size() && (isdigit((unsigned char)out[end]) || out[end]=='-'))
+          ++end;
+        out.replace(start,end-start,INTERESTING[rand()%INTERESTING_COUNT]);
+        break;
+      }
+      case 2:
+        if(!out.empty())
+          out[pos]^=1<<(rand()%8);
+        break;
+      case 3:
+        out.insert(pos,1,(char)(rand()%256));
+        break;
+      case 4:
+        if(!out.empty())
+          out.erase(pos,1+rand()%8);
+        break;
+      case 5:
+        if(!out.empty()){
+          // copy a piece of the input somewhere else to repeat structures
+          size_t from=rand()%out.size();
+          size_t len=1+rand()%64;
+          out.insert(pos,out.substr(from,len));
+        }
+        break;
+    }
+  }
+  return out;
+}
+
+/// Save an input that was found
+/**
+ * @param prefix the start of the file name
+ * @param kind what was found
+ * @param n the number of the input
+ * @param data the input
+ */
+static void save(const string& prefix,const char* kind,int n,const string& data){
+  ostringstream name;
+  name<<prefix<<"-"<<kind<<"-"<<n;
+  ofstream out(name.str().c_str(),ios::binary);
+  out.write(data.data(),data.size());
+  cerr<<"written to "<<name.str()<<endl;
+}
+
+int main(int argc,char** argv){
+  int iterations=10000;
+  unsigned int seed=1;
+  double limit=1000;
+  string prefix="hypiofuzz";
+  vector<string> corpus;
+  for(int i=1;i<argc;++i){
+    string arg=argv[i];
+    if(i+1<argc && arg=="-n")
+      iterations=atoi(argv[++i]);
+    else if(i+1<argc && arg=="-r")
+      seed=atoi(argv[++i]);
+    else if(i+1<argc && arg=="-t")
+      limit=atof(argv[++i]);
+    else if(i+1<argc && arg=="-o")
+      prefix=argv[++i];
+    else if(arg.size()>0 && arg[0]!='-'){
+      ifstream in(argv[i],ios::binary);
+      if(!in){
+        cerr<<"Can't open "<<argv[i]<<endl;
+        return 2;
+      }
+      ostringstream data;
+      data<<in.rdbuf();
+      corpus.push_back(data.str());
+    }else{
+      cerr<<"Usage: "<<argv[0]<<" [-n iterations] [-r seed] [-t ms] [-o prefix] file..."<<endl;
+      return 2;
+    }
+  }
+  if(corpus.empty())
+    corpus.push_back("");
+  srand(seed);
+
+  int failures=0;
+  int slow=0;
+  double slowest=0;
+  int total=corpus.size()+(iterations>0?iterations:0);
+  for(int i=0;i<total;++i){
+    string input=i<(int)corpus.size()?corpus[i]:mutate(corpus[rand()%corpus.size()]);
+    double ms=0;
+    long long cells=0;
+    bool ok;
+    try{
+      ok=check((const uint8_t*)input.data(),input.size(),ms,cells);
+    }catch(bad_alloc&){
+      ok=fail("reading tried to use too much memory");
+    }
+    if(ms>slowest)
+      slowest=ms;
+    if(!ok)
+      save(prefix,"fail",failures++,input);
+    if(ms>limit*(1+cells/SLOW_CELLS)){
+      cerr<<"input took "<<ms<<"ms"<<endl;
+      save(prefix,"slow",slow++,input);
+    }
+  }
+  cout<<total<<" inputs, "<<failures<<" failed, "<<slow<<" slow, slowest took "<<slowest<<"ms"<<endl;
+  return failures||slow?1:0;
+}
+
+#endif
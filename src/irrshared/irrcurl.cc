@@ -3,9 +3,14 @@
  * @brief Implementation of irrcurl.hh
  */
 #include "irrcurl.hh"
+#include "../core/levelpack.hh"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mutex>
+
+/// Held while using the level pack cache as levels can be loaded from other threads
+static std::mutex openmutex;
 
 #ifdef USE_CURL
 #include <curl/curl.h>
@@ -48,7 +53,28 @@ irr::io::IReadFile* createAndOpenURL(irr::io::IFileSystem* fs,const wchar_t* url
   irr::core::stringc urlc(url);
   return createAndOpenURL(fs,urlc.c_str());
 }
-irr::io::IReadFile* createAndOpenURL(irr::io::IFileSystem* fs,const char* url){
+/// Callback used to stop a download once it is cancelled
+/**
+ * @param clientp the flag that is set to cancel
+ * @return non zero to stop the download
+ */
+static int CancelCallback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+  const std::atomic<bool>* cancelled=(const std::atomic<bool>*)clientp;
+  return cancelled && *cancelled;
+}
+
+/// Download a url into memory
+/**
+ * @param url the url to download
+ * @param data set to the contents
+ * @param cancelled if not 0 the download stops when this is set
+ * @return false if nothing could be downloaded or it was cancelled
+ */
+static bool download(const char* url,std::vector<char>& data,const std::atomic<bool>* cancelled){
+  // curl_global_init isn't thread safe so it is only done once
+  static std::once_flag initialised;
+  std::call_once(initialised,curl_global_init,CURL_GLOBAL_ALL);
   CURL *curl_handle;
 
   struct MemoryStruct chunk;
@@ -56,8 +82,6 @@ irr::io::IReadFile* createAndOpenURL(irr::io::IFileSystem* fs,const char* url){
   chunk.memory = (char*)malloc(1);  /* will be grown as needed by the realloc above */
   chunk.size = 0;    /* no data at this point */
 
-  curl_global_init(CURL_GLOBAL_ALL);
-
   /* init the curl session */
   curl_handle = curl_easy_init();
 
@@ -74,31 +98,41 @@ irr::io::IReadFile* createAndOpenURL(irr::io::IFileSystem* fs,const char* url){
      field, so we provide one */
   curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, "libcurl-agent/1.0");
 
+  /* stop part way through if cancelled */
+  if(cancelled){
+    curl_easy_setopt(curl_handle, CURLOPT_XFERINFOFUNCTION, CancelCallback);
+    curl_easy_setopt(curl_handle, CURLOPT_XFERINFODATA, (void *)cancelled);
+    curl_easy_setopt(curl_handle, CURLOPT_NOPROGRESS, 0L);
+  }
+
   /* get it! */
-  curl_easy_perform(curl_handle);
+  CURLcode res=curl_easy_perform(curl_handle);
 
   /* cleanup curl stuff */
   curl_easy_cleanup(curl_handle);
 
-  irr::io::IReadFile* file=0;
-
+  bool ok=false;
   if(chunk.memory){
-    if(chunk.size>0){
-      char* data=new char[chunk.size];
-
-      memcpy(data, chunk.memory, chunk.size);
-
-      file=fs->createMemoryReadFile(data,chunk.size,url,true);
-    }
-
+    ok=res==CURLE_OK && chunk.size>0;
+    if(ok)
+      data.assign(chunk.memory,chunk.memory+chunk.size);
     free(chunk.memory);
   }
-  /* we're done with libcurl, so clean it up */
-  curl_global_cleanup();
+  return ok;
+}
 
-  return file;
+irr::io::IReadFile* createAndOpenURL(irr::io::IFileSystem* fs,const char* url){
+  std::vector<char> data;
+  if(!download(url,data,0))
+    return 0;
+  char* copy=new char[data.size()];
+  memcpy(copy,&data[0],data.size());
+  return fs->createMemoryReadFile(copy,data.size(),url,true);
 }
 #else
+static bool download(const char* url,std::vector<char>& data,const std::atomic<bool>* cancelled){
+  return false;
+}
 irr::io::IReadFile* createAndOpenURL(irr::io::IFileSystem* fs,const wchar_t* url){
   return 0;
 }
@@ -128,9 +162,57 @@ bool isurl(const char* url){
   return false;
 }
 
+/// Open a level in a level pack
+/**
+ * The last pack opened is kept so moving between the levels of a pack only reads
+ * or downloads it once. This can be used from more than one thread.
+ * @param fs the irrlicht filesystem to load using
+ * @param packurl the url of the pack
+ * @param name the name of the level
+ * @return an IReadFile to read the level using or 0 if the pack or level can't be
+ * opened or the level is corrupt
+ */
+static irr::io::IReadFile* createAndOpenPackLevel(irr::io::IFileSystem* fs,const char* packurl,const char* name){
+  static SPA<const char> lasturl;
+  static LevelPack lastpack;
+  std::unique_lock<std::mutex> lock(openmutex);
+  if(lasturl.isnull() || strcmp(&*lasturl,packurl)!=0){
+    lasturl=SPA<const char>();
+    // don't stop other threads using the cache while the pack is downloaded
+    lock.unlock();
+    irr::io::IReadFile* in=createAndOpen(fs,packurl);
+    if(!in)
+      return 0;
+    long len=in->getSize();
+    SPA<char> data(len>0?len:1);
+    bool ok=len>0 && in->read(&*data,len)==len;
+    in->drop();
+    lock.lock();
+    if(!ok || !lastpack.open(data,len))
+      return 0;
+    int urllen=strlen(packurl);
+    SPA<char> copy(urllen+1);
+    memcopy(copy,packurl,urllen+1);
+    lasturl=copy;
+  }
+  int i=lastpack.find(name);
+  if(i<0 || !lastpack.check(i))
+    return 0;
+  int len=lastpack[i].size;
+  char* level=new char[len];
+  memcpy(level,lastpack.level(i),len);
+  irr::core::stringc filename(packurl);
+  filename.append(LEVELPACK_SEPARATOR);
+  filename.append(name);
+  return fs->createMemoryReadFile(level,len,filename.c_str(),true);
+}
+
 irr::io::IReadFile* createAndOpen(irr::io::IFileSystem* fs,const char* url){
   if(!url)
     return 0;
+  SPA<const char> pack,name;
+  if(splitLevelPath(url,pack,name))
+    return createAndOpenPackLevel(fs,&*pack,&*name);
   if(isurl(url))
     return createAndOpenURL(fs,url);
   else{
@@ -142,8 +224,79 @@ irr::io::IReadFile* createAndOpen(irr::io::IFileSystem* fs,const char* url){
 irr::io::IReadFile* createAndOpen(irr::io::IFileSystem* fs,const wchar_t* url){
   if(!url)
     return 0;
+  irr::core::stringc urlc(url);
+  SPA<const char> pack,name;
+  if(splitLevelPath(urlc.c_str(),pack,name))
+    return createAndOpenPackLevel(fs,&*pack,&*name);
   if(isurl(url))
     return createAndOpenURL(fs,url);
   else
     return fs->createAndOpenFile(url);
 }
+
+std::string resolveURL(irr::io::IFileSystem* fs,const char* url){
+  if(!url)
+    return std::string();
+  SPA<const char> pack,name;
+  if(splitLevelPath(url,pack,name)){
+    std::string packpath=resolveURL(fs,&*pack);
+    if(packpath.empty())
+      return packpath;
+    return packpath+LEVELPACK_SEPARATOR+&*name;
+  }
+  if(isurl(url))
+    return url;
+  irr::core::stringw urlw(url);
+  irr::io::IReadFile* in=fs->createAndOpenFile(urlw.c_str());
+  if(!in)
+    return std::string();
+  irr::core::stringc found(in->getFileName());
+  in->drop();
+  return found.c_str();
+}
+
+/// Read a local file into memory
+/**
+ * @param path the path of the file
+ * @param data set to the contents
+ * @param cancelled if not 0 reading stops when this is set
+ * @return false if the file couldn't be read or it was cancelled
+ */
+static bool readFile(const char* path,std::vector<char>& data,const std::atomic<bool>* cancelled){
+  FILE* f=fopen(path,"rb");
+  if(!f)
+    return false;
+  data.clear();
+  char chunk[65536];
+  size_t l;
+  while(!(cancelled && *cancelled) && (l=fread(chunk,1,sizeof(chunk),f))>0)
+    data.insert(data.end(),chunk,chunk+l);
+  bool ok=!ferror(f) && !(cancelled && *cancelled) && !data.empty();
+  fclose(f);
+  return ok;
+}
+
+bool readURL(const char* url,std::vector<char>& data,const std::atomic<bool>* cancelled){
+  if(!url || !*url)
+    return false;
+  SPA<const char> pack,name;
+  if(splitLevelPath(url,pack,name)){
+    std::vector<char> packdata;
+    if(!readURL(&*pack,packdata,cancelled))
+      return false;
+    LevelPack lp;
+    int len=packdata.size();
+    SPA<char> copy(len);
+    memcopy(copy,&packdata[0],len);
+    if(!lp.open(copy,len))
+      return false;
+    int i=lp.find(&*name);
+    if(i<0 || !lp.check(i))
+      return false;
+    data.assign(lp.level(i),lp.level(i)+lp[i].size);
+    return true;
+  }
+  if(isurl(url))
+    return download(url,data,cancelled);
+  return readFile(url,data,cancelled);
+}
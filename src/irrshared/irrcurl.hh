@@ -3,9 +3,14 @@
  * @brief A set of functions to open files either using irrlicht or curl as appropriate
  */
 #include "irrlicht.h"
+#include <atomic>
+#include <string>
+#include <vector>
 
 /// Open a url using either curl of irrlicht filesystem as appropriate
 /**
+ * A url of the form pack.hmp#name opens the level with that name in a level pack
+ * (see LevelPack), the pack itself being loaded from a file or a url.
  * @param fs the irrlicht filesystem to load using
  * @param url the url to load
  * @return an IReadFile to read the file using
@@ -27,6 +32,8 @@ bool isurl(const wchar_t* url);
 
 /// Open a url using either curl of irrlicht filesystem as appropriate
 /**
+ * A url of the form pack.hmp#name opens the level with that name in a level pack
+ * (see LevelPack), the pack itself being loaded from a file or a url.
  * @param fs the irrlicht filesystem to load using
  * @param url the url to load
  * @return an IReadFile to read the file using
@@ -46,4 +53,25 @@ irr::io::IReadFile* createAndOpenURL(irr::io::IFileSystem* fs,const char* url);
  */
 bool isurl(const char* url);
 
-
+/// Find where a url will be read from so it can be read without irrlicht
+/**
+ * Local paths are looked up in the irrlicht filesystem, which includes the data
+ * folder, and the path of the file found is given. Urls are kept as they are and in
+ * level pack paths the path of the pack is looked up. This has to be called on the
+ * thread that uses fs.
+ * @param fs the irrlicht filesystem to look up local paths in
+ * @param url the url to look up
+ * @return the url to pass to readURL or an empty string if the file can't be found
+ */
+std::string resolveURL(irr::io::IFileSystem* fs,const char* url);
+/// Read the whole of a url without using irrlicht
+/**
+ * This can be used from any thread. Local files are read with stdio so a path has
+ * to be looked up with resolveURL first. Level packs are read whole rather than
+ * using the pack kept by createAndOpen.
+ * @param url the url to read
+ * @param data set to the contents
+ * @param cancelled if not 0 reading or downloading stops part way once this is set
+ * @return false if nothing could be read or it was cancelled
+ */
+bool readURL(const char* url,std::vector<char>& data,const std::atomic<bool>* cancelled);
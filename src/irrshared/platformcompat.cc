@@ -16,6 +16,7 @@
 #include "direct.h"
 #else
 #include "sys/stat.h"
+#include <cstdio>
 #endif
 
 #ifdef _IRR_WCHAR_FILESYSTEM
@@ -315,4 +316,16 @@ bool ishidden(irr::io::path folder, irr::io::path file){
     return file[0]==IRRSLIT('.');
   #endif
 }
+bool replaceFile(irr::io::path from, irr::io::path to){
+  #ifdef WIN32
+    return
+    #ifdef _IRR_WCHAR_FILESYSTEM
+      MoveFileExW(from.c_str(),to.c_str(),MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH)!=0;
+    #else
+      MoveFileExA(from.c_str(),to.c_str(),MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH)!=0;
+    #endif
+  #else
+    return rename(irr::core::stringc(from).c_str(),irr::core::stringc(to).c_str())==0;
+  #endif
+}
 
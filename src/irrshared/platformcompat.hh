@@ -51,6 +51,14 @@ bool samePath(irr::io::path path1, irr::io::path path2);
  * @return true if the file is a hidden file
  */
 bool ishidden(irr::io::path folder, irr::io::path file);
+/// Replace a file with another one in a single step
+/**
+ * If this fails both files are left as they were
+ * @param from the path of the file to move
+ * @param to the path of the file to replace
+ * @return true if the file was replaced
+ */
+bool replaceFile(irr::io::path from, irr::io::path to);
  
 
 #endif
@@ -0,0 +1,137 @@
+/**
+ * @file levelpack.cc
+ * @brief Make, list and extract level packs
+ *
+ * Usage:
+ * - levelpack -c pack level... makes a pack from the level files. Each level is
+ *   named after its file without the directory or extension.
+ * - levelpack -l pack lists the levels in a pack with their sizes and checks them.
+ * - levelpack -x pack name writes a level from a pack to standard output.
+ *
+ * A level in a pack can be opened in the game as pack#name, e.g.
+ * levels/tutorial.hmp#tutorial-2, including as the next level of another level.
+ * The exit status is 0 on success, 1 if a listed level is corrupt and 2 on an error.
+ */
+#include "../core/levelpack.hh"
+#include "../core/maze.hh"
+#include "../core/script.hh"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+/// Read a whole file
+/**
+ * @param filename the name of the file
+ * @param data set to the contents of the file
+ * @return true if it was read
+ */
+bool readFile(const char* filename,string& data){
+  ifstream is(filename,ios::in|ios::binary);
+  if(!is.is_open())
+    return false;
+  ostringstream os;
+  os<<is.rdbuf();
+  data=os.str();
+  return true;
+}
+
+/// Open a pack
+/**
+ * @param filename the name of the file
+ * @param pack the pack to open
+ * @return true if it was opened
+ */
+bool openPack(const char* filename,LevelPack& pack){
+  string data;
+  if(!readFile(filename,data)){
+    cerr<<"Can't open pack "<<filename<<endl;
+    return false;
+  }
+  SPA<char> copy(data.size());
+  memcopy(copy,data.data(),data.size());
+  if(!pack.open(copy,data.size())){
+    cerr<<filename<<" isn't a level pack"<<endl;
+    return false;
+  }
+  return true;
+}
+
+/// Get the name of a level from the name of its file
+/**
+ * @param filename the name of the file
+ * @return the name without the directory or extension
+ */
+string levelName(const string& filename){
+  string::size_type slash=filename.find_last_of("/\\");
+  string name=slash==string::npos?filename:filename.substr(slash+1);
+  string::size_type dot=name.rfind('.');
+  if(dot!=string::npos && dot>0)
+    name.erase(dot);
+  return name;
+}
+
+int main(int argc,char** argv){
+  string mode=argc>2?argv[1]:"";
+  if(mode=="-c" && argc>3){
+    LevelPackWriter writer;
+    for(int i=3;i<argc;++i){
+      string level;
+      if(!readFile(argv[i],level)){
+        cerr<<"Can't open level "<<argv[i]<<endl;
+        return 2;
+      }
+      string name=levelName(argv[i]);
+      if(!writer.add(name.c_str(),level.data(),level.size())){
+        cerr<<"Can't add "<<argv[i]<<" as "<<name<<". It isn't a valid level or the name is already used"<<endl;
+        return 2;
+      }
+    }
+    SPA<char> data;
+    int len;
+    if(!writer.write(data,len)){
+      cerr<<"Error making the pack"<<endl;
+      return 2;
+    }
+    ofstream os(argv[2],ios::out|ios::binary);
+    if(!os.write(&*data,len)){
+      cerr<<"Error writing "<<argv[2]<<endl;
+      return 2;
+    }
+    return 0;
+  }else if(mode=="-l" && argc==3){
+    LevelPack pack;
+    if(!openPack(argv[2],pack))
+      return 2;
+    bool corrupt=false;
+    for(int i=0;i<pack.levels();++i){
+      const LevelPackEntry& e=pack[i];
+      bool ok=pack.check(i);
+      corrupt|=!ok;
+      cout<<&*e.name<<": "<<e.dimensions.X<<"x"<<e.dimensions.Y<<"x"<<e.dimensions.Z<<", "<<e.size<<" bytes"
+          <<(ok?"":", corrupt")<<endl;
+    }
+    return corrupt?1:0;
+  }else if(mode=="-x" && argc==4){
+    LevelPack pack;
+    if(!openPack(argv[2],pack))
+      return 2;
+    int i=pack.find(argv[3]);
+    if(i<0){
+      cerr<<"No level "<<argv[3]<<" in "<<argv[2]<<endl;
+      return 2;
+    }
+    if(!pack.check(i)){
+      cerr<<"Level "<<argv[3]<<" is corrupt"<<endl;
+      return 2;
+    }
+    cout.write(pack.level(i),pack[i].size);
+    return 0;
+  }
+  cerr<<"Usage: "<<argv[0]<<" -c pack level..."<<endl;
+  cerr<<"       "<<argv[0]<<" -l pack"<<endl;
+  cerr<<"       "<<argv[0]<<" -x pack name"<<endl;
+  return 2;
+}
@@ -0,0 +1,305 @@
+/**
+ * @file replay.cc
+ * @brief Replay a recorded game against a level without any display
+ *
+ * Usage: replay [-n repeats] [-p] [-b milliseconds] level log
+ *
+ * The log is one written by the game when run with HYPERMAZE_RECORD set. The
+ * moves are fed back through StringPlay and the level's script exactly as the
+ * game does so the outcome can be checked after rule changes or to verify a
+ * solution. With -n the replay is repeated to benchmark the string engine.
+ * With -p a report of the cost of each event of the script is printed and with
+ * -b the level is rejected if any run of the script took longer than the budget.
+ * The exit status is 0 if the level was won, 1 if not, 2 on an error and 3 if
+ * the script went over the budget.
+ */
+#include "../core/maze.hh"
+#include "../core/script.hh"
+#include "../core/string.hh"
+#include "../core/movelog.hh"
+#include "../core/scriptprofile.hh"
+#include "../shared/cpphypioimp.hh"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <ctime>
+
+using namespace std;
+
+/// A level being replayed
+/**
+ * This follows the same steps as PuzzleDisplay for each notification so the
+ * script sees exactly what it saw when the log was recorded.
+ */
+class Replay{
+  public:
+    Maze m; ///< the maze
+    Script sc; ///< the level's script
+    SP<String> s; ///< the string
+    StringPlay sp; ///< the play used to make the moves
+    bool won; ///< if the level has been won
+    unsigned int wontime; ///< the time the level was won
+    int wonscore; ///< the score when the level was won
+    int moves; ///< the number of calls made on sp
+
+    /// Load a level
+    /**
+     * @param level the text of the level
+     * @param ok set to false if the level couldn't be read
+     */
+    Replay(const string& level,bool& ok):m(Vector(5,5,5)),sc(),s(new String(m)),sp(s),won(false),wontime(0),wonscore(0),moves(0){
+      istringstream is(level);
+      CPPHypIStream ihs(is);
+      ok=read(ihs,m).ok;
+      if(ok)
+        ok=read(ihs,sc).ok;
+    }
+
+    /// The level has been (re)started
+    void start(){
+      s=SP<String>(new String(m));
+      sp.SetString(s);
+      won=false;
+      ScriptResponseStart r=sc.runStart(s);
+      if(r.stringChanged||r.stringSelectionChanged)
+        sp.externalEditHappened();
+    }
+
+    /// The string has been won
+    /**
+     * @param now the time now
+     */
+    void win(unsigned int now){
+      ScriptResponseWin r=sc.runWin(s);
+      if(r.stringChanged||r.stringSelectionChanged)
+        sp.externalEditHappened();
+      if(r.block)
+        return;
+      won=true;
+      wontime=now;
+      wonscore=sp.getScore();
+    }
+
+    /// The string has been changed
+    /**
+     * @param now the time now
+     */
+    void stringUpdated(unsigned int now){
+      ScriptResponseMove r=sc.runMove(s);
+      if(r.stringChanged||r.stringSelectionChanged)
+        sp.externalEditHappened();
+      if((!won) && (s->hasWon()||r.forceWin))
+        win(now);
+    }
+
+    /// The selection has been changed
+    /**
+     * @param now the time now
+     */
+    void stringSelectionUpdated(unsigned int now){
+      ScriptResponseSelect r=sc.runSelect(s);
+      if(r.stringChanged||r.stringSelectionChanged)
+        sp.externalEditHappened();
+      if((!won) && r.forceWin)
+        win(now);
+    }
+
+    /// Replay a single event from a log
+    /**
+     * @param e the event
+     */
+    void run(const MoveLog::Event& e){
+      sc.setnow(e.time);
+      switch(e.op){
+        case MoveLog::START:
+          start();
+          return;
+        case MoveLog::UPDATED:
+          stringUpdated(e.time);
+          return;
+        case MoveLog::SELECTIONUPDATED:
+          stringSelectionUpdated(e.time);
+          return;
+        case MoveLog::MOVE:
+          sp.tryMove(e.d,e.flag);
+          break;
+        case MoveLog::MOVES:
+          sp.tryMoves(e.d,e.count,e.flag);
+          break;
+        case MoveLog::SLIDE:
+          sp.slide(e.flag,e.out);
+          break;
+        case MoveLog::SELECT:
+          {
+            // an index past the end can only come from a rule change so
+            // the call is just dropped
+            StringPointer p=s->begin();
+            for(int i=0;i<e.count && p!=s->end();++i)
+              ++p;
+            if(p!=s->end())
+              sp.setSelected(p,e.flag);
+          }
+          break;
+        case MoveLog::UNDO:
+          sp.undo(e.flag);
+          break;
+        case MoveLog::UNDOSTEPS:
+          sp.undoSteps(e.count,e.flag);
+          break;
+        case MoveLog::REDO:
+          sp.redo(e.flag);
+          break;
+        case MoveLog::EXTENDED:
+          sp.startExtendedMove();
+          break;
+        case MoveLog::JUMP:
+          sp.jumpTo(e.count);
+          break;
+        default:
+          return;
+      }
+      moves++;
+    }
+
+    /// Replay a whole log
+    /**
+     * @param log the log
+     * @return false if the log was corrupt
+     */
+    bool run(const MoveLog& log){
+      MoveLog::Reader r(log);
+      MoveLog::Event e;
+      bool started=false;
+      while(r.next(e)){
+        // logs always start with the level starting but be safe
+        if(!started && e.op!=MoveLog::START){
+          sc.setnow(e.time);
+          start();
+        }
+        started=true;
+        run(e);
+      }
+      return !r.failed();
+    }
+
+    /// Get a checksum of the current string to compare replays
+    /**
+     * @return the checksum
+     */
+    unsigned int checksum() const{
+      unsigned int h=2166136261u;
+      const String& t=*s;
+      for(ConstStringPointer p=t.begin();p!=t.end();++p){
+        int v[5]={p->pos.X,p->pos.Y,p->pos.Z,(int)to_id(p->d),p->selected};
+        for(int i=0;i<5;++i)
+          h=(h^v[i])*16777619u;
+      }
+      int v[3]={t.getEnd().X,t.getEnd().Y,t.getEnd().Z};
+      for(int i=0;i<3;++i)
+        h=(h^v[i])*16777619u;
+      return h;
+    }
+};
+
+/// Read a whole file
+/**
+ * @param filename the name of the file
+ * @param data set to the contents of the file
+ * @return true if it was read
+ */
+bool readFile(const char* filename,string& data){
+  ifstream is(filename,ios::in|ios::binary);
+  if(!is.is_open())
+    return false;
+  ostringstream os;
+  os<<is.rdbuf();
+  data=os.str();
+  return true;
+}
+
+int main(int argc,char** argv){
+  int repeats=1;
+  bool profiling=false;
+  double budget=-1;
+  int arg=1;
+  for(;arg<argc && argv[arg][0]=='-';++arg){
+    string opt=argv[arg];
+    if(arg+1<argc && opt=="-n"){
+      repeats=atoi(argv[++arg]);
+      if(repeats<1)
+        repeats=1;
+    }else if(opt=="-p")
+      profiling=true;
+    else if(arg+1<argc && opt=="-b")
+      budget=atof(argv[++arg]);
+    else
+      break;
+  }
+  if(argc-arg!=2){
+    cerr<<"Usage: "<<argv[0]<<" [-n repeats] [-p] [-b milliseconds] level log"<<endl;
+    return 2;
+  }
+
+  string level,logdata;
+  if(!readFile(argv[arg],level)){
+    cerr<<"Can't open level "<<argv[arg]<<endl;
+    return 2;
+  }
+  if(!readFile(argv[arg+1],logdata)){
+    cerr<<"Can't open log "<<argv[arg+1]<<endl;
+    return 2;
+  }
+  MoveLog log;
+  if(!log.load((const unsigned char*)logdata.data(),logdata.size())){
+    cerr<<argv[arg+1]<<" isn't a move log"<<endl;
+    return 2;
+  }
+
+  clock_t total=0;
+  bool won=false;
+  ScriptProfile profile;
+  for(int i=0;i<repeats;++i){
+    bool ok;
+    // load the level fresh each time as the script keeps state
+    Replay r(level,ok);
+    if(!ok){
+      cerr<<"Error reading level "<<argv[arg]<<endl;
+      return 2;
+    }
+    if(profiling || budget>=0)
+      r.sc.setProfile(&profile);
+    clock_t before=clock();
+    bool logok=r.run(log);
+    total+=clock()-before;
+    if(!logok){
+      cerr<<"Log "<<argv[arg+1]<<" is corrupt after "<<r.moves<<" moves"<<endl;
+      return 2;
+    }
+    if(i==0){
+      won=r.won;
+      cout<<"moves: "<<r.moves<<endl;
+      if(r.won)
+        cout<<"result: won at "<<r.wontime<<" with score "<<r.wonscore<<endl;
+      else
+        cout<<"result: not won"<<endl;
+      cout<<"final score: "<<r.sp.getScore()<<endl;
+      cout<<"final string: "<<hex<<r.checksum()<<dec<<endl;
+    }
+    if(i==repeats-1 && repeats>1){
+      double seconds=(double)total/CLOCKS_PER_SEC;
+      cout<<"replayed "<<repeats<<" times in "<<seconds<<"s";
+      if(seconds>0)
+        cout<<" ("<<r.moves*(double)repeats/seconds<<" moves/s)";
+      cout<<endl;
+    }
+  }
+  if(profiling)
+    cout<<profile.report();
+  if(budget>=0 && profile.getWorstRun()*1000.0/CLOCKS_PER_SEC>budget){
+    cout<<"over budget: worst script run "<<profile.getWorstRun()*1000.0/CLOCKS_PER_SEC<<"ms"<<endl;
+    return 3;
+  }
+  return won?0:1;
+}
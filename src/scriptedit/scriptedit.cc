@@ -1,11 +1,21 @@
 #include "../core/script.hh"
 #include "../core/scriptimpl.hh"
 #include "../shared/cpphypioimp.hh"
+#include "../shared/mappedhypioimp.hh"
 #include "../core/maze.hh"
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <climits>
 #include <cctype>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
 
 using namespace std;
 
@@ -498,6 +508,8 @@ bool edit(StringElementCondition& e){
     if(cin.eof())
       break;
   }
+  if(changed)
+    e.compile();
   return changed;
 }
 #undef MAKETERM
@@ -804,6 +816,10 @@ bool edit(ConditionStringPattern& a){
     if(cin.eof())
       break;
   }
+  if(changed){
+    a.sm.compile();
+    a.resetCache();
+  }
   return changed;
 }
 
@@ -1290,6 +1306,8 @@ bool edit(StringMatcher& sm){
     if(cin.eof())
       break;
   }
+  if(changed)
+    sm.compile();
   return changed;
 }
 
@@ -1678,7 +1696,10 @@ bool edit(Script& s){
           cin.ignore(100,'\n');
           cin>>n;
         }
-        changed|=edit(s.getevents()[n]);
+        if(edit(s.getevents()[n])){
+          s.reindex();
+          changed=true;
+        }
         break;
       }
       default: cout<<"invalid input \""<<c<<"\""<<endl;
@@ -1691,6 +1712,365 @@ bool edit(Script& s){
   return changed;
 }
 
+/// The most element tests a single run of a pattern should need before it is reported
+const double COST_LIMIT=1e6;
+
+/// Estimate the longest a string can be in a maze
+/**
+ * This assumes the string doesn't pass through the same place twice so it is the
+ * number of places in the area the string can move in, which is the maze plus 6
+ * either side in x and z.
+ * @param m the maze
+ * @return the most elements a string can have
+ */
+int maxStringLength(const Maze& m){
+  Vector size=m.size();
+  double n=(double)(size.X+13)*(size.Y+1)*(size.Z+13);
+  return n>INT_MAX?INT_MAX:(int)n;
+}
+
+/// Check if two lists of ranges are the same
+/**
+ * @param ac the number of ranges in the first list
+ * @param a the first list
+ * @param bc the number of ranges in the second list
+ * @param b the second list
+ * @return true if they have the same ranges in the same order
+ */
+bool sameRanges(int ac,const SPA<Range>& a,int bc,const SPA<Range>& b){
+  if(ac!=bc)
+    return false;
+  for(int i=0;i<ac;++i)
+    if(a[i].start!=b[i].start || a[i].end!=b[i].end)
+      return false;
+  return true;
+}
+
+/// Check if two element conditions are the same
+/**
+ * @param a the first condition
+ * @param b the second condition
+ * @return true if they are written the same way
+ */
+bool sameCondition(const StringElementCondition& a,const StringElementCondition& b){
+  int as=(a.selectionCondition&2)?2:(a.selectionCondition&1);
+  int bs=(b.selectionCondition&2)?2:(b.selectionCondition&1);
+  return as==bs && (a.dirnsCondition&ALLDIRNSMASK)==(b.dirnsCondition&ALLDIRNSMASK) &&
+      sameRanges(a.xrange_count,a.xrange,b.xrange_count,b.xrange) &&
+      sameRanges(a.yrange_count,a.yrange,b.yrange_count,b.yrange) &&
+      sameRanges(a.zrange_count,a.zrange,b.zrange_count,b.zrange);
+}
+
+/// Get the number of ways of splitting up to n string elements between k pattern elements
+/**
+ * @param n the number of string elements
+ * @param k the number of pattern elements
+ * @return the number of ways
+ */
+double splits(int n,int k){
+  double r=1;
+  for(int i=1;i<=k;++i)
+    r=r*(n+i)/i;
+  return r;
+}
+
+/// Write the worst case cost of matching a pattern and suggest cheaper equivalents
+/**
+ * A compiled pattern is matched by stepping through the string once with every
+ * instruction so it costs at most the size of the program times the length of the
+ * string. A pattern that isn't compiled is matched by backtracking which tries every
+ * way of splitting the string between a run of variable length elements that can
+ * match the same string elements, so a run of k of them costs about n^k.
+ * @param o the stream to write to
+ * @param where a description of where the pattern is used
+ * @param sm the pattern
+ * @param n the most elements the string can have
+ * @param repeats the most times the pattern is matched in one run of the action
+ * @return the number of problems found
+ */
+int analyse(ostream& o,const string& where,StringMatcher& sm,int n,double repeats=1){
+  int problems=0;
+  vector<string> advice;
+
+  // work out the size compile() needed so the reason it failed can be given
+  bool groupsok=true;
+  vector<bool> boundary(sm.count+1,false);
+  for(int i=0;i<sm.group_count;++i){
+    if(sm.groups[i].a<0 || sm.groups[i].a>=sm.count || sm.groups[i].b<0 || sm.groups[i].b>=sm.count){
+      groupsok=false;
+      continue;
+    }
+    boundary[sm.groups[i].a]=true;
+    boundary[sm.groups[i].b+1]=true;
+  }
+  double size=1;
+  if(boundary[sm.count])
+    size++;
+
+  bool never=false;
+  int run=0,longest=0,lastchoices=1;
+  double runcost=1,combos=1;
+  for(int i=0;i<sm.count;++i){
+    PatternTag& pt=sm.pattern[i].a;
+    StringElementCondition& c=sm.pattern[i].b;
+    int min=pt.min<0?0:pt.min;
+    int max=pt.max<min?min:pt.max;
+    if(boundary[i])
+      size++;
+    size+=min+(max==INT_MAX?3:2.0*(max-min));
+
+    ostringstream a;
+    if(min>0 && c.matchesNothing()){
+      a<<"element "<<i<<" can't match any string element so the pattern never matches";
+      never=true;
+    }else if(min>n){
+      a<<"element "<<i<<" needs at least "<<min<<" string elements but no string in this maze is longer than "<<n<<
+          " so the pattern never matches";
+      never=true;
+    }else if(max!=INT_MAX && max>n)
+      a<<"element "<<i<<" has a maximum of "<<max<<" which is more than the longest string ("<<n<<
+          ") so it can be * (no limit) which is "<<2.0*(max-min)-3<<" instructions smaller";
+    if(a.str().size())
+      advice.push_back(a.str());
+
+    if(max==min || max==0){
+      run=0;
+      continue;
+    }
+    // variable length elements next to each other that can match the same string
+    // elements can split the string between them in many ways
+    int choices=(max>n?n:max)-min+1;
+    if(run>0 && c.overlaps(sm.pattern[i-1].b)){
+      run++;
+      runcost=runcost*lastchoices;
+      double bound=splits(n,run-1);
+      if(runcost>bound)
+        runcost=bound;
+      PatternTag& prev=sm.pattern[i-1].a;
+      if(!boundary[i] && prev.greedy==pt.greedy && sameCondition(c,sm.pattern[i-1].b)){
+        ostringstream m;
+        int pmin=prev.min<0?0:prev.min;
+        m<<"elements "<<i-1<<" and "<<i<<" have the same condition so can be merged into one of "<<pmin+min<<"-";
+        if(max==INT_MAX || prev.max==INT_MAX || (double)prev.max+max>n)
+          m<<"*";
+        else
+          m<<prev.max+max;
+        m<<" elements";
+        advice.push_back(m.str());
+      }
+    }else{
+      if(run>0)
+        combos*=runcost;
+      // a single element can only match one way as the next one can't match its elements
+      run=1;
+      runcost=1;
+    }
+    lastchoices=choices;
+    if(run>longest)
+      longest=run;
+  }
+  if(run>0)
+    combos*=runcost;
+
+  o<<where<<": ";
+  if(sm.programSize()>0){
+    o<<"compiled to "<<sm.programSize()<<" instructions, at most "<<sm.programSize()*(double)n*repeats<<" element tests (linear)"<<endl;
+  }else{
+    o<<"not compiled (";
+    if(!groupsok)
+      o<<"a group is outside the pattern";
+    else if(sm.count==0)
+      o<<"empty pattern";
+    else
+      o<<"about "<<size<<" instructions is too large";
+    o<<"), backtracking";
+    if(longest>1)
+      o<<" through "<<longest<<" variable length elements in a row that can match the same string elements";
+    double cost=combos*n*repeats;
+    o<<", about "<<cost<<" element tests";
+    if(longest>2)
+      o<<" (exponential in the pattern length)";
+    else if(longest==2)
+      o<<" (quadratic)";
+    else
+      o<<" (linear)";
+    o<<endl;
+    if(longest>2 || cost>COST_LIMIT){
+      o<<"  warning: this pattern can take too long to match"<<endl;
+      problems++;
+    }
+    if(groupsok && size>1)
+      advice.push_back("a pattern of at most 4096 instructions is compiled and matched in linear time");
+  }
+  if(never){
+    o<<"  warning: this pattern can never match"<<endl;
+    problems++;
+  }
+  for(unsigned int i=0;i<advice.size();++i)
+    o<<"  suggestion: "<<advice[i]<<endl;
+  return problems;
+}
+
+/// Write the worst case cost of the patterns in a condition
+/**
+ * @param o the stream to write to
+ * @param where a description of where the condition is used
+ * @param c the condition
+ * @param n the most elements the string can have
+ * @return the number of problems found
+ */
+int analyse(ostream& o,const string& where,SP<Condition> c,int n){
+  if(c.isnull())
+    return 0;
+  int problems=0;
+  switch(c->getid()){
+    case ConditionOr::id:{
+      ConditionOr& e=(ConditionOr&)*c;
+      for(int i=0;i<e.count;++i)
+        problems+=analyse(o,where,e.conditions[i],n);
+      break;
+    }
+    case ConditionAnd::id:{
+      ConditionAnd& e=(ConditionAnd&)*c;
+      for(int i=0;i<e.count;++i)
+        problems+=analyse(o,where,e.conditions[i],n);
+      break;
+    }
+    case ConditionNot::id:
+      problems+=analyse(o,where,((ConditionNot&)*c).condition,n);
+      break;
+    case ConditionStringPattern::id:
+      problems+=analyse(o,where+" condition pattern",((ConditionStringPattern&)*c).sm,n);
+      break;
+  }
+  return problems;
+}
+
+/// Write the worst case cost of the patterns in an action
+/**
+ * @param o the stream to write to
+ * @param where a description of where the action is used
+ * @param a the action
+ * @param n the most elements the string can have
+ * @return the number of problems found
+ */
+int analyse(ostream& o,const string& where,SP<Action> a,int n){
+  if(a.isnull())
+    return 0;
+  int problems=0;
+  switch(a->getid()){
+    case ActionMulti::id:{
+      ActionMulti& e=(ActionMulti&)*a;
+      for(int i=0;i<e.num;++i)
+        problems+=analyse(o,where,e.actions[i],n);
+      break;
+    }
+    case ActionSetStringRoute::id:{
+      ActionSetStringRoute& e=(ActionSetStringRoute&)*a;
+      if(!e.all)
+        problems+=analyse(o,where+" route pattern",e.ranges,n);
+      else if(e.singlePass())
+        problems+=analyse(o,where+" route pattern (all matches in one pass)",e.ranges,n);
+      else{
+        // the pattern is matched from the start again after every change
+        problems+=analyse(o,where+" route pattern (all matches, rematched after each change)",e.ranges,n,n);
+        o<<"  suggestion: anything, then a fixed length group with no location conditions, then anything "
+            "is set in one pass"<<endl;
+      }
+      break;
+    }
+  }
+  return problems;
+}
+
+/// Write the worst case cost of the patterns in a script
+/**
+ * @param o the stream to write to
+ * @param s the script
+ * @param m the maze the script is for
+ * @return the number of problems found
+ */
+int analyse(ostream& o,const Script& s,const Maze& m){
+  int n=maxStringLength(m);
+  o<<"strings in this maze have at most "<<n<<" elements"<<endl;
+  int problems=0;
+  for(int i=0;i<s.geteventcount();++i){
+    ostringstream where;
+    where<<"event "<<i;
+    const Event& e=s.getevents()[i];
+    problems+=analyse(o,where.str(),e.condition,n);
+    problems+=analyse(o,where.str(),e.action,n);
+  }
+  return problems;
+}
+
+/// Analyse the script of a level file
+/**
+ * @param filename the level file
+ * @return the number of problems found, counting not being able to read it as one
+ */
+int lint(const string& filename){
+  cout<<filename<<":"<<endl;
+  MappedHypIStream ihs(filename.c_str());
+  if(!ihs.isOpen()){
+    cout<<"  error: can't open file"<<endl;
+    return 1;
+  }
+  Maze m(Vector(0,0,0));
+  Script s;
+  if(!read(ihs,m).ok || !read(ihs,s).ok){
+    cout<<"  error: can't read level"<<endl;
+    return 1;
+  }
+  return analyse(cout,s,m);
+}
+
+/// Check if a file name has an extension
+/**
+ * @param name the file name
+ * @param ext the extension including the dot
+ * @return true if name ends with ext
+ */
+bool hasExtension(const string& name,const char* ext){
+  size_t l=strlen(ext);
+  return name.size()>l && name.compare(name.size()-l,l,ext)==0;
+}
+
+/// Get the level files in a directory
+/**
+ * @param dir the directory
+ * @param files the paths of the files ending in .hml or .hmb are added to this in order
+ * @return false if it isn't a directory that can be read
+ */
+bool listLevels(const string& dir,vector<string>& files){
+  vector<string> names;
+#ifdef _WIN32
+  _finddata_t f;
+  intptr_t h=_findfirst((dir+"/*.hm?").c_str(),&f);
+  if(h==-1)
+    return false;
+  do
+    if(hasExtension(f.name,".hml") || hasExtension(f.name,".hmb"))
+      names.push_back(f.name);
+  while(_findnext(h,&f)==0);
+  _findclose(h);
+#else
+  DIR* d=opendir(dir.c_str());
+  if(!d)
+    return false;
+  while(dirent* e=readdir(d)){
+    string name=e->d_name;
+    if(hasExtension(name,".hml") || hasExtension(name,".hmb"))
+      names.push_back(name);
+  }
+  closedir(d);
+#endif
+  sort(names.begin(),names.end());
+  for(unsigned int i=0;i<names.size();++i)
+    files.push_back(dir+"/"+names[i]);
+  return true;
+}
+
 void edit(){
   char c='p';
   Maze m(Vector(0,0,0));
@@ -1717,12 +2097,11 @@ void edit(){
         cin.ignore(100,'\n');
         cin.getline(fname,256);
         cout<<"opening "<<fname<<endl;
-        ifstream is(fname);
-        if(!is.is_open()){
+        MappedHypIStream ihs(fname);
+        if(!ihs.isOpen()){
           cout<<"error opening file"<<endl;
           break;
         }
-        CPPHypIStream ihs(is);
         read(ihs,m);
         read(ihs,s);
         changed=false;
@@ -1756,12 +2135,15 @@ void edit(){
           delete[] tmp;
         }
         cout<<"saving to "<<fname<<endl;
-        ofstream os(fname);
+        ofstream os(fname,ios::out|ios::binary);
         if(!os.is_open()){
           cout<<"error opening file"<<endl;
           break;
         }
         CPPHypOStream ohs(os);
+        // .hmb is the binary form of a level
+        if(hasExtension(fname,".hmb"))
+          ohs.setBinary();
         write(ohs,m);
         ohs.setNextSpace("\n");
         write(ohs,s);
@@ -1772,6 +2154,11 @@ void edit(){
       case 'e':
         changed|=edit(s);
         break;
+      case 'a':{
+        int problems=analyse(cout,s,m);
+        cout<<problems<<" problem"<<(problems==1?"":"s")<<" found"<<endl;
+        break;
+      }
       case 'd':
         if(changed){
           cout<<"The current script has unsaved changes. Are you sure you want to exit? (y/n) ";
@@ -1786,13 +2173,31 @@ void edit(){
         return;
       default: cout<<"invalid input \""<<c<<"\""<<endl;
     }
-    cout<<"What would you like to do?"<<endl<<"p) Print the current Script"<<endl<<"l) Load a script from file"<<endl<<"n) Create a new empty script"<<endl<<"s) Save the current script"<<endl<<"e) Edit the current script"<<endl<<"d) Done with editing"<<endl<<": ";
+    cout<<"What would you like to do?"<<endl<<"p) Print the current Script"<<endl<<"l) Load a script from file"<<endl<<"n) Create a new empty script"<<endl<<"s) Save the current script"<<endl<<"e) Edit the current script"<<endl<<"a) Analyse the worst case cost of the patterns"<<endl<<"d) Done with editing"<<endl<<": ";
     cin>>c;
     if(cin.eof())
       break;
   }
 }
 
-int main(){
-  edit();
+int main(int argc,char** argv){
+  if(argc==1){
+    edit();
+    return 0;
+  }
+  // batch mode to check the scripts of many levels at once
+  if(argc<3 || string(argv[1])!="--lint"){
+    cerr<<"Usage: "<<argv[0]<<" [--lint level-or-directory...]"<<endl;
+    return 2;
+  }
+  int problems=0;
+  for(int i=2;i<argc;++i){
+    vector<string> files;
+    if(!listLevels(argv[i],files))
+      files.push_back(argv[i]);
+    for(unsigned int j=0;j<files.size();++j)
+      problems+=lint(files[j]);
+  }
+  cout<<problems<<" problem"<<(problems==1?"":"s")<<" found"<<endl;
+  return problems?1:0;
 }
@@ -6,6 +6,12 @@
 #include <cstdlib>
 #include <cstring>
 
+// SSE2 is always there on x86-64 so only a scalar build needs to be asked for
+#if !defined(HYPIO_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2))
+#define HYPIO_SSE2
+#include <emmintrin.h>
+#endif
+
 BufHypIStream::BufHypIStream():len(255),buf(new char[len+1]),start(0),end(0),eof(false){}
 
 BufHypIStream::~BufHypIStream(){
@@ -13,64 +19,346 @@ BufHypIStream::~BufHypIStream(){
 }
 
 void BufHypIStream::consumewhitespace(){
-  if(start>=end)
-    if(eof)
+  for(;;){
+    while(start<end && HypIStream::isspace(buf[start]))
+      ++start;
+    if(start<end || eof)
       return;
-    else
-      readtobuf();
-  while(HypIStream::isspace(buf[start])){
-    if(++start>=end){
-      if(eof)
-        return;
-      else
+    readtobuf();
+  }
+}
+void BufHypIStream::detectFormat(){
+  format=TEXT;
+  while(end-start<HYPIO_BINARY_MAGIC_LEN && !eof)
+    readtobuf();
+  if(end-start<HYPIO_BINARY_MAGIC_LEN || memcmp(buf+start,HYPIO_BINARY_MAGIC,HYPIO_BINARY_MAGIC_LEN)!=0)
+    return;
+  start+=HYPIO_BINARY_MAGIC_LEN;
+  unsigned int version;
+  if(readVarint(version).ok && version<=(unsigned int)HYPIO_BINARY_VERSION)
+    format=BINARY;
+  else
+    format=UNSUPPORTED;
+}
+IOResult BufHypIStream::readVarint(unsigned int& u){
+  u=0;
+  // an int never needs more than 5 bytes
+  for(int shift=0;shift<35;shift+=7){
+    if(start>=end){
+      if(!eof)
         readtobuf();
+      if(start>=end)
+        return IOResult(false,true);
     }
+    unsigned char c=buf[start++];
+    u|=(unsigned int)(c&0x7f)<<shift;
+    if(!(c&0x80))
+      return IOResult(true,start==end);
   }
+  return IOResult(false,start==end);
 }
-IOResult BufHypIStream::read(int& i,const int& base){
-  consumewhitespace();//ensure first char is not whitespace so can check if anything was parsed
-  char* rend=0;
-  long l=strtol(buf+start,&rend,base);
-  while(rend>=buf+end && !eof){//try reading more data
-    readtobuf();
-    l=strtol(buf+start,&rend,base);//try again with more data
+/// The class of a character that isn't a digit or whitespace
+const unsigned char CHAR_OTHER=36;
+/// The class of a whitespace character
+const unsigned char CHAR_SPACE=37;
+
+/// A table of the class of each character for parsing integers
+/**
+ * Digits in any base up to 36 have their value as their class. Looking this up is
+ * much faster than a chain of comparisons for each character.
+ */
+struct CharClasses{
+  unsigned char c[256];///<the class of each character
+  /// Fill in the table
+  CharClasses(){
+    for(int i=0;i<256;++i){
+      if(HypIStream::isspace((char)i))
+        c[i]=CHAR_SPACE;
+      else if(i>='0' && i<='9')
+        c[i]=i-'0';
+      else if(i>='a' && i<='z')
+        c[i]=i-'a'+10;
+      else if(i>='A' && i<='Z')
+        c[i]=i-'A'+10;
+      else
+        c[i]=CHAR_OTHER;
+    }
+  }
+};
+/// The classes of all the characters
+static const CharClasses charClasses;
+
+/// Get the class of a character
+/**
+ * @param c the character
+ * @return the value of the digit, CHAR_OTHER or CHAR_SPACE
+ */
+static inline int charClass(char c){
+  return charClasses.c[(unsigned char)c];
+}
+
+/// Parse a whole token as an integer
+/**
+ * This gives the same result as strtol followed by a cast to int, except that the
+ * token must be used up completely and * and -* are the largest and smallest ints.
+ * Unlike strtol it stops at the end of the token so the buffer doesn't need to be
+ * terminated.
+ * @param p the start of the token
+ * @param e the end of the token
+ * @param base the base, 0 to use the prefix to decide
+ * @param i set to the value
+ * @return false if the token isn't a valid integer
+ */
+static bool parseInt(const char* p,const char* e,int base,int& i){
+  bool neg=false;
+  if(p<e && (*p=='-' || *p=='+')){
+    neg=*p=='-';
+    if(e-p==2 && p[1]=='*' && neg){
+      i=INT_MIN;
+      return true;
+    }
+    ++p;
+  }else if(e-p==1 && *p=='*'){
+    i=INT_MAX;
+    return true;
   }
-  //must have used something
-  if(rend==buf+start){
-    bool neg=false;
-    if(*rend=='-'){
-      neg=true;
-      ++rend;
+  // a prefix is only used if there is a digit after it
+  if((base==0 || base==16) && e-p>2 && p[0]=='0' && (p[1]=='x' || p[1]=='X') && charClass(p[2])<16){
+    base=16;
+    p+=2;
+  }else if(base==0)
+    base=(p<e && *p=='0')?8:10;
+  if(p>=e)
+    return false;
+  // strtol saturates at the limits of long before the cast
+  unsigned long limit=neg?(unsigned long)LONG_MAX+1:(unsigned long)LONG_MAX;
+  unsigned long v=0;
+  bool over=false;
+  for(;p<e;++p){
+    int d=charClass(*p);
+    if(d>=base)
+      return false;
+    // the division is only needed near the limit as the base is at most 36
+    if(!over){
+      if(v>(limit>>6) && v>(limit-d)/base)
+        over=true;
+      else
+        v=v*base+d;
     }
-    if(!(*rend=='*'))
-      return IOResult(false,rend==buf+end);
-    ++rend;
-    if(neg)
-      l=INT_MIN;
-    else
-      l=INT_MAX;
   }
-  start=rend-buf;
-  //must either be at end of file or have whitespace after the number
-  if(! (start>=end || HypIStream::isspace(*rend)) )
-    return IOResult(false,start==end);
-  i=(int)l;//cast. Am just going to force the cast for now may add checks later
+  if(over)
+    v=limit;
+  i=(int)(neg?(long)(0-v):(long)v);
+  return true;
+}
+
+#ifdef HYPIO_SSE2
+/// Get the position of the lowest set bit
+/**
+ * @param x the bits which mustn't all be 0
+ * @return the position of the lowest set bit
+ */
+static inline int lowestBit(unsigned int x){
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward(&i,x);
+  return i;
+#else
+  return __builtin_ctz(x);
+#endif
+}
+
+/// Parse whitespace separated hex numbers 16 characters at a time
+/**
+ * Each block of 16 characters is classified and turned into digit values with SSE2 and
+ * the numbers that end inside the block are put together from the values. This stops
+ * at anything that isn't a hex digit or whitespace, such as a prefix, a sign or *, at a
+ * number of more than 7 digits or when fewer than 16 characters are left, so the
+ * general parser can take over with exactly the same results.
+ * @param p the buffer
+ * @param b the position to start at. This is moved past the numbers parsed
+ * @param end the end of the data in the buffer
+ * @param dst where to store the numbers
+ * @param n the most numbers to parse
+ * @return the number of numbers parsed
+ */
+static int parseHexBlocks(const char* p,int& b,int end,int* dst,int n){
+  const __m128i before0=_mm_set1_epi8('0'-1);
+  const __m128i after9=_mm_set1_epi8('9'+1);
+  const __m128i beforea=_mm_set1_epi8('a'-1);
+  const __m128i afterf=_mm_set1_epi8('f'+1);
+  const __m128i beforetab=_mm_set1_epi8('\t'-1);
+  const __m128i aftercr=_mm_set1_epi8('\r'+1);
+  const __m128i space=_mm_set1_epi8(' ');
+  const __m128i lowercase=_mm_set1_epi8(0x20);
+  const __m128i zero=_mm_set1_epi8('0');
+  const __m128i a10=_mm_set1_epi8('a'-10);
+  unsigned char values[16];
+  int k=0;
+  while(k<n && end-b>=16){
+    __m128i c=_mm_loadu_si128((const __m128i*)(p+b));
+    // bytes from 128 up are negative so they fail all the range checks
+    __m128i digit=_mm_and_si128(_mm_cmpgt_epi8(c,before0),_mm_cmplt_epi8(c,after9));
+    __m128i lower=_mm_or_si128(c,lowercase);
+    __m128i letter=_mm_and_si128(_mm_cmpgt_epi8(lower,beforea),_mm_cmplt_epi8(lower,afterf));
+    __m128i white=_mm_or_si128(_mm_cmpeq_epi8(c,space),_mm_and_si128(_mm_cmpgt_epi8(c,beforetab),_mm_cmplt_epi8(c,aftercr)));
+    int spaces=_mm_movemask_epi8(white);
+    int valid=spaces|_mm_movemask_epi8(_mm_or_si128(digit,letter));
+    __m128i v=_mm_or_si128(_mm_and_si128(digit,_mm_sub_epi8(c,zero)),_mm_andnot_si128(digit,_mm_sub_epi8(lower,a10)));
+    _mm_storeu_si128((__m128i*)values,v);
+
+    // only look up to the first character that isn't allowed
+    unsigned int seen=~valid&0xffff?((~valid&0xffff)&-(~valid&0xffff))-1:0xffff;
+    unsigned int ends=spaces&seen;
+    unsigned int starts=~spaces&seen;
+    int i=0;
+    while(k<n && starts){
+      i=lowestBit(starts);
+      unsigned int after=ends&~((1u<<i)-1);
+      // the number carries on past what can be seen
+      if(!after)
+        break;
+      int e=lowestBit(after);
+      if(e-i>7){
+        b+=i;
+        return k;
+      }
+      int x=0;
+      for(int j=i;j<e;++j)
+        x=(x<<4)|values[j];
+      dst[k++]=x;
+      starts&=~((1u<<e)-1);
+      i=e;
+    }
+    // carry on from the start of the number that didn't fit or skip the whitespace
+    if(!starts && k<n)
+      i=lowestBit(~seen|0x10000);
+    if(i==0)
+      break;
+    b+=i;
+  }
+  return k;
+}
+#endif
+
+IOResult BufHypIStream::read(int& i,const int& base){
+  return BufHypIStream::read(&i,1,base);
+}
+
+IOResult BufHypIStream::read(int* dst,int n,const int& base){
+  if(format==UNKNOWN)
+    detectFormat();
+  if(format==BINARY){
+    for(int k=0;k<n;++k){
+      unsigned int u;
+      IOResult r=readVarint(u);
+      if(!r.ok)
+        return r;
+      dst[k]=zigzagDecode(u);
+    }
+    return IOResult(true,start==end);
+  }else if(format==UNSUPPORTED)
+    return IOResult(false,false);
+  for(int k=0;k<n;++k){
+#ifdef HYPIO_SSE2
+    // maze cells are long runs of small hex numbers
+    if(base==16){
+      k+=parseHexBlocks(buf,start,end,dst+k,n-k);
+      if(k>=n)
+        break;
+    }
+#endif
+    // work on copies of the positions as the compiler can't tell dst doesn't point into this
+    int b=start;
+    for(;;){
+      const char* p=buf;
+      int last=end;
+      while(b<last && charClass(p[b])==CHAR_SPACE)
+        ++b;
+      if(b<last || eof)
+        break;
+      start=b;
+      readtobuf();
+      b=start;
+    }
+    // find the end of the number reading more data if it runs to the end of the buffer
+    int e=b;
+    for(;;){
+      const char* p=buf;
+      int last=end;
+      while(e<last && charClass(p[e])!=CHAR_SPACE)
+        ++e;
+      if(e<last || eof)
+        break;
+      // reading may move the data to the start of the buffer
+      start=b;
+      e-=b;
+      readtobuf();
+      b=start;
+      e+=b;
+    }
+    start=b;
+    // only an empty token or a lone minus sign can fail at the end of the data
+    if(!parseInt(buf+b,buf+e,base,dst[k]))
+      return IOResult(false,e==end && (e==b || (e-b==1 && buf[b]=='-')));
+    start=e;
+  }
   return IOResult(true,start==end);
-};
-void BufHypIStream::mergebufs(SPA<char>& addto,int& tolen,char const* const& addfrom,int& fromstart,int& fromlen){
-  SPA<char> tmp(tolen+fromlen+1);
-  memcopy(tmp,addto,tolen);
-  memcopy(tmp+tolen,addfrom+fromstart,fromlen);
-  tmp[tolen+fromlen]='\0';
-  addto=tmp;
+}
+void BufHypIStream::mergebufs(SPA<char>& addto,int& tolen,int& tocap,char const* const& addfrom,int& fromstart,int& fromlen){
+  if(addto.isnull() || tolen+fromlen+1>tocap){
+    // grow by doubling so a long string is only copied a few times
+    int cap=tocap<INT_MAX/2 && tocap*2>tolen+fromlen+1?tocap*2:tolen+fromlen+1;
+    SPA<char> tmp(cap);
+    if(tolen>0)
+      memcopy(tmp,addto,tolen);
+    addto=tmp;
+    tocap=cap;
+  }
+  if(fromlen>0)
+    memcopy(addto+tolen,addfrom+fromstart,fromlen);
+  addto[tolen+fromlen]='\0';
   fromstart+=fromlen;
   tolen+=fromlen;
   fromlen=0;
 }
 IOResult BufHypIStream::read(SPA<char const>& str,const bool& quote){
+  if(format==UNKNOWN)
+    detectFormat();
+  if(format==BINARY){
+    unsigned int u;
+    IOResult r=readVarint(u);
+    if(!r.ok)
+      return r;
+    if(u>INT_MAX)
+      return IOResult(false,start==end);
+    // copy what is in the buffer at a time so a corrupt length can't make a huge allocation
+    SPA<char> sb;
+    int sblen=0;
+    int sbcap=0;
+    int need=u;
+    do{
+      if(start>=end && need>0){
+        if(!eof)
+          readtobuf();
+        if(start>=end)
+          return IOResult(false,true);
+      }
+      int l=end-start<need?end-start:need;
+      need-=l;
+      mergebufs(sb,sblen,sbcap,buf,start,l);
+    }while(need>0);
+    if(!isTextString(&*sb,sblen,quote))
+      return IOResult(false,start==end);
+    str=sb;
+    return IOResult(true,start==end);
+  }else if(format==UNSUPPORTED)
+    return IOResult(false,false);
   char d;
   consumewhitespace();
-  // There is at least one char left after start as it was checked and found to not be whitespace
+  // nothing is ever read from past end as the buffer may not be ours to read
+  if(start>=end)
+    return IOResult(false,true);
   if(quote){
     d=*(buf+start);
     if(++start>=end){
@@ -82,19 +370,24 @@ IOResult BufHypIStream::read(SPA<char const>& str,const bool& quote){
   }
   SPA<char> sb;
   int sblen=0;
+  int sbcap=0;
   int l=0;
-  while(! (quote ? *(buf+start+l)==d : HypIStream::isspace(*(buf+start+l))) ){
-    ++l;
+  for(;;){
     if(start+l>=end){
       if(eof)
         break;
-      mergebufs(sb,sblen,buf,start,l);
+      mergebufs(sb,sblen,sbcap,buf,start,l);
       readtobuf();
+      continue;
     }
+    char c=*(buf+start+l);
+    if(quote ? c==d : HypIStream::isspace(c))
+      break;
+    ++l;
   }
-  mergebufs(sb,sblen,buf,start,l);
+  mergebufs(sb,sblen,sbcap,buf,start,l);
   if( quote )
-    if(!(*(buf+start)==d))
+    if(start>=end || !(*(buf+start)==d))
       return IOResult(false,start==end);
     else
       ++start;
@@ -102,7 +395,7 @@ IOResult BufHypIStream::read(SPA<char const>& str,const bool& quote){
   return IOResult(true,start==end);
 }
 
-BufHypOStream::BufHypOStream():len(255),buf(new char[len+1]),end(0){}
+BufHypOStream::BufHypOStream():len(255),buf(new char[len+1]),end(0),binary(false){}
 
 BufHypOStream::~BufHypOStream(){
   delete[] buf;
@@ -118,84 +411,94 @@ bool BufHypOStream::addSpace(){
   return true;
 }
 
-bool BufHypOStream::write(const int& _i,const int& _base){
+bool BufHypOStream::writeVarint(unsigned int u){
+  if(end+5>len)
+    writeToSink();
+  do{
+    unsigned char c=u&0x7f;
+    u>>=7;
+    if(u)
+      c|=0x80;
+    buf[end++]=c;
+  }while(u);
+  return true;
+}
+
+bool BufHypOStream::setBinary(){
+  if(end+HYPIO_BINARY_MAGIC_LEN>len)
+    writeToSink();
+  memcopy(buf+end,HYPIO_BINARY_MAGIC,HYPIO_BINARY_MAGIC_LEN);
+  end+=HYPIO_BINARY_MAGIC_LEN;
+  binary=true;
+  return writeVarint(HYPIO_BINARY_VERSION);
+}
+
+bool BufHypOStream::write(const int& i,const int& base){
+  if(binary)
+    return writeVarint(zigzagEncode(i));
   addSpace();
-  int i=_i;
-  int base=_base;
-  // if negative add "-" to buffer and make positive
-  if (i < 0){
-    if(end+1>len)
-      writeToSink();
-    buf[end]='-';
-    ++end;
-    if(i==INT_MIN){
-      if(end+1>len)
-        writeToSink();
-      buf[end]='*';
-      ++end;
-      return true;
-    }
-    i *= -1;
-  }else
-    if(i==INT_MAX){
-      if(end+1>len)
-        writeToSink();
-      buf[end]='*';
-      ++end;
-      return true;
-    }
-  if(!i){
-    if(end+1>len)
-      writeToSink();
-    buf[end]='0';
-    ++end;
+  // enough for an int in base 2 with a sign
+  char ibuf[34];
+  int idx=sizeof(ibuf);
+  if(i==INT_MIN){
+    ibuf[--idx]='*';
+    ibuf[--idx]='-';
+  }else if(i==INT_MAX){
+    ibuf[--idx]='*';
   }else{
-    if(base==0)
-      base=10;
-    char* ibuf=new char[16];
-    int idx = 16;
-    int ilen = 16;
-    // add numbers
-    while(i){
-      if(--idx<0){
-        char* tmp=new char[len+16];
-        memcopy(tmp+16,ibuf,len);
-        delete[] ibuf;
-        ibuf=tmp;
-        ilen+=16;
-        idx+=16;
-      }
-      if((i % base)>9)
-        ibuf[idx] = (char)('a' - 10 + (i % base));
-      else
-        ibuf[idx] = (char)('0' + (i % base));
-      i /= base;
-    }
-    if(end+ilen-idx>len)
-      writeToSink();
-    memcopy(buf+end,ibuf+idx,ilen-idx);
-    end+=ilen-idx;
-    delete[] ibuf;
+    int b=base<2?10:base;
+    unsigned int u=i<0?0u-(unsigned int)i:(unsigned int)i;
+    do{
+      int d=u%b;
+      ibuf[--idx]=(char)(d>9?'a'-10+d:'0'+d);
+      u/=b;
+    }while(u);
+    if(i<0)
+      ibuf[--idx]='-';
   }
+  int l=sizeof(ibuf)-idx;
+  if(end+l>len)
+    writeToSink();
+  memcopy(buf+end,ibuf+idx,l);
+  end+=l;
+  return true;
+}
+bool BufHypOStream::write(const int* src,int n,const int& base){
+  for(int k=0;k<n;++k)
+    BufHypOStream::write(src[k],base);
   return true;
 }
 bool BufHypOStream::write(const char*& str,const bool& quote){
+  if(binary){
+    int l=strlen(str);
+    writeVarint(l);
+    int s=0;
+    while(l-s>len-end){
+      memcopy(buf+end,str+s,len-end);
+      s+=len-end;
+      end=len;
+      writeToSink();
+    }
+    memcopy(buf+end,str+s,l-s);
+    end+=l-s;
+    return true;
+  }
+  char d='\0';
+  if(quote && !(d=quoteFor(str)))
+    return false;
   addSpace();
-  const char* d=quotechars;
   if(quote){
-    while(strchr(str,*d)!=0)
-      ++d;
     if(end+1>len)
       writeToSink();
-    buf[end]=*d;
+    buf[end]=d;
     ++end;
   }
   int l=strlen(str);
   int s=0;
   while(l-s>len-end){
     memcopy(buf+end,str+s,len-end);
-    end=len;
     s+=len-end;
+    end=len;
     writeToSink();
   }
   memcopy(buf+end,str+s,l-s);
@@ -203,7 +506,7 @@ bool BufHypOStream::write(const char*& str,const bool& quote){
   if(quote){
     if(end+1>len)
       writeToSink();
-    buf[end]=*d;
+    buf[end]=d;
     ++end;
   }
   return true;
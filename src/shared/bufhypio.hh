@@ -36,15 +36,29 @@ class BufHypIStream: public HypIStream{
     /**
      * @param addto the buffer to add data too
      * @param tolen the length of the data in the tolen buffer
+     * @param tocap the size of the addto buffer which is updated if it has to grow
      * @param addfrom the buffer to take the extra data from
      * @param fromstart how far into the buffer to start copying data
      * @param fromlen how much data to copy
      */
-    void mergebufs(SPA<char>& addto,int& tolen,char const* const& addfrom,int& fromstart,int& fromlen);
+    void mergebufs(SPA<char>& addto,int& tolen,int& tocap,char const* const& addfrom,int& fromstart,int& fromlen);
+    /// Set format by checking if the data starts with the binary header
+    /**
+     * The header is consumed if it is there
+     */
+    void detectFormat();
+    /// Read an unsigned varint as used in the binary form
+    /**
+     * @param u reference to a variable to store the value in
+     * @return an IOResult object that contains the status of the read
+     */
+    IOResult readVarint(unsigned int& u);
     // doc copied
     IOResult read(int& i,const int& base);
     // doc copied
     IOResult read(SPA<char const>& str,const bool& quote);
+    // doc copied
+    IOResult read(int* dst,int n,const int& base);
   public:
     ///virtual destructor to delete the buffer
     virtual ~BufHypIStream();
@@ -59,6 +73,7 @@ class BufHypOStream: public HypOStream{
     int len;///<The length of the buffer
     char* buf;///<The actual data buffer
     int end;///<The index of the end of the data (i.e. the length of the data)
+    bool binary;///<if the binary form is being written
     ///Called to actually write data to the destination
     /**
      * this should write all data in the buffer to the destination and set end to 0
@@ -80,12 +95,22 @@ class BufHypOStream: public HypOStream{
      * @return true if the write was successful else false
      */
     bool addSpace();
+    /// add an unsigned varint to the buffer as used in the binary form
+    /**
+     * @param u the value to add
+     * @return true if the write was successful else false
+     */
+    bool writeVarint(unsigned int u);
 
     // doc copied
     bool write(const int&,const int&);
     // doc copied
     bool write(const char*&,const bool&);
+    // doc copied
+    bool write(const int*,int,const int&);
   public:
+    // doc copied
+    bool setBinary();
     /// flush the buffer to the destination
     virtual void flush(){
       writeToSink();
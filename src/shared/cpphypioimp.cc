@@ -3,66 +3,148 @@
  * @brief Implementation of cpphypioimp.hh
  */
 #include "cpphypioimp.hh"
+#include <cstdlib>
 #include <string>
 using namespace std;
 
 #ifdef IOSTREAM
 
+void CPPHypIStream::detectFormat(){
+  format=TEXT;
+  if(is.peek()!=HYPIO_BINARY_MAGIC[0])
+    return;
+  char magic[HYPIO_BINARY_MAGIC_LEN];
+  is.read(magic,HYPIO_BINARY_MAGIC_LEN);
+  unsigned int version;
+  // the bytes can't be put back so anything other than a header we can read is an error
+  if(is.gcount()==HYPIO_BINARY_MAGIC_LEN && memcmp(magic,HYPIO_BINARY_MAGIC,HYPIO_BINARY_MAGIC_LEN)==0 &&
+      readVarint(version).ok && version<=(unsigned int)HYPIO_BINARY_VERSION)
+    format=BINARY;
+  else
+    format=UNSUPPORTED;
+}
+
+IOResult CPPHypIStream::readVarint(unsigned int& u){
+  u=0;
+  // an int never needs more than 5 bytes
+  for(int shift=0;shift<35;shift+=7){
+    int c=is.get();
+    if(c==EOF)
+      return IOResult(false,true);
+    u|=(unsigned int)(c&0x7f)<<shift;
+    if(!(c&0x80))
+      return IOResult(true,is.peek()==EOF);
+  }
+  return IOResult(false,is.eof());
+}
+
 IOResult CPPHypIStream::read(int& i, const int& base){
-  std::istream::sentry s(is);
-  if (!s)
+  if(format==UNKNOWN)
+    detectFormat();
+  if(format==BINARY){
+    unsigned int u;
+    IOResult r=readVarint(u);
+    if(r.ok)
+      i=zigzagDecode(u);
+    return r;
+  }else if(format==UNSUPPORTED)
+    return IOResult(false,false);
+  // read the whole word so it is parsed the same as BufHypIStream does with strtol
+  string token;
+  if(!(is>>token))
     return IOResult(false,is.eof());
-  bool neg=false;
-  int c=is.peek();
-  if(c=='-')
-    neg=true;
-  else if(c=='+')
-    neg=false;
-  if (base==0){
-    is.unsetf(ios_base::basefield);
-  }else if (base==10){
-    is>>dec;
-  }else if(base==8){
-    is>>oct;
-  }else if(base==16){
-    is>>hex;
+  bool eof=is.peek()==EOF;
+  if(token=="*"){
+    i=INT_MAX;
+    return IOResult(true,eof);
   }
-  if(is.fail()){
-    is.clear();
-    c=is.peek();
-    if(c=='*'){
-      is>>c;
-      if(neg)
-        i=INT_MIN;
-      else
-        i=INT_MAX;
-    }else
-      is.clear(is.failbit);
-  }   
-  is>>i;
-  return IOResult(is.good(),is.eof());
+  if(token=="-*"){
+    i=INT_MIN;
+    return IOResult(true,eof);
+  }
+  char* end;
+  long l=strtol(token.c_str(),&end,base);
+  // like BufHypIStream only a lone minus sign at the end can be a number cut short
+  if(end!=token.c_str()+token.size())
+    return IOResult(false,eof && token=="-");
+  i=(int)l;
+  return IOResult(true,eof);
+}
+
+IOResult CPPHypIStream::read(int* dst,int n,const int& base){
+  IOResult r;
+  for(int i=0;i<n;++i)
+    if(!(r=CPPHypIStream::read(dst[i],base)).ok)
+      return r;
+  return r;
 }
 
 IOResult CPPHypIStream::read(SPA<char const>& str,const bool& quote){
-  is>>ws;
-  if(!is.good())
-    return IOResult(false,is.eof());
+  if(format==UNKNOWN)
+    detectFormat();
+  if(format==UNSUPPORTED)
+    return IOResult(false,false);
   string st;
-  if(quote){
-    char d;
-    is>>d;
-    getline(is,st,d);
+  if(format==BINARY){
+    unsigned int u;
+    IOResult r=readVarint(u);
+    if(!r.ok)
+      return r;
+    if(u>INT_MAX)
+      return IOResult(false,is.eof());
+    // read a chunk at a time so a corrupt length can't make a huge allocation
+    char chunk[256];
+    while(u>0){
+      int l=u<sizeof(chunk)?u:sizeof(chunk);
+      is.read(chunk,l);
+      if(is.gcount()!=l)
+        return IOResult(false,true);
+      st.append(chunk,l);
+      u-=l;
+    }
+    if(!isTextString(st.data(),st.size(),quote))
+      return IOResult(false,is.eof());
   }else{
-    is>>st;
+    is>>ws;
+    if(!is.good())
+      return IOResult(false,is.eof());
+    if(quote){
+      char d;
+      is>>d;
+      getline(is,st,d);
+      // the string has to end with the quote
+      if(is.fail() || is.eof())
+        return IOResult(false,true);
+    }else if(!(is>>st))
+      return IOResult(false,is.eof());
   }
   SPA<char> tmp(st.length()+1);
   memcopy(tmp,st.c_str(),st.length());
   tmp[st.length()]='\0';
   str=tmp;
-  return IOResult(is.good(),is.eof());
+  return IOResult(true,is.peek()==EOF);
+}
+
+bool CPPHypOStream::writeVarint(unsigned int u){
+  do{
+    unsigned char c=u&0x7f;
+    u>>=7;
+    if(u)
+      c|=0x80;
+    os.put(c);
+  }while(u);
+  return os.good();
+}
+
+bool CPPHypOStream::setBinary(){
+  os.write(HYPIO_BINARY_MAGIC,HYPIO_BINARY_MAGIC_LEN);
+  binary=true;
+  return writeVarint(HYPIO_BINARY_VERSION);
 }
 
 bool CPPHypOStream::write(const int& i,const int& base){
+  if(binary)
+    return writeVarint(zigzagEncode(i));
   os<<nextSpace();
   if(i==INT_MIN){
     os<<"-*";
@@ -82,17 +164,29 @@ bool CPPHypOStream::write(const int& i,const int& base){
   return os.good();
 }
 
+bool CPPHypOStream::write(const int* src,int n,const int& base){
+  for(int i=0;i<n;++i)
+    if(!CPPHypOStream::write(src[i],base))
+      return false;
+  return true;
+}
+
 bool CPPHypOStream::write(const char*& str,const bool& quote){
-  os<<nextSpace();
-  const char* d=quotechars;
-  if(quote){
-    while(strchr(str,*d)!=0)
-      ++d;
-    os<<*d;
+  if(binary){
+    int l=strlen(str);
+    writeVarint(l);
+    os.write(str,l);
+    return os.good();
   }
+  char d='\0';
+  if(quote && !(d=quoteFor(str)))
+    return false;
+  os<<nextSpace();
+  if(quote)
+    os<<d;
   os<<str;
   if(quote)
-    os<<*d;
+    os<<d;
   return os.good();
 }
 #endif
@@ -22,25 +22,51 @@ class CPPHypIStream: public HypIStream{
      */
     CPPHypIStream(std::istream& is):is(is){};
   protected:
+    /// Set format by checking if the data starts with the binary header
+    /**
+     * The header is consumed if it is there. The istream must be opened in binary mode
+     * for the binary form to be read correctly.
+     */
+    void detectFormat();
+    /// Read an unsigned varint as used in the binary form
+    /**
+     * @param u reference to a variable to store the value in
+     * @return an IOResult object that contains the status of the read
+     */
+    IOResult readVarint(unsigned int& u);
     //doc copied
     IOResult read(int&,const int&);
     //doc copied
     IOResult read(SPA<char const>&,const bool&);
+    //doc copied
+    IOResult read(int*,int,const int&);
 };
 ///An implementation of HypOStream using a c++ std:ostream
 class CPPHypOStream: public HypOStream{
   std::ostream &os;///< The ostream that this writes to
+  bool binary;///< if the binary form is being written
   public:
     /// Create a CPPHypOStream for the specified ostream
     /**
      * @param os the stream to write to
      */
-    CPPHypOStream(std::ostream& os):os(os){};
+    CPPHypOStream(std::ostream& os):os(os),binary(false){};
+    /// @copydoc HypOStream::setBinary
+    /// The ostream must be opened in binary mode
+    bool setBinary();
   protected:
+    /// Write an unsigned varint as used in the binary form
+    /**
+     * @param u the value to write
+     * @return true if it was written ok
+     */
+    bool writeVarint(unsigned int u);
     //doc copied
     bool write(const int&,const int&);
     //doc copied
     bool write(const char*&,const bool&);
+    //doc copied
+    bool write(const int*,int,const int&);
     /// Flushes the ostream we wrap
     virtual void flush(){
       os.flush();
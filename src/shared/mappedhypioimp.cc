@@ -0,0 +1,75 @@
+/**
+ * @file mappedhypioimp.cc
+ * @brief Implementation of mappedhypioimp.hh
+ */
+#include "mappedhypioimp.hh"
+#include <climits>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedHypIStream::MappedHypIStream(const char* filename):handle(0),opened(false){
+  delete[] buf;
+  buf=0;
+  len=0;
+  end=0;
+  eof=true;
+#ifdef _WIN32
+  HANDLE f=CreateFileA(filename,GENERIC_READ,FILE_SHARE_READ,0,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,0);
+  if(f==INVALID_HANDLE_VALUE)
+    return;
+  LARGE_INTEGER size;
+  if(GetFileSizeEx(f,&size) && size.QuadPart<=INT_MAX){
+    opened=true;
+    // an empty file can't be mapped but there is nothing to read anyway
+    if(size.QuadPart>0){
+      handle=CreateFileMappingA(f,0,PAGE_READONLY,0,0,0);
+      if(handle)
+        buf=(char*)MapViewOfFile(handle,FILE_MAP_READ,0,0,0);
+      if(buf)
+        len=end=(int)size.QuadPart;
+      else
+        opened=false;
+    }
+  }
+  CloseHandle(f);
+#else
+  int f=open(filename,O_RDONLY);
+  if(f<0)
+    return;
+  struct stat st;
+  if(fstat(f,&st)==0 && st.st_size<=INT_MAX){
+    opened=true;
+    // an empty file can't be mapped but there is nothing to read anyway
+    if(st.st_size>0){
+      void* p=mmap(0,st.st_size,PROT_READ,MAP_PRIVATE,f,0);
+      if(p!=MAP_FAILED){
+        buf=(char*)p;
+        len=end=(int)st.st_size;
+      }else
+        opened=false;
+    }
+  }
+  close(f);
+#endif
+}
+
+MappedHypIStream::~MappedHypIStream(){
+#ifdef _WIN32
+  if(buf)
+    UnmapViewOfFile(buf);
+  if(handle)
+    CloseHandle(handle);
+#else
+  if(buf)
+    munmap(buf,len);
+#endif
+  // the buffer isn't ours for ~BufHypIStream to delete
+  buf=0;
+}
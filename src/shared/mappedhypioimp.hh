@@ -0,0 +1,49 @@
+/**
+ * @file mappedhypioimp.hh
+ * @brief An implementation of hypio that reads straight from a file mapped into memory
+ */
+#include "bufhypio.hh"
+
+#ifndef MAPPEDHYPIOIMP_HH_INC
+#define MAPPEDHYPIOIMP_HH_INC
+
+/// A HypIStream that reads from a file mapped into memory
+/**
+ * The whole file is the buffer so numbers are parsed straight from the mapping, strings
+ * are copied out of it in a single allocation and nothing is ever refilled. The mapping
+ * is read only and has no terminating null after it so the parsing never looks past the end.
+ */
+class MappedHypIStream: public BufHypIStream{
+  void* handle;///< the handle of the mapping on windows
+  bool opened;///< if the file was opened
+
+  public:
+    /// Map a file to read
+    /**
+     * If the file can't be opened the stream is empty so every read fails
+     * @param filename the name of the file
+     */
+    MappedHypIStream(const char* filename);
+    /// Unmap the file
+    ~MappedHypIStream();
+
+    /// Check if the file was opened
+    /**
+     * @return true if it was opened and mapped
+     */
+    inline bool isOpen() const{
+      return opened;
+    }
+    /// Get the size of the file
+    /**
+     * @return the size in bytes
+     */
+    inline int size() const{
+      return len;
+    }
+
+  protected:
+    /// empty read function
+    void readtobuf(){};
+};
+#endif
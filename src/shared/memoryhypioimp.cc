@@ -3,6 +3,7 @@
  * @brief Implementation of memoryhypioimp.hh
  */
 #include "memoryhypioimp.hh"
+#include <climits>
 #include <cstdlib>
 
 MemoryHypIStream::MemoryHypIStream(SPA<const char> _buf,int _len){
@@ -23,14 +24,21 @@ MemoryHypIStream::MemoryHypIStream(const char* _buf,int _len){
   end=_len;
   eof=true;
 }
-MemoryHypOStream::MemoryHypOStream(SPA<char>& str):str(str),strlen(0){};
+MemoryHypOStream::MemoryHypOStream(SPA<char>& str):str(str),strlen(0),cap(0){};
 
 bool MemoryHypOStream::writeToSink(){
-  SPA<char> tmp(strlen+end+1);
-  memcopy(tmp,str,strlen);
-  memcopy((tmp+strlen),buf,end);
-  tmp[strlen+end]='\0';
-  str=tmp;
+  if(strlen+end+1>cap){
+    // grow by doubling so large outputs are only copied a few times
+    int newcap=cap<INT_MAX/2 && cap*2>strlen+end+1?cap*2:strlen+end+1;
+    SPA<char> tmp(newcap);
+    if(strlen>0)
+      memcopy(tmp,str,strlen);
+    str=tmp;
+    cap=newcap;
+  }
+  memcopy((str+strlen),buf,end);
+  str[strlen+end]='\0';
   strlen=strlen+end;
   end=0;
+  return true;
 }
@@ -40,6 +40,9 @@ class MemoryHypOStream: public BufHypOStream{
   public:
     SPA<char>& str;///< The memory buffer storing the data.
     int strlen;///< The length of data in the buffer.
+  private:
+    int cap;///< The size of the memory buffer which grows by doubling.
+  public:
     /// Create a HypOStream that writes to the specified buffer
     /**
      * The buffer provided will have it's target changed when data is written.
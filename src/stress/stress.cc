@@ -0,0 +1,348 @@
+/**
+ * @file stress.cc
+ * @brief Randomised stress test and throughput benchmark for StringPlay
+ *
+ * Usage: stress [-t threads] [-n operations] [-z size] [-r seed]
+ *
+ * Each thread plays its own generated maze making random selections, slides,
+ * moves, undos and redos. After every operation the string is checked:
+ * - each element starts where the previous one ends and the last ends at the
+ *   end position
+ * - every element is inside the area the string is allowed to move in
+ * - a move never sweeps an element through a wall
+ * - undoing a move gives back exactly the string from before it and redoing
+ *   it gives back exactly the string from after it
+ * - undoing part of a move made in several steps and then the rest gives back
+ *   the string from before it and the parts can be redone
+ * - after any other undo the string is the one the history rebuilds for the
+ *   state undone to, apart from the selection which the history doesn't keep
+ *
+ * After a check fails the string and its history no longer agree so the
+ * session starts again with a new string.
+ *
+ * The number of operations per second is reported so this also works as a
+ * soak test of the string code. The exit status is 1 if any check failed.
+ */
+#include "../core/maze.hh"
+#include "../core/string.hh"
+#include "../core/mazegen.hh"
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+
+/// The most failures each thread describes in full
+const int MAX_REPORTS=5;
+
+/// A copy of a string for comparing
+struct StringCopy{
+  vector<StringElement> route; ///< the elements
+  Vector end; ///< the end position
+  int score; ///< the score
+  /// Copy a string
+  /**
+   * @param s the string
+   * @param score the score
+   * @param selection false to copy every element as unselected
+   */
+  StringCopy(const String& s,int score,bool selection=true):route(),end(s.getEnd()),score(score){
+    for(ConstStringPointer p=s.begin();p!=s.end();++p){
+      route.push_back(*p);
+      if(!selection)
+        route.back().selected=false;
+    }
+  }
+  /// Compare to another copy
+  /**
+   * @param o the other copy
+   * @return true if they are identical
+   */
+  bool operator==(const StringCopy& o) const{
+    if(route.size()!=o.route.size() || end!=o.end || score!=o.score)
+      return false;
+    for(unsigned int i=0;i<route.size();++i)
+      if(route[i].pos!=o.route[i].pos || route[i].d!=o.route[i].d || route[i].selected!=o.route[i].selected)
+        return false;
+    return true;
+  }
+};
+
+/// A single game played by one thread
+class Session{
+  Maze m; ///< the maze
+  SP<String> s; ///< the string
+  StringPlay sp; ///< the play making the moves
+  unsigned int seed; ///< the state of the random number generator
+
+  /// Get a random number
+  /**
+   * rand() can't be used as it is shared by all the threads
+   * @param n one more than the largest number wanted
+   * @return a number from 0 to n-1
+   */
+  int random(int n){
+    seed=seed*1103515245+12345;
+    return (seed>>16)%n;
+  }
+
+  /// Record a failed check
+  /**
+   * @param op the operation that was done
+   * @param what the check that failed
+   * @return false
+   */
+  bool fail(const char* op,const char* what){
+    if(failures<MAX_REPORTS){
+      ostringstream o;
+      o<<"after "<<operations<<" operations: "<<what<<" after "<<op;
+      reports.push_back(o.str());
+    }
+    failures++;
+    broken=true;
+    return false;
+  }
+
+  /// Start again with a new string and history
+  void restart(){
+    s=SP<String>(new String(m));
+    sp.SetString(s);
+    broken=false;
+  }
+
+  /// Check the string is well formed
+  /**
+   * @param op the operation that was just done
+   * @return false if a check failed
+   */
+  bool check(const char* op){
+    const String& t=*s;
+    ConstStringPointer p=t.begin();
+    if(!(p!=t.end()))
+      return fail(op,"empty string");
+    Vector size=m.size();
+    for(;;){
+      Vector pos=p->pos;
+      // moves are only stopped for elements at the limits so the elements
+      // after them can end up one further out
+      if(pos.X<-6 || pos.X>size.X+6 || pos.Y<0 || pos.Y>size.Y || pos.Z<-6 || pos.Z>size.Z+6)
+        return fail(op,"element out of bounds");
+      Vector next=pos+to_vector(p->d);
+      ++p;
+      if(!(p!=t.end())){
+        if(next!=t.getEnd())
+          return fail(op,"end position doesn't match the route");
+        return true;
+      }
+      if(next!=p->pos)
+        return fail(op,"route isn't connected");
+    }
+  }
+
+  /// Check the string is back to what it was
+  /**
+   * @param op the operation that was just done
+   * @param expected the string it should be
+   * @param selection false if expected has every element unselected
+   * @return false if it isn't
+   */
+  bool restored(const char* op,const StringCopy& expected,bool selection=true){
+    if(StringCopy(*s,sp.getScore(),selection)==expected)
+      return true;
+    return fail(op,"string not restored");
+  }
+
+  /// Check the string is the one the history rebuilds for the current state
+  /**
+   * @param op the operation that was just done
+   * @return false if it isn't
+   */
+  bool matchesHistory(const char* op){
+    SP<String> t=sp.materialise(sp.snapshot());
+    return restored(op,StringCopy(*t,sp.getScore(),false),false);
+  }
+
+  /// Check no selected element would be moved through a wall
+  /**
+   * @param d the direction of the move
+   * @return false if an element would hit a wall
+   */
+  bool clearOfWalls(Dirn d){
+    const String& t=*s;
+    for(ConstStringPointer p=t.begin();p!=t.end();++p){
+      if(!p->selected || p->d==d || p->d==opposite(d))
+        continue;
+      Vector wall=p->pos+to_shift_vector(p->d)+to_shift_vector(d);
+      if(inCube(wall,Vector(0,0,0),m.size()) && ((*m[wall])&to_mask(perpendicular(p->d,d)))!=0)
+        return false;
+    }
+    return true;
+  }
+
+  /// Make a random move and check undo and redo reverse it
+  /**
+   * @param multi true to use tryMoves rather than tryMove
+   */
+  void move(bool multi){
+    Dirn d=from_id(random(6));
+    bool clear=clearOfWalls(d);
+    StringCopy before(*s,sp.getScore());
+    int steps=multi?sp.tryMoves(d,1+random(4)):sp.tryMove(d);
+    const char* op=multi?"tryMoves":"tryMove";
+    if(!check(op) || steps==0)
+      return;
+    if(!clear){
+      fail(op,"moved through a wall");
+      return;
+    }
+    if(random(4)!=0)
+      return;
+    StringCopy after(*s,sp.getScore());
+    // sometimes undo part of the move first and then the rest
+    int part=steps>1 && random(2)==0?1+random(steps-1):0;
+    if(part){
+      if(sp.undoSteps(part)!=part){
+        fail("undoSteps","wrong number of steps undone");
+        return;
+      }
+      if(!check("undoSteps"))
+        return;
+    }
+    if(sp.undo()!=steps-part){
+      fail("undo","wrong number of steps undone");
+      return;
+    }
+    if(!check("undo") || !restored("undo",before))
+      return;
+    if(sp.redo()!=steps-part || (part && sp.redo()!=part)){
+      fail("redo","wrong number of steps redone");
+      return;
+    }
+    if(check("redo"))
+      restored("redo",after);
+  }
+
+  public:
+    long long operations; ///< the number of operations done
+    int failures; ///< the number of failed checks
+    bool broken; ///< if the last operation left the string and its history different
+    vector<string> reports; ///< descriptions of the first few failures
+
+    /// Create a new session
+    /**
+     * @param m the maze which mustn't be shared with any other session
+     * @param seed the seed for the random numbers
+     */
+    Session(Maze m,unsigned int seed):m(m),s(new String(m)),sp(s),seed(seed),operations(0),failures(0),broken(false),reports(){};
+
+    /// Do some random operations
+    /**
+     * @param count the number of operations
+     */
+    void run(long long count){
+      for(long long i=0;i<count;++i,++operations){
+        int r=random(20);
+        if(r<8){
+          move(false);
+        }else if(r<10){
+          move(true);
+        }else if(r<13){
+          sp.slide(random(2),random(2));
+          check("slide");
+        }else if(r<15){
+          StringPointer p=s->begin();
+          for(int n=random(s->length());n>0;--n)
+            ++p;
+          sp.setSelected(p,random(2));
+          check("setSelected");
+        }else if(r<18){
+          // the undo can't be checked against the string before the move as that
+          // was many operations ago so it is checked against the history instead
+          int undone=sp.undo();
+          if(check("undo") && undone>0)
+            matchesHistory("undo");
+        }else if(r<19){
+          sp.redo();
+          check("redo");
+        }else if(random(100)==0 || s->hasWon()){
+          // start again now and then so the string doesn't just get longer
+          restart();
+        }
+        if(broken)
+          restart();
+      }
+    }
+};
+
+/// Run a session in a thread
+/**
+ * @param session the session
+ * @param count the number of operations to do
+ */
+void runSession(Session* session,long long count){
+  session->run(count);
+}
+
+int main(int argc,char** argv){
+  int threads=thread::hardware_concurrency();
+  long long count=1000000;
+  int size=8;
+  unsigned int seed=time(0);
+  for(int i=1;i<argc;++i){
+    string arg=argv[i];
+    if(i+1<argc && arg=="-t")
+      threads=atoi(argv[++i]);
+    else if(i+1<argc && arg=="-n")
+      count=atoll(argv[++i]);
+    else if(i+1<argc && arg=="-z")
+      size=atoi(argv[++i]);
+    else if(i+1<argc && arg=="-r")
+      seed=strtoul(argv[++i],0,10);
+    else{
+      cerr<<"Usage: "<<argv[0]<<" [-t threads] [-n operations] [-z size] [-r seed]"<<endl;
+      return 2;
+    }
+  }
+  if(threads<1)
+    threads=1;
+  if(size<3)
+    size=3;
+  cout<<"seed "<<seed<<", "<<threads<<" threads, "<<count<<" operations each on "<<size<<"x"<<size<<"x"<<size<<" mazes"<<endl;
+
+  // The generator uses rand() and the smart pointers aren't thread safe so
+  // each thread gets its own maze made here before any thread starts.
+  srand(seed);
+  vector<Session*> sessions;
+  for(int i=0;i<threads;++i)
+    sessions.push_back(new Session(generate<RandLimitMazeGenHalf<Hunter<RandOrderWalker<DiagonalWalker> > > >(Vector(size,size,size)),seed+i));
+
+  chrono::steady_clock::time_point start=chrono::steady_clock::now();
+  vector<thread*> workers;
+  for(int i=0;i<threads;++i)
+    workers.push_back(new thread(runSession,sessions[i],count));
+  for(int i=0;i<threads;++i){
+    workers[i]->join();
+    delete workers[i];
+  }
+  double seconds=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+
+  long long operations=0;
+  int failures=0;
+  for(int i=0;i<threads;++i){
+    operations+=sessions[i]->operations;
+    failures+=sessions[i]->failures;
+    for(unsigned int j=0;j<sessions[i]->reports.size();++j)
+      cout<<"thread "<<i<<" "<<sessions[i]->reports[j]<<endl;
+    delete sessions[i];
+  }
+  cout<<operations<<" operations in "<<seconds<<"s";
+  if(seconds>0)
+    cout<<" ("<<operations/seconds<<" operations/s)";
+  cout<<endl<<failures<<" failed checks"<<endl;
+  return failures?1:0;
+}
@@ -0,0 +1,251 @@
+/**
+ * @file history.cc
+ * @brief Tests of the undo history of StringPlay
+ */
+#include "unittest.hh"
+#include <vector>
+#include <cstdlib>
+
+using namespace std;
+
+/// The number of moves made by the undo and redo test
+const int UNDO_MOVES=300;
+/// The undo budget in bytes used by the trim test
+const int TRIM_BUDGET=2048;
+/// The number of changes in a row that don't move the string before some moves are undone
+const int STUCK_CHANGES=50;
+
+/// Make a change to the selection or a move
+/**
+ * The same op and arg always make the same change to the same string so two
+ * plays can be kept in step.
+ * @param sp the play to change
+ * @param op a random number choosing what to do
+ * @param arg a random number choosing the element or direction
+ * @return the number of steps moved or 0 for a change to the selection
+ */
+static int randomOp(StringPlay& sp,int op,int arg){
+  SP<String> s=sp.getString();
+  switch(op%6){
+    case 0:
+      {
+        StringPointer p=s->begin();
+        for(int n=arg%s->length();n>0;--n)
+          ++p;
+        sp.setSelected(p,(arg/7)%2);
+      }
+      return 0;
+    case 1:
+      sp.slide(arg&1,arg&2);
+      return 0;
+    case 5:
+      return sp.tryMoves(from_id(arg%6),1+arg/6%4);
+    default:
+      return sp.tryMove(from_id(arg%6))?1:0;
+  }
+}
+
+/// Check a string is back to a copy made earlier
+/**
+ * The selection isn't compared as the history doesn't keep it.
+ * @param expected the copy
+ * @param s the string
+ * @param what a description of the check
+ * @return false if the check failed
+ */
+static bool restored(const StringCopy& expected,const String& s,const char* what){
+  return expect(expected.same(s,false),what);
+}
+
+/// Make random moves keeping a copy of the string and score after each
+/**
+ * A string soon gets stuck so when it stops moving some moves are undone,
+ * which leaves moves that can be redone to be replaced by the next move, and a
+ * single element is selected as undo puts back the selection that got stuck.
+ * @param sp the play to move
+ * @param states the copies of the string, the first is from before the moves
+ * @param scores the scores, the first is from before the moves
+ * @param moves the number of moves to make
+ * @return false if the moves couldn't be made
+ */
+static bool makeMoves(StringPlay& sp,vector<StringCopy>& states,vector<int>& scores,int moves){
+  SP<String> s=sp.getString();
+  for(int i=0,stuck=0;i<moves*STUCK_CHANGES && (int)states.size()<=moves;++i){
+    int op=rand(),arg=rand();
+    if(randomOp(sp,op,arg)>0){
+      states.push_back(StringCopy(*s));
+      scores.push_back(sp.getScore());
+      stuck=0;
+      continue;
+    }
+    if(++stuck<STUCK_CHANGES)
+      continue;
+    stuck=0;
+    for(int n=1+rand()%5;n>0 && sp.undo()>0;--n){
+      states.pop_back();
+      scores.pop_back();
+      if(!restored(states.back(),*s,"undoing while moving didn't give back the string from before the move"))
+        return false;
+    }
+    for(StringPointer p=s->begin();p!=s->end();++p)
+      sp.setSelected(p,false);
+    sp.setSelected(randomElement(s),true);
+  }
+  return expect((int)states.size()>moves,"the string didn't move");
+}
+
+bool testUndoRedo(){
+  Maze m=randomMaze(Vector(6,6,6));
+  SP<String> s(new String(m));
+  StringPlay sp(s);
+  vector<StringCopy> states(1,StringCopy(*s));
+  vector<int> scores(1,sp.getScore());
+  if(!makeMoves(sp,states,scores,UNDO_MOVES))
+    return false;
+
+  // undo to the start and redo to the end
+  int at=states.size()-1;
+  while(at>0){
+    if(!expect(sp.undo()>0,"undo didn't undo a move"))
+      return false;
+    --at;
+    expect(sp.getScore()==scores[at],"undo didn't give back the score from before the move");
+    if(!restored(states[at],*s,"undo didn't give back the string from before the move"))
+      return false;
+  }
+  expect(sp.undo()==0,"undo went past the start");
+
+  while(at<(int)states.size()-1){
+    if(!expect(sp.redo()>0,"redo didn't redo a move"))
+      return false;
+    ++at;
+    expect(sp.getScore()==scores[at],"redo didn't give back the score from after the move");
+    if(!restored(states[at],*s,"redo didn't give back the string from after the move"))
+      return false;
+  }
+  expect(sp.redo()==0,"redo went past the last move");
+  return true;
+}
+
+bool testUndoSteps(){
+  Maze m=randomMaze(Vector(5,5,5));
+  int tested=0;
+  for(int trial=0;trial<300;++trial){
+    // a second play is kept in step to make the move in two parts
+    SP<String> a(new String(m)),b(new String(m));
+    StringPlay pa(a),pb(b);
+    for(int i=rand()%40;i>0;--i){
+      int op=rand(),arg=rand();
+      randomOp(pa,op,arg);
+      randomOp(pb,op,arg);
+    }
+    Dirn d=from_id(rand()%6);
+    StringCopy before(*a);
+    int beforeScore=pa.getScore();
+    int n=pa.tryMoves(d,2+rand()%4);
+    if(n<2)
+      continue;
+    ++tested;
+    StringCopy after(*a);
+    int afterScore=pa.getScore();
+    int k=1+rand()%(n-1);
+    // a move after this one that was undone must still be redone after the steps
+    StringCopy later(*a);
+    int laterDirn=rand()%6;
+    bool moved=pa.tryMove(from_id(laterDirn));
+    if(moved){
+      later=StringCopy(*a);
+      pa.undo();
+    }
+    int node=pa.snapshot(),size=pa.getHistorySize();
+
+    expect(pa.undoSteps(k)==k,"undoSteps didn't undo the steps asked for");
+    expect(pa.snapshot()==node && pa.getHistorySize()==size+1 && pa.getHistoryParent(size)==node,"undoSteps didn't split the move in the history");
+    expect(pb.tryMoves(d,n-k)==n-k,"the first part of the move couldn't be made");
+    expect(StringCopy(*b).same(*a,false) && pa.getScore()==pb.getScore(),"undoSteps didn't give back the string part way through the move");
+    expect(StringCopy(*pa.materialise(node)).same(*a,false),"the history doesn't have the string part way through the move");
+    expect(pa.redo()==k,"redo didn't redo the steps undone");
+    expect(after.same(*a,false) && pa.getScore()==afterScore,"redo didn't give back the string from after the move");
+    if(moved){
+      expect(pa.redo()==1 && later.same(*a,false),"redo didn't give back the move after the one split");
+      pa.undo();
+    }
+    expect(pa.undo()==k,"undo didn't undo the second part of the move");
+    expect(pa.undo()==n-k,"undo didn't undo the first part of the move");
+    expect(before.same(*a,false) && pa.getScore()==beforeScore,"undo didn't give back the string from before the move");
+  }
+  return expect(tested>0,"no move was made in several steps");
+}
+
+bool testCheckpoints(){
+  Maze m=randomMaze(Vector(6,6,6));
+  const int INTERVALS[]={1,4,1000};
+  const int PLAYS=sizeof(INTERVALS)/sizeof(INTERVALS[0]);
+  SP<String> s[PLAYS];
+  StringPlay* sp[PLAYS];
+  for(int i=0;i<PLAYS;++i){
+    s[i]=SP<String>(new String(m));
+    sp[i]=new StringPlay(s[i]);
+    sp[i]->setCheckpointInterval(INTERVALS[i]);
+  }
+  for(int n=0;n<3000;++n){
+    int what=rand()%10,op=rand(),arg=rand();
+    for(int i=0;i<PLAYS;++i){
+      if(what<7)
+        randomOp(*sp[i],op,arg);
+      else if(what<8)
+        sp[i]->undo();
+      else if(what<9)
+        sp[i]->redo();
+      else
+        sp[i]->jumpTo(arg%sp[i]->getHistorySize());
+    }
+    bool same=true;
+    for(int i=1;i<PLAYS && same;++i)
+      same=expect(sameString(*s[0],*s[i]) && sp[0]->getScore()==sp[i]->getScore(),"the string depends on the checkpoint interval");
+    // once one check fails the plays no longer agree so stop
+    if(!same || !restored(StringCopy(*sp[0]->materialise(sp[0]->snapshot())),*s[0],"the string isn't the one the history has"))
+      break;
+  }
+  bool sizes=true;
+  for(int i=1;i<PLAYS;++i)
+    sizes=expect(sp[0]->getHistorySize()==sp[i]->getHistorySize(),"the history size depends on the checkpoint interval") && sizes;
+  for(int node=0;sizes && node<sp[0]->getHistorySize();++node){
+    SP<String> t=sp[0]->materialise(node);
+    for(int i=1;i<PLAYS;++i)
+      if(!expect(sameString(*t,*sp[i]->materialise(node)),"a rebuilt state depends on the checkpoint interval"))
+        break;
+  }
+  for(int i=0;i<PLAYS;++i)
+    delete sp[i];
+  return true;
+}
+
+bool testTrim(){
+  Maze m=randomMaze(Vector(6,6,6));
+  SP<String> s(new String(m));
+  StringPlay sp(s);
+  sp.setUndoBudget(TRIM_BUDGET);
+  vector<StringCopy> states(1,StringCopy(*s));
+  vector<int> scores(1,sp.getScore());
+  for(int i=0;i<UNDO_MOVES/25;++i){
+    if(!makeMoves(sp,states,scores,states.size()+25))
+      return false;
+    if(!expect(sp.getUndoMemory()<=TRIM_BUDGET,"the history is over the budget"))
+      break;
+  }
+  int undone=0;
+  while(sp.undo()>0){
+    ++undone;
+    int i=states.size()-1-undone;
+    if(!expect(i>=0,"undid more moves than were made"))
+      return false;
+    if(!expect(sp.getScore()==scores[i],"undo after trimming didn't give back the score from before the move"))
+      return false;
+    if(!restored(states[i],*s,"undo after trimming didn't give back the string from before the move"))
+      return false;
+  }
+  expect(undone>0,"nothing could be undone after trimming");
+  expect(undone<(int)states.size()-1,"nothing was forgotten");
+  return true;
+}
@@ -0,0 +1,194 @@
+/**
+ * @file levels.cc
+ * @brief Tests of the compressed maze cells and level packs
+ */
+#include "unittest.hh"
+#include "../core/mazecoder.hh"
+#include "../core/levelpack.hh"
+#include "../core/script.hh"
+#include "../shared/cpphypioimp.hh"
+#include "../shared/memoryhypioimp.hh"
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+using namespace std;
+
+/// Get the cells of a maze
+/**
+ * @param m the maze
+ * @param walls true to only keep the walls
+ * @return the cells in the order they are stored in the maze
+ */
+static vector<int> cellsOf(const Maze& m,bool walls){
+  vector<int> cells;
+  const Vector& size=m.size();
+  for(int z=0;z<size.Z;++z)
+    for(int y=0;y<size.Y;++y)
+      for(int x=0;x<size.X;++x)
+        cells.push_back(*m[Vector(x,y,z)]&(walls?ALLDIRNSMASK:~0));
+  return cells;
+}
+
+/// Compress cells and check they decompress to the same walls
+/**
+ * @param cells the cells
+ * @param size the size of the maze
+ * @return the compressed data
+ */
+static vector<unsigned char> roundTrip(const vector<int>& cells,const Vector& size){
+  vector<unsigned char> data;
+  compressCells(&cells[0],size,data);
+  expect(checkCompressedCells(data.empty()?0:&data[0],data.size()),"compressed cells failed the quick check");
+  vector<int> back(cells.size(),-1);
+  expect(decompressCells(data.empty()?0:&data[0],data.size(),size,&back[0]),"compressed cells couldn't be decompressed");
+  bool same=true;
+  for(unsigned int i=0;i<cells.size();++i)
+    same=same && back[i]==(cells[i]&ALLDIRNSMASK);
+  expect(same,"decompressed cells have different walls");
+  return data;
+}
+
+/// Write a maze and script
+/**
+ * @param m the maze
+ * @param sc the script
+ * @param binary true for the binary form
+ * @param compressed true to compress the cells
+ * @return the level
+ */
+static string writeLevel(const Maze& m,const Script& sc,bool binary,bool compressed){
+  ostringstream os;
+  {
+    CPPHypOStream s(os);
+    if(binary)
+      s.setBinary();
+    write(s,m,compressed);
+    write(s,sc);
+  }
+  return os.str();
+}
+
+bool testMazeCoder(){
+  const Vector SIZES[]={Vector(1,1,1),Vector(2,1,1),Vector(1,7,3),Vector(3,3,3),Vector(5,2,9),Vector(8,8,8),Vector(20,20,20)};
+  for(unsigned int i=0;i<sizeof(SIZES)/sizeof(SIZES[0]);++i){
+    Maze m=randomMaze(SIZES[i]);
+    vector<int> cells=cellsOf(m,false);
+    vector<unsigned char> data=roundTrip(cells,m.size());
+    // a real maze has walls that agree between cells so it compresses well
+    if(cells.size()>=1000)
+      expect(data.size()*8<cells.size()*3,"a generated maze took more than 3 bits a cell");
+
+    // every wall bit flipped somewhere so nothing can be predicted
+    for(unsigned int c=0;c<cells.size();++c)
+      if(rand()%4==0)
+        cells[c]^=1<<(rand()%6);
+    roundTrip(cells,m.size());
+
+    // damaged data must be turned down or decompress to something without crashing
+    vector<unsigned char> bad=data;
+    for(int n=0;n<20;++n){
+      bad=data;
+      if(n%2)
+        bad.resize(rand()%(bad.size()+1));
+      else if(!bad.empty()){
+        int at=rand()%bad.size();
+        bad[at]^=1<<(rand()%8);
+      }
+      if(checkCompressedCells(bad.empty()?0:&bad[0],bad.size())){
+        vector<int> back(cells.size());
+        decompressCells(bad.empty()?0:&bad[0],bad.size(),m.size(),&back[0]);
+      }
+    }
+  }
+  expect(!checkCompressedCells(0,0),"no data passed the quick check");
+
+  // the compressed form of a whole level in text and binary
+  Maze m=randomMaze(Vector(7,5,6));
+  Script sc;
+  vector<int> walls=cellsOf(m,true);
+  for(int binary=0;binary<2;++binary){
+    string level=writeLevel(m,sc,binary,true);
+    Maze back(Vector(1,1,1));
+    Script backsc;
+    MemoryHypIStream s(level.data(),level.size());
+    expect(read(s,back).ok && read(s,backsc).ok,"a level with compressed cells couldn't be read");
+    expect(!(back.size()!=m.size()) && cellsOf(back,true)==walls,"a level with compressed cells was read back different");
+  }
+  return true;
+}
+
+bool testLevelPack(){
+  vector<string> names,levels;
+  vector<Vector> sizes;
+  for(int i=0;i<12;++i){
+    // a maze that is read has at least 3 cells each way
+    int x=3+rand()%6,y=3+rand()%6,z=3+rand()%6;
+    Vector size(x,y,z);
+    ostringstream name;
+    name<<"level-"<<i;
+    names.push_back(name.str());
+    levels.push_back(writeLevel(randomMaze(size),Script(),i%2,i%3==0));
+    sizes.push_back(size);
+  }
+  LevelPackWriter writer;
+  for(unsigned int i=0;i<levels.size();++i)
+    expect(writer.add(names[i].c_str(),levels[i].data(),levels[i].size()),"a level couldn't be added");
+  expect(!writer.add(names[0].c_str(),levels[1].data(),levels[1].size()),"a name was used twice");
+  expect(!writer.add("",levels[1].data(),levels[1].size()),"a level was added without a name");
+  expect(!writer.add("a#b",levels[1].data(),levels[1].size()),"a name had the separator in it");
+  expect(!writer.add("bad","not a level",11),"a level that can't be read was added");
+
+  SPA<char> out;
+  int len;
+  if(!expect(writer.write(out,len),"the pack couldn't be written"))
+    return false;
+  expect(memcmp(&*out,LEVELPACK_MAGIC,LEVELPACK_MAGIC_LEN)==0,"the pack doesn't start with the magic");
+
+  LevelPack pack;
+  if(!expect(pack.open(out,len),"the pack couldn't be opened"))
+    return false;
+  if(!expect(pack.levels()==(int)levels.size(),"the pack has the wrong number of levels"))
+    return false;
+  for(unsigned int i=0;i<levels.size();++i){
+    int l=pack.find(names[i].c_str());
+    if(!expect(l>=0,"a level couldn't be found by name"))
+      continue;
+    const LevelPackEntry& e=pack[l];
+    expect(string(&*e.name)==names[i] && !(e.dimensions!=sizes[i]),"the index entry of a level is wrong");
+    expect(e.size==(int)levels[i].size() && string(pack.level(l),e.size)==levels[i],"a level in the pack is different");
+    expect(pack.check(l),"a level failed its checksum");
+    Maze m(Vector(1,1,1));
+    Script sc;
+    expect(pack.read(l,m,sc).ok && !(m.size()!=sizes[i]),"a level couldn't be read from the pack");
+  }
+  expect(pack.find("missing")<0,"a missing level was found");
+
+  // a change to a level is found by its checksum
+  int l=pack.find(names[3].c_str());
+  SPA<char> damaged(len);
+  memcopy(damaged,&*out,len);
+  damaged[pack.level(l)-&*out+pack[l].size/2]^=1;
+  LevelPack bad;
+  if(expect(bad.open(damaged,len),"a pack with a damaged level couldn't be opened")){
+    expect(!bad.check(l),"a damaged level passed its checksum");
+    Maze m(Vector(1,1,1));
+    Script sc;
+    expect(!bad.read(l,m,sc).ok,"a damaged level was read");
+  }
+  for(int cut=0;cut<len;cut+=1+rand()%16){
+    LevelPack truncated;
+    SPA<char> part(cut+1);
+    memcopy(part,&*out,cut);
+    if(truncated.open(part,cut))
+      for(int i=0;i<truncated.levels();++i)
+        truncated.check(i);
+  }
+
+  SPA<const char> packpath,name;
+  expect(splitLevelPath("levels/tutorial.hmp#tutorial-2",packpath,name) && string(&*packpath)=="levels/tutorial.hmp" && string(&*name)=="tutorial-2",
+      "a path to a level in a pack wasn't split");
+  expect(!splitLevelPath("levels/tutorial-2.hml",packpath,name),"a path to a level file was split");
+  return true;
+}
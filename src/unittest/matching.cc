@@ -0,0 +1,398 @@
+/**
+ * @file matching.cc
+ * @brief Tests of the compiled string matcher and event conditions against the code they replaced
+ */
+#include "unittest.hh"
+#include "../core/script.hh"
+#include "../core/scriptimpl.hh"
+#include "../shared/cpphypioimp.hh"
+#include "../shared/memoryhypioimp.hh"
+#include <sstream>
+#include <string>
+#include <vector>
+#include <climits>
+#include <cstdlib>
+
+using namespace std;
+
+/// Get the position of an element in a string
+/**
+ * @param s the string
+ * @param p the element
+ * @return the number of elements before it
+ */
+static int indexOf(SP<String> s,const StringPointer& p){
+  int i=0;
+  for(StringPointer q=s->begin();q!=p;++q)
+    ++i;
+  return i;
+}
+
+/// Give a string a new random route and selection
+/**
+ * @param sp the play of the string
+ * @param length the length of the new route
+ */
+static void randomRoute(StringPlay& sp,int length){
+  SP<String> s=sp.getString();
+  SPA<Dirn> route(length);
+  for(int i=0;i<length;++i)
+    route[i]=from_id(rand()%6);
+  StringEdit se(s);
+  se.setStringSegment(s->begin(),s->end(),length,route);
+  sp.externalEditHappened();
+  for(StringPointer p=s->begin();p!=s->end();++p)
+    sp.setSelected(p,rand()%2);
+}
+
+/// Make a random string pattern
+/**
+ * Some patterns start and end with anything so they can match anywhere.
+ * @param a the matcher to set the pattern and groups of
+ */
+static void randomPattern(StringMatcher& a){
+  a.count=1+rand()%4;
+  a.pattern=SPA<Pair<PatternTag,StringElementCondition> >(a.count);
+  for(int i=0;i<a.count;++i){
+    PatternTag& t=a.pattern[i].a;
+    t.min=rand()%3;
+    t.max=rand()%4==0?INT_MAX:t.min+rand()%4;
+    if(rand()%8==0)
+      t.max=t.min-1;
+    t.greedy=rand()%2;
+    StringElementCondition& c=a.pattern[i].b;
+    c.selectionCondition=rand()%3;
+    c.dirnsCondition=rand()%3==0?63:rand()%64;
+    if(rand()%4==0){
+      c.xrange_count=1;
+      c.xrange=SPA<Range>(1);
+      c.xrange[0].start=rand()%6;
+      c.xrange[0].end=c.xrange[0].start+rand()%4;
+    }
+  }
+  if(rand()%3==0){
+    a.pattern[0].a.min=0;
+    a.pattern[0].a.max=INT_MAX;
+    a.pattern[0].b=StringElementCondition();
+    a.pattern[a.count-1].a.min=0;
+    a.pattern[a.count-1].a.max=INT_MAX;
+    a.pattern[a.count-1].b=StringElementCondition();
+  }
+  a.group_count=rand()%3;
+  a.groups=SPA<Pair<int> >(a.group_count);
+  for(int g=0;g<a.group_count;++g){
+    a.groups[g].a=rand()%a.count;
+    a.groups[g].b=a.groups[g].a+rand()%(a.count-a.groups[g].a);
+  }
+}
+
+bool testMatcher(){
+  Maze m=randomMaze(Vector(6,6,6));
+  SP<String> s(new String(m));
+  StringPlay sp(s);
+  int matches=0;
+  for(int it=0;it<10000;++it){
+    if(it%50==0)
+      randomRoute(sp,10+rand()%40);
+    for(int k=0;k<3;++k){
+      switch(rand()%4){
+        case 0:
+          sp.tryMove(from_id(rand()%6));
+          break;
+        case 1:
+          {
+            bool moveEnd=rand()%2;
+            sp.slide(moveEnd,rand()%2);
+          }
+          break;
+        case 2:
+          {
+            StringPointer p=randomElement(s);
+            sp.setSelected(p,rand()%2);
+          }
+          break;
+        default:
+          sp.undo();
+      }
+    }
+    // the same pattern is matched compiled and by backtracking
+    StringMatcher a;
+    randomPattern(a);
+    StringMatcher b;
+    b.count=a.count;
+    b.pattern=a.pattern;
+    b.group_count=a.group_count;
+    b.groups=a.groups;
+    expect(a.compile(),"a pattern didn't compile");
+
+    SPA<Pair<SP<StringPointer> > > ga(a.group_count),gb(b.group_count);
+    bool ra=a.match(s,ga),rb=b.match(s,gb);
+    if(!expect(ra==rb,"the compiled pattern matched differently"))
+      continue;
+    expect(a.match(SP<const String>(s))==ra && b.match(SP<const String>(s))==rb,"matching without groups gave a different result");
+    if(ra){
+      ++matches;
+      for(int g=0;g<a.group_count;++g)
+        if(!expect(indexOf(s,*ga[g].a)==indexOf(s,*gb[g].a) && indexOf(s,*ga[g].b)==indexOf(s,*gb[g].b),"the compiled pattern found different groups"))
+          break;
+    }
+  }
+  return expect(matches>0,"no pattern matched");
+}
+
+/// Make a random tree of conditions
+/**
+ * @param depth how deep in the tree this is
+ * @param events the number of events in the script
+ * @return the condition
+ */
+static SP<Condition> randomCondition(int depth,int events){
+  switch(rand()%(depth>3?4:7)){
+    case 0:
+      return SP<Condition>(new ConditionTrue());
+    case 1:
+      {
+        ConditionBefore* c=new ConditionBefore();
+        c->event=rand()%events;
+        return SP<Condition>(c);
+      }
+    case 2:
+      {
+        ConditionAfter* c=new ConditionAfter();
+        c->event=rand()%events;
+        c->delay=rand()%5;
+        return SP<Condition>(c);
+      }
+    case 3:
+      {
+        // anything then 1 to 3 elements with a random condition then anything
+        ConditionStringPattern* c=new ConditionStringPattern();
+        StringMatcher& a=c->sm;
+        a.count=3;
+        a.pattern=SPA<Pair<PatternTag,StringElementCondition> >(3);
+        a.pattern[0].a.min=0;
+        a.pattern[0].a.max=INT_MAX;
+        a.pattern[2].a.min=0;
+        a.pattern[2].a.max=INT_MAX;
+        a.pattern[1].a.min=1;
+        a.pattern[1].a.max=1+rand()%3;
+        a.pattern[1].b.selectionCondition=rand()%3;
+        a.pattern[1].b.dirnsCondition=rand()%64;
+        a.compile();
+        return SP<Condition>(c);
+      }
+    case 4:
+      {
+        ConditionNot* c=new ConditionNot();
+        c->condition=randomCondition(depth+1,events);
+        return SP<Condition>(c);
+      }
+  }
+  int n=rand()%4;
+  SPA<SP<Condition> > cs(n);
+  for(int i=0;i<n;++i)
+    cs[i]=randomCondition(depth+1,events);
+  if(rand()%2){
+    ConditionOr* c=new ConditionOr();
+    c->count=n;
+    c->conditions=cs;
+    return SP<Condition>(c);
+  }
+  ConditionAnd* c=new ConditionAnd();
+  c->count=n;
+  c->conditions=cs;
+  return SP<Condition>(c);
+}
+
+/// Access to the private parts of a Script
+struct ScriptTest{
+  /// Check the compiled condition of an event
+  /**
+   * @param sc the script
+   * @param event the index of the event
+   * @param s the current string
+   * @return true if the condition is matched
+   */
+  static bool test(Script& sc,int event,const String& s){
+    return sc.test(event,s);
+  }
+};
+
+bool testConditions(){
+  Maze m=randomMaze(Vector(6,6,6));
+  SP<String> s(new String(m));
+  StringPlay sp(s);
+  int trues=0,tests=0;
+  for(int it=0;it<1000;++it){
+    int events=1+rand()%6;
+    SPA<Event> ev(events);
+    for(int i=0;i<events;++i)
+      ev[i]=Event(rand()%16,randomCondition(0,events),Action::defaultvalue);
+    Script sc(events,ev);
+    for(int k=0;k<30;++k){
+      sc.setnow(k);
+      if(rand()%3==0)
+        sp.tryMove(from_id(rand()%6));
+      else{
+        StringPointer p=randomElement(s);
+        sp.setSelected(p,rand()%2);
+      }
+      for(int i=0;i<events;++i){
+        bool compiled=ScriptTest::test(sc,i,*s);
+        ++tests;
+        if(compiled)
+          ++trues;
+        if(!expect(compiled==ev[i].condition->is(k,sc,*s),"the compiled condition gave a different result"))
+          break;
+      }
+      // run the events so BEFORE and AFTER see events that have happened
+      if(rand()%2)
+        sc.runMove(s);
+      else
+        sc.runSelect(s);
+    }
+  }
+  return expect(trues>0 && trues<tests,"the conditions were all the same");
+}
+
+bool testTruncatedScripts(){
+  Maze m=randomMaze(Vector(6,6,6));
+  SP<String> s(new String(m));
+  int dangling=0;
+  for(int it=0;it<50;++it){
+    int events=2+rand()%6;
+    SPA<Event> ev(events);
+    for(int i=0;i<events;++i)
+      ev[i]=Event(rand()%16,randomCondition(0,events),Action::defaultvalue);
+    Script sc(events,ev);
+    ostringstream os;
+    {
+      CPPHypOStream out(os);
+      if(it%2)
+        out.setBinary();
+      write(out,sc);
+    }
+    string data=os.str();
+    for(unsigned int cut=0;cut<data.size();cut+=1+rand()%8){
+      // the game keeps a level that was partly read so it is run whether or not it was read
+      Script back;
+      MemoryHypIStream in(data.data(),cut);
+      read(in,back);
+      if(back.geteventcount()<events)
+        ++dangling;
+      expect(back.getTime(events)==-1 && back.getTime(-1)==-1,"an event that isn't in the script has a time");
+      for(int k=0;k<5;++k){
+        back.setnow(k);
+        back.runStart(s);
+        back.runMove(s);
+        back.runSelect(s);
+        back.runWin(s);
+      }
+    }
+  }
+  return expect(dangling>0,"no script was cut short");
+}
+
+/// Make a string with a route
+/**
+ * @param m the maze
+ * @param dirns the ids of the directions of the route
+ * @param selection the selection of the elements which is repeated along the string
+ * @return the string
+ */
+static SP<String> makeString(Maze& m,const vector<int>& dirns,const vector<int>& selection){
+  SP<String> s(new String(m));
+  StringEdit se(s);
+  SPA<Dirn> route(dirns.size());
+  for(unsigned int i=0;i<dirns.size();++i)
+    route[i]=from_id(dirns[i]);
+  se.setStringSegment(s->begin(),s->end(),dirns.size(),route);
+  int i=0;
+  for(StringPointer p=s->begin();p!=s->end();++p,++i)
+    se.setSelected(p,selection[i%selection.size()]);
+  return s;
+}
+
+/// Set the route of every match the way ActionSetStringRoute did before it could do it in one pass
+/**
+ * @param a the action
+ * @param s the string to change
+ * @param limit the most matches to change
+ * @return false if there were more matches than the limit
+ */
+static bool setRouteOfMatches(ActionSetStringRoute& a,SP<String> s,int limit){
+  StringEdit se(s);
+  SPA<Pair<SP<StringPointer> > > groups(a.ranges.groupCount());
+  for(int n=0;a.ranges.match(s,groups);){
+    for(int i=0;i<a.ranges.groupCount();++i)
+      se.setStringSegment(*groups[i].a,*groups[i].b,a.count,a.route);
+    if(++n>limit)
+      return false;
+    if(!a.all)
+      break;
+  }
+  return true;
+}
+
+bool testRewriteAll(){
+  Maze m=randomMaze(Vector(6,6,6));
+  int tested=0,singlePass=0;
+  for(int it=0;it<2000;++it){
+    // mostly a zig zag with random directions mixed in
+    vector<int> dirns,selection;
+    int n=rand()%30;
+    int k=1+rand()%3;
+    for(int i=0;i<n;++i)
+      dirns.push_back(rand()%k==0?rand()%6:(i%2?1:4));
+    for(int i=1+rand()%3;i>0;--i)
+      selection.push_back(rand()%2);
+
+    // anything then 1 to 3 elements with random conditions as the only group then anything
+    ActionSetStringRoute a;
+    a.all=true;
+    int core=1+rand()%3;
+    StringMatcher& r=a.ranges;
+    r.count=core+2;
+    r.pattern=SPA<Pair<PatternTag,StringElementCondition> >(core+2);
+    for(int e=0;e<core+2;++e){
+      PatternTag& t=r.pattern[e].a;
+      StringElementCondition& c=r.pattern[e].b;
+      t.greedy=rand()%2;
+      if(e==0||e==core+1){
+        t.min=0;
+        t.max=INT_MAX;
+      }else{
+        t.min=t.max=1+(rand()%4==0);
+        c.dirnsCondition=rand()%3?(1<<(rand()%6)):rand()%64;
+        c.selectionCondition=rand()%3;
+        if(rand()%15==0){
+          c.xrange_count=1;
+          c.xrange=SPA<Range>(1);
+          c.xrange[0].start=0;
+          c.xrange[0].end=3;
+        }
+      }
+    }
+    r.group_count=1;
+    r.groups=SPA<Pair<int> >(1);
+    r.groups[0].a=1;
+    r.groups[0].b=core;
+    r.compile();
+    a.count=rand()%4;
+    a.route=SPA<Dirn>(a.count);
+    for(int i=0;i<a.count;++i)
+      a.route[i]=from_id(rand()%6);
+
+    SP<String> expected=makeString(m,dirns,selection),actual=makeString(m,dirns,selection);
+    // a route that keeps matching would loop forever either way
+    if(!setRouteOfMatches(a,expected,200))
+      continue;
+    ++tested;
+    if(a.singlePass())
+      ++singlePass;
+    ScriptResponse response;
+    a.doCommon(response,actual);
+    expect(sameString(*expected,*actual),"setting the route in one pass gave a different string");
+  }
+  return expect(tested>0 && singlePass>0,"no pattern could be set in one pass");
+}
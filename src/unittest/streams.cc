@@ -0,0 +1,309 @@
+/**
+ * @file streams.cc
+ * @brief Tests of the hypio streams
+ *
+ * CPPHypIStream parses each number with strtol so it is used to check the
+ * faster parsing of BufHypIStream.
+ */
+#include "unittest.hh"
+#include "../shared/cpphypioimp.hh"
+#include "../shared/memoryhypioimp.hh"
+#include <sstream>
+#include <string>
+#include <vector>
+#include <climits>
+#include <cstdlib>
+
+using namespace std;
+
+/// The output streams tested
+enum Output{
+  MEMORY_OUT,///< MemoryHypOStream
+  CPP_OUT,///< CPPHypOStream
+  OUTPUT_COUNT///< the number of output streams
+};
+
+/// Values that are at the edges of the sizes of varint
+const int EDGE_VALUES[]={0,1,-1,63,-64,64,-65,8191,-8192,8192,-8193,1048575,-1048576,
+    1048576,134217727,-134217728,134217728,INT_MAX,INT_MIN,INT_MAX-1,INT_MIN+1};
+
+/// Get a random int with a random number of bits
+/**
+ * @return the number
+ */
+static int randomInt(){
+  unsigned int u=(unsigned int)rand()<<16;
+  u^=(unsigned int)rand();
+  u^=(unsigned int)rand()<<30;
+  return (int)(u>>(rand()%32));
+}
+
+/// Something to write to a stream
+class Writer{
+  public:
+    /// Write to a stream
+    /**
+     * @param s the stream
+     * @return true if it was written
+     */
+    virtual bool write(HypOStream& s) const=0;
+    virtual ~Writer(){};
+};
+
+/// Write to an output stream
+/**
+ * @param out the stream to use
+ * @param binary true to use the binary form
+ * @param w what to write
+ * @return the bytes written
+ */
+static string writeTo(Output out,bool binary,const Writer& w){
+  if(out==MEMORY_OUT){
+    SPA<char> data;
+    MemoryHypOStream s(data);
+    if(binary)
+      s.setBinary();
+    expect(w.write(s),"writing to a memory stream failed");
+    s.flush();
+    return s.strlen>0?string(&*data,s.strlen):string();
+  }
+  ostringstream os;
+  {
+    CPPHypOStream s(os);
+    if(binary)
+      s.setBinary();
+    expect(w.write(s),"writing to a c++ stream failed");
+  }
+  return os.str();
+}
+
+/// Integers and strings to write one at a time
+class ValueWriter: public Writer{
+  public:
+    vector<int> ints;///< the integers which are written first
+    vector<string> strings;///< the strings, which are quoted if they couldn't be read back otherwise
+    bool write(HypOStream& s) const{
+      for(unsigned int i=0;i<ints.size();++i)
+        if(!::write(s,ints[i]))
+          return false;
+      for(unsigned int i=0;i<strings.size();++i){
+        const char* str=strings[i].c_str();
+        if(!::write(s,str,quoted(i)))
+          return false;
+      }
+      return true;
+    }
+    /// Find if a string is quoted
+    /**
+     * The binary form only takes strings the text form can hold so a string
+     * is quoted if it is empty or has a space.
+     * @param i the string
+     * @return true if it is quoted
+     */
+    bool quoted(int i) const{
+      const string& str=strings[i];
+      if(str.empty())
+        return true;
+      for(unsigned int k=0;k<str.size();++k)
+        if(HypIStream::isspace(str[k]))
+          return true;
+      return false;
+    }
+    /// Read the values back and check them
+    /**
+     * @param s the stream
+     * @return true if they were all read back the same
+     */
+    bool check(HypIStream& s) const{
+      for(unsigned int i=0;i<ints.size();++i){
+        int v;
+        if(!read(s,v).ok || v!=ints[i])
+          return false;
+      }
+      for(unsigned int i=0;i<strings.size();++i){
+        SPA<char const> str;
+        if(!read(s,str,quoted(i)).ok || string(&*str)!=strings[i])
+          return false;
+      }
+      return true;
+    }
+};
+
+bool testVarint(){
+  for(int i=0;i<1000;++i){
+    int v=randomInt();
+    if(!expect(zigzagDecode(zigzagEncode(v))==v,"zigzag encoding didn't round trip"))
+      break;
+  }
+  expect(zigzagEncode(0)==0 && zigzagEncode(-1)==1 && zigzagEncode(1)==2 && zigzagEncode(INT_MIN)==UINT_MAX,"zigzag encoding changed");
+
+  ValueWriter small;
+  for(int v=-64;v<64;++v)
+    small.ints.push_back(v);
+  for(int out=0;out<OUTPUT_COUNT;++out){
+    string data=writeTo((Output)out,true,small);
+    // the magic then a byte for the version and each number
+    expect(data.size()==HYPIO_BINARY_MAGIC_LEN+1+small.ints.size(),"small numbers don't take one byte");
+    expect(data.compare(0,HYPIO_BINARY_MAGIC_LEN,HYPIO_BINARY_MAGIC)==0,"the binary form doesn't start with the magic");
+  }
+
+  ValueWriter w;
+  w.ints.assign(EDGE_VALUES,EDGE_VALUES+sizeof(EDGE_VALUES)/sizeof(EDGE_VALUES[0]));
+  for(int i=0;i<5000;++i)
+    w.ints.push_back(randomInt());
+  w.strings.push_back("");
+  w.strings.push_back("a");
+  w.strings.push_back("with \"quotes\" and spaces");
+  w.strings.push_back(string(20000,'x'));
+  for(int i=0;i<200;++i){
+    string str;
+    for(int n=rand()%300;n>0;--n)
+      str+=(char)(1+rand()%255);
+    // a string with every quote in it can't be written
+    if(HypOStream::quoteFor(str.c_str()))
+      w.strings.push_back(str);
+  }
+  string first;
+  for(int out=0;out<OUTPUT_COUNT;++out){
+    string data=writeTo((Output)out,true,w);
+    if(out==0)
+      first=data;
+    else
+      expect(data==first,"the output streams wrote different binary data");
+    MemoryHypIStream mem(data.data(),data.size());
+    expect(w.check(mem),"the memory stream didn't read back what was written");
+    istringstream is(data);
+    CPPHypIStream cpp(is);
+    expect(w.check(cpp),"the c++ stream didn't read back what was written");
+  }
+  return true;
+}
+
+/// Integers to write one at a time or all at once
+class IntsWriter: public Writer{
+  public:
+    vector<int> ints;///< the integers
+    int base;///< the base to write them in
+    bool bulk;///< true to write them all at once
+    bool write(HypOStream& s) const{
+      if(bulk)
+        return ::write(s,&ints[0],ints.size(),base);
+      for(unsigned int i=0;i<ints.size();++i)
+        if(!::write(s,ints[i],base))
+          return false;
+      return true;
+    }
+};
+
+/// Read integers one at a time and all at once and check them
+/**
+ * @param s the stream
+ * @param ints the integers that should be read
+ * @param base the base to read them in
+ * @param bulk true to read them all at once
+ * @return true if they were read back the same
+ */
+static bool readInts(HypIStream& s,const vector<int>& ints,int base,bool bulk){
+  vector<int> got(ints.size());
+  if(bulk){
+    if(!read(s,&got[0],got.size(),base).ok)
+      return false;
+  }else{
+    for(unsigned int i=0;i<got.size();++i)
+      if(!read(s,got[i],base).ok)
+        return false;
+  }
+  return got==ints;
+}
+
+bool testBulk(){
+  const int BASES[]={10,16,8};
+  const int FORMS=sizeof(BASES)/sizeof(BASES[0])+1;
+  IntsWriter w;
+  w.ints.assign(EDGE_VALUES,EDGE_VALUES+sizeof(EDGE_VALUES)/sizeof(EDGE_VALUES[0]));
+  for(int i=0;i<20000;++i)
+    w.ints.push_back(rand()%3?rand()%64:randomInt());
+  // every base c++ streams can write then binary
+  for(int form=0;form<FORMS;++form){
+    bool binary=form==FORMS-1;
+    w.base=binary?10:BASES[form];
+    for(int out=0;out<OUTPUT_COUNT;++out){
+      w.bulk=false;
+      string single=writeTo((Output)out,binary,w);
+      w.bulk=true;
+      string bulk=writeTo((Output)out,binary,w);
+      expect(bulk==single,"writing all at once was different to writing one at a time");
+      for(int readBulk=0;readBulk<2;++readBulk){
+        MemoryHypIStream mem(bulk.data(),bulk.size());
+        expect(readInts(mem,w.ints,w.base,readBulk),"the memory stream didn't read back what was written");
+        istringstream is(bulk);
+        CPPHypIStream cpp(is);
+        expect(readInts(cpp,w.ints,w.base,readBulk),"the c++ stream didn't read back what was written");
+      }
+    }
+  }
+  return true;
+}
+
+/// Make a random token for the hex test
+/**
+ * Most are hex numbers of up to 9 digits but there are also the other tokens
+ * the general parser has to deal with and the occasional invalid one.
+ * @return the token
+ */
+static string randomHexToken(){
+  static const char DIGITS[]="0123456789abcdefABCDEF";
+  static const char* const OTHERS[]={"*","-*","-1","+a","0x1f","0X","-","+","x","g7","1z","7-","\x80","0x"};
+  int r=rand()%40;
+  if(r==0)
+    return OTHERS[rand()%(sizeof(OTHERS)/sizeof(OTHERS[0]))];
+  string t;
+  for(int n=r<4?8+rand()%2:1+rand()%(r<20?2:7);n>0;--n)
+    t+=DIGITS[rand()%(sizeof(DIGITS)-1)];
+  return t;
+}
+
+bool testHex(){
+  static const char SPACES[]=" \t\n\r\v\f";
+  int failed=0;
+  for(int it=0;it<3000;++it){
+    string text;
+    int tokens=1+rand()%200;
+    // make most inputs valid so the whole of them is parsed
+    bool valid=rand()%2;
+    for(int i=0;i<tokens;++i){
+      if(i>0 || rand()%4==0)
+        for(int n=rand()%4==0?1+rand()%3:1;n>0;--n)
+          text+=rand()%5?' ':SPACES[rand()%(sizeof(SPACES)-1)];
+      string t=randomHexToken();
+      while(valid && t.find_first_not_of("0123456789abcdefABCDEF")!=string::npos)
+        t=randomHexToken();
+      text+=t;
+    }
+    if(rand()%2)
+      text+=SPACES[rand()%(sizeof(SPACES)-1)];
+
+    // the reference reads one at a time with strtol
+    vector<int> expected(tokens);
+    IOResult er;
+    int good=0;
+    {
+      istringstream is(text);
+      CPPHypIStream cpp(is);
+      for(;good<tokens;++good)
+        if(!(er=read(cpp,expected[good],16)).ok)
+          break;
+    }
+    vector<int> got(tokens);
+    MemoryHypIStream mem(text.data(),text.size());
+    IOResult r=read(mem,&got[0],tokens,16);
+    if(good<tokens)
+      ++failed;
+    bool same=r.ok==er.ok && r.eof==er.eof;
+    for(int i=0;i<good;++i)
+      same=same && got[i]==expected[i];
+    if(!expect(same,"reading hex all at once gave different results to strtol"))
+      break;
+  }
+  return expect(failed>0 && failed<3000,"the inputs were all valid or all invalid");
+}
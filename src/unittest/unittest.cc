@@ -0,0 +1,133 @@
+/**
+ * @file unittest.cc
+ * @brief Unit and randomised regression tests for the core
+ *
+ * Usage: unittest [-r seed] [test...]
+ *
+ * Runs the named tests, or all of them if none are named, and prints a line
+ * for each. The randomised tests compare a fast path with the simple code it
+ * replaced, or with copies made along the way, on inputs made from the seed,
+ * 1 by default, so a failure can be repeated. Each test is given its own
+ * srand() so they get the same inputs whether run alone or together.
+ *
+ * The exit status is 0 if every test passed, 1 if any failed and 2 for an
+ * unknown test.
+ */
+#include "unittest.hh"
+#include "../core/mazegen.hh"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+using namespace std;
+
+/// A test that can be run by name
+struct UnitTest{
+  const char* name;///< the name to run it by
+  bool (*run)();///< the test, returns false if it failed
+};
+
+/// All the tests in the order they are run
+const UnitTest TESTS[]={
+  {"undo-redo",testUndoRedo},
+  {"undo-steps",testUndoSteps},
+  {"checkpoints",testCheckpoints},
+  {"trim",testTrim},
+  {"matcher",testMatcher},
+  {"conditions",testConditions},
+  {"truncated-scripts",testTruncatedScripts},
+  {"rewrite-all",testRewriteAll},
+  {"varint",testVarint},
+  {"bulk",testBulk},
+  {"hex",testHex},
+  {"mazecoder",testMazeCoder},
+  {"levelpack",testLevelPack}
+};
+/// The number of tests
+const int TEST_COUNT=sizeof(TESTS)/sizeof(TESTS[0]);
+
+/// The most failed checks described for each test
+const int MAX_REPORTS=5;
+
+/// The test being run
+static const char* current="";
+/// The number of failed checks in the test being run
+static int failures=0;
+
+bool expect(bool ok,const char* what){
+  if(!ok){
+    if(failures<MAX_REPORTS)
+      cerr<<current<<": "<<what<<endl;
+    ++failures;
+  }
+  return ok;
+}
+
+Maze randomMaze(const Vector& size){
+  return generate<RandLimitMazeGenHalf<Hunter<RandOrderWalker<DiagonalWalker> > > >(size);
+}
+
+StringCopy::StringCopy(const String& s):route(),end(s.getEnd()){
+  for(ConstStringPointer p=s.begin();p!=s.end();++p)
+    route.push_back(*p);
+}
+
+bool StringCopy::same(const String& s,bool selection) const{
+  if(end!=s.getEnd() || (int)route.size()!=s.length())
+    return false;
+  ConstStringPointer p=s.begin();
+  for(unsigned int i=0;i<route.size();++i,++p)
+    if(route[i].pos!=p->pos || route[i].d!=p->d || (selection && route[i].selected!=p->selected))
+      return false;
+  return true;
+}
+
+StringPointer randomElement(SP<String> s){
+  StringPointer p=s->begin();
+  for(int n=rand()%s->length();n>0;--n)
+    ++p;
+  return p;
+}
+
+int main(int argc,char** argv){
+  unsigned int seed=1;
+  vector<int> run;
+  for(int i=1;i<argc;++i){
+    string arg=argv[i];
+    if(i+1<argc && arg=="-r"){
+      seed=strtoul(argv[++i],0,10);
+      continue;
+    }
+    int t=0;
+    while(t<TEST_COUNT && arg!=TESTS[t].name)
+      ++t;
+    if(t==TEST_COUNT){
+      cerr<<"Usage: "<<argv[0]<<" [-r seed] [test...]"<<endl<<"Tests:";
+      for(t=0;t<TEST_COUNT;++t)
+        cerr<<" "<<TESTS[t].name;
+      cerr<<endl;
+      return 2;
+    }
+    run.push_back(t);
+  }
+  if(run.empty())
+    for(int t=0;t<TEST_COUNT;++t)
+      run.push_back(t);
+
+  int failed=0;
+  for(unsigned int i=0;i<run.size();++i){
+    current=TESTS[run[i]].name;
+    failures=0;
+    srand(seed);
+    bool ok=TESTS[run[i]].run() && failures==0;
+    cout<<current<<": ";
+    if(ok)
+      cout<<"ok"<<endl;
+    else
+      cout<<"FAILED ("<<failures<<" checks)"<<endl;
+    if(!ok)
+      ++failed;
+  }
+  return failed?1:0;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file unittest.hh
+ * @brief The tests run by the unittest tool and the helpers they share
+ */
+#include "../core/string.hh"
+#include "../core/maze.hh"
+#include <vector>
+
+#ifndef UNITTEST_HH_INC
+#define UNITTEST_HH_INC
+
+/// Record the result of a check
+/**
+ * A failed check is reported on standard error with the test it was in.
+ * @param ok if the check passed
+ * @param what a description of what was checked
+ * @return ok
+ */
+bool expect(bool ok,const char* what);
+
+/// Make a random maze
+/**
+ * This uses rand() so the maze depends on the seed given to srand()
+ * @param size the size of the maze
+ * @return the maze
+ */
+Maze randomMaze(const Vector& size);
+
+/// A copy of a string to compare against later
+struct StringCopy{
+  std::vector<StringElement> route;///< the elements
+  Vector end;///< the end position
+  /// Copy a string
+  /**
+   * @param s the string
+   */
+  StringCopy(const String& s);
+  /// Compare to a string
+  /**
+   * @param s the string
+   * @param selection false to ignore which elements are selected
+   * @return true if it has the same route and end
+   */
+  bool same(const String& s,bool selection=true) const;
+};
+
+/// Compare two strings
+/**
+ * @param a the first string
+ * @param b the second string
+ * @param selection false to ignore which elements are selected
+ * @return true if they have the same route and end
+ */
+inline bool sameString(const String& a,const String& b,bool selection=true){
+  return StringCopy(a).same(b,selection);
+}
+
+/// Get a random element of a string
+/**
+ * @param s the string which mustn't be empty
+ * @return a pointer to the element
+ */
+StringPointer randomElement(SP<String> s);
+
+/// Undo and redo of moves against copies of the string made along the way
+bool testUndoRedo();
+/// Undo of part of a move made in several steps
+bool testUndoSteps();
+/// Rebuilding states with different checkpoint intervals
+bool testCheckpoints();
+/// Trimming the history to the undo budget
+bool testTrim();
+
+/// The compiled string matcher against the backtracking one
+bool testMatcher();
+/// The compiled event conditions against the condition trees
+bool testConditions();
+/// Running scripts cut short whose conditions refer to events that were dropped
+bool testTruncatedScripts();
+/// Setting the route of every match in one pass against matching again after each change
+bool testRewriteAll();
+
+/// Integers and strings in the binary form
+bool testVarint();
+/// Reading and writing arrays of integers against one at a time
+bool testBulk();
+/// The block hex parser against the general parser
+bool testHex();
+
+/// Compressing and decompressing maze cells
+bool testMazeCoder();
+/// Writing and opening level packs
+bool testLevelPack();
+
+#endif